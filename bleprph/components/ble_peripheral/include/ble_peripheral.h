@@ -2,6 +2,7 @@
 #define BLE_PERIPHERAL_H
 
 #include <stdbool.h>
+#include "sdkconfig.h"
 #include "nimble/ble.h"
 #include "esp_err.h"
 
@@ -9,6 +10,65 @@
 extern "C" {
 #endif
 
+/** Maximum number of simultaneous central connections */
+#define BLE_PERIPHERAL_MAX_CONNS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+
+/** Link state of one connection */
+typedef struct {
+    uint16_t conn_handle;
+    uint16_t mtu;                   // Negotiated ATT MTU
+    uint16_t conn_itvl;             // Connection interval, 1.25 ms units
+    uint16_t conn_latency;          // Peripheral latency, connection events
+    uint16_t supervision_timeout;   // Supervision timeout, 10 ms units
+    uint32_t first_cmd_ms;          // Connect to first accepted motor command, 0 until then
+} ble_conn_info_t;
+
+/** Connect-to-first-command latency; index 0 = unbonded link, 1 = bonded link */
+typedef struct {
+    uint32_t count[2];
+    uint32_t sum_ms[2];
+    uint32_t max_ms[2];
+} ble_first_cmd_stats_t;
+
+/** Advertising phase; after a disconnect the phases run in this order */
+typedef enum {
+    BLE_ADV_PHASE_IDLE = 0,
+    BLE_ADV_PHASE_DIRECTED,     // High duty directed burst to the last bonded peer (1.28 s)
+    BLE_ADV_PHASE_FAST,         // BLE_ADV_INTERVAL_MIN..MAX for CONFIG_BLE_PERIPHERAL_FAST_ADV_DURATION_S
+    BLE_ADV_PHASE_SLOW,         // CONFIG_BLE_PERIPHERAL_SLOW_ADV_INTERVAL_MS until a client connects
+    BLE_ADV_PHASE_COUNT
+} ble_adv_phase_t;
+
+/** Reconnection and advertising duty statistics, indexed by ble_adv_phase_t */
+typedef struct {
+    uint32_t active_ms[BLE_ADV_PHASE_COUNT];        // Time spent advertising in each phase
+    uint32_t reconnects[BLE_ADV_PHASE_COUNT];       // Connections made after a disconnect or boot
+    uint32_t reconnect_ms_sum[BLE_ADV_PHASE_COUNT]; // Sum of disconnect-to-connect times
+    uint32_t reconnect_ms_max[BLE_ADV_PHASE_COUNT]; // Worst disconnect-to-connect time
+} ble_adv_stats_t;
+
+/**
+ * Called from the NimBLE host task after a link opened or closed and the
+ * connection table was updated; must not block
+ */
+typedef void (*ble_peripheral_conn_cb_t)(uint16_t conn_handle, bool connected, void *arg);
+
+/**
+ * Manufacturer-specific advertising data carrying the motor status:
+ * [company_id:2][version:1][seq:1][status:1][pos_lo:1][pos_hi:1][flags:1]
+ * seq increments on every change so scanners can detect missed updates.
+ */
+#define BLE_ADV_STATUS_LEN      8
+#define BLE_ADV_STATUS_VERSION  1
+#define BLE_ADV_STATUS_F_FAULT  0x01
+
+/** Motor state broadcast in the advertising status record */
+typedef struct {
+    uint8_t status;     // motor_status_t
+    int16_t position;
+    bool fault;
+} ble_adv_status_t;
+
 /**
  * @brief Initialize BLE peripheral
  * @return ESP_OK on success, error code otherwise
@@ -29,16 +89,77 @@ esp_err_t ble_peripheral_stop_advertising(void);
 
 /**
  * @brief Check if connected
- * @return true if connected, false otherwise
+ * @return true if at least one client is connected, false otherwise
  */
 bool ble_peripheral_is_connected(void);
 
 /**
  * @brief Get connection handle
- * @return Connection handle or BLE_HS_CONN_HANDLE_NONE if not connected
+ * @return Handle of the oldest connection or BLE_HS_CONN_HANDLE_NONE if not connected
  */
 uint16_t ble_peripheral_get_conn_handle(void);
 
+/**
+ * @brief Get number of open connections
+ * @return Connection count, at most BLE_PERIPHERAL_MAX_CONNS
+ */
+int ble_peripheral_get_conn_count(void);
+
+/**
+ * @brief Get link state of a connection
+ * @param conn_handle Connection handle
+ * @param info Output link state
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the handle is not connected
+ */
+esp_err_t ble_peripheral_get_conn_info(uint16_t conn_handle, ble_conn_info_t *info);
+
+/**
+ * @brief Register the connection callback (single slot)
+ * @param cb Callback, NULL to remove it
+ * @param arg Passed to the callback
+ */
+void ble_peripheral_set_conn_callback(ble_peripheral_conn_cb_t cb, void *arg);
+
+/**
+ * @brief Check the motion command policy for a connection
+ * @param conn_handle Connection handle
+ * @return true if this connection may issue motion commands
+ */
+bool ble_peripheral_motion_allowed(uint16_t conn_handle);
+
+/**
+ * @brief Update the status record broadcast in advertising
+ * @param status Current motor state; advertising data is only rewritten when it changed
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if status broadcast is disabled
+ */
+esp_err_t ble_peripheral_set_adv_status(const ble_adv_status_t *status);
+
+/**
+ * @brief Get the current advertising phase
+ * @return Advertising phase, BLE_ADV_PHASE_IDLE when not advertising
+ */
+ble_adv_phase_t ble_peripheral_get_adv_phase(void);
+
+/**
+ * @brief Get time-to-reconnect and advertising time per phase
+ * @param stats Output statistics
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if stats is NULL
+ */
+esp_err_t ble_peripheral_get_adv_stats(ble_adv_stats_t *stats);
+
+/**
+ * @brief Note an accepted motor command; the first one per connection is timed
+ * @param conn_handle Connection the command arrived on
+ */
+void ble_peripheral_command_accepted(uint16_t conn_handle);
+
+/**
+ * @brief Get connect-to-first-command latency statistics
+ * @param stats Output statistics
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if stats is NULL
+ */
+esp_err_t ble_peripheral_get_first_cmd_stats(ble_first_cmd_stats_t *stats);
+
 #ifdef __cplusplus
 }
 #endif
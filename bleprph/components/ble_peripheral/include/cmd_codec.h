@@ -0,0 +1,96 @@
+#ifndef CMD_CODEC_H
+#define CMD_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "stepper_motor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Single command: [command:1][param_lo:1][param_hi:1], optionally followed by [move_id:2] */
+#define CMD_CODEC_SINGLE_LEN        3
+#define CMD_CODEC_TAGGED_LEN        5
+
+/**
+ * Batch command: [CMD_CODEC_BATCH_MARKER][tlv_len:1][TLV...]
+ * Each TLV is [type:1][len:1][value:len], where type is a motor_command_t
+ * and value is the little endian parameter (len 2) or empty (len 0).
+ * A CMD_CODEC_TLV_MOVE_ID TLV (len 2) tags the next motion command of the
+ * batch with a move ID.
+ */
+#define CMD_CODEC_BATCH_MARKER      0x80
+#define CMD_CODEC_BATCH_HDR_LEN     2
+#define CMD_CODEC_TLV_HDR_LEN       2
+#define CMD_CODEC_TLV_MOVE_ID       0x10
+#define CMD_CODEC_BATCH_MAX_CMDS    16
+#define CMD_CODEC_BATCH_MAX_LEN     (CMD_CODEC_BATCH_HDR_LEN + CMD_CODEC_BATCH_MAX_CMDS * 2 * (CMD_CODEC_TLV_HDR_LEN + 2))
+
+/**
+ * @brief Characteristic payload decoder producing motor commands
+ *
+ * Every command-carrying characteristic decodes its payload through one of
+ * these so that all writes share a single validated path.
+ *
+ * @param buf Payload
+ * @param len Payload length
+ * @param cmds Output array
+ * @param max_cmds Capacity of cmds
+ * @param count Number of decoded commands
+ * @return ESP_OK, or an error if the payload is malformed
+ */
+typedef esp_err_t (*cmd_codec_decode_fn)(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmds,
+                                         size_t max_cmds, size_t *count);
+
+/**
+ * @brief Decode a position write: [position:2] -> MOVE_ABSOLUTE
+ */
+esp_err_t cmd_codec_decode_position(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmds,
+                                    size_t max_cmds, size_t *count);
+
+/**
+ * @brief Decode a speed write: [delay_ms:2] -> SET_SPEED
+ */
+esp_err_t cmd_codec_decode_speed(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmds,
+                                 size_t max_cmds, size_t *count);
+
+/**
+ * @brief Decode a command characteristic write: single, tagged or batch
+ */
+esp_err_t cmd_codec_decode_command(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmds,
+                                   size_t max_cmds, size_t *count);
+
+/**
+ * @brief Decode a fixed 3-byte command, or a 5-byte command carrying a move ID
+ * @param buf Encoded command
+ * @param len CMD_CODEC_TAGGED_LEN to read a move ID, otherwise at least CMD_CODEC_SINGLE_LEN
+ * @param cmd Decoded command
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE if too short, ESP_ERR_INVALID_ARG for an unknown command
+ */
+esp_err_t cmd_codec_decode_single(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmd);
+
+/**
+ * @brief Decode a TLV batch in one pass
+ *
+ * Either every command of the batch is decoded or none is. When the batch
+ * header is intact, consumed is set even if the TLVs are rejected so the
+ * caller can skip to the next frame.
+ *
+ * @param buf Encoded batch, starting with CMD_CODEC_BATCH_MARKER
+ * @param len Bytes available in buf (may contain trailing frames)
+ * @param cmds Output array
+ * @param max_cmds Capacity of cmds
+ * @param count Number of decoded commands
+ * @param consumed Bytes occupied by the batch
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE if truncated, ESP_ERR_INVALID_ARG for malformed TLVs
+ */
+esp_err_t cmd_codec_decode_batch(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmds,
+                                 size_t max_cmds, size_t *count, size_t *consumed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CMD_CODEC_H
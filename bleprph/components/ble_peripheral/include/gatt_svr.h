@@ -29,6 +29,140 @@ extern "C" {
 #define MOTOR_COMMAND_UUID    "87654321-abcd-ef90-1234-567890abcd02"
 #define MOTOR_STATUS_UUID     "87654321-abcd-ef90-1234-567890abcd03"
 #define MOTOR_SPEED_UUID      "87654321-abcd-ef90-1234-567890abcd04"
+#define MOTOR_STREAM_UUID     "87654321-abcd-ef90-1234-567890abcd05"
+#define MOTOR_ACK_UUID        "87654321-abcd-ef90-1234-567890abcd06"
+#define MOTOR_EVENT_UUID      "87654321-abcd-ef90-1234-567890abcd07"
+#define MOTOR_DB_SIG_UUID     "87654321-abcd-ef90-1234-567890abcd08"
+#define MOTOR_ALERT_UUID      "87654321-abcd-ef90-1234-567890abcd09"
+
+/** Firmware Update Service */
+#define OTA_SERVICE_UUID      "87654321-abcd-ef90-1234-567890abce00"
+#define OTA_CONTROL_UUID      "87654321-abcd-ef90-1234-567890abce01"
+#define OTA_DATA_UUID         "87654321-abcd-ef90-1234-567890abce02"
+
+/** Diagnostics Service */
+#define DIAG_SERVICE_UUID     "87654321-abcd-ef90-1234-567890abcf00"
+#define DIAG_STEP_TIMING_UUID "87654321-abcd-ef90-1234-567890abcf01"
+#define DIAG_LATENCY_UUID     "87654321-abcd-ef90-1234-567890abcf02"
+#define DIAG_CAPTURE_UUID     "87654321-abcd-ef90-1234-567890abcf03"
+#define DIAG_PROFILE_UUID     "87654321-abcd-ef90-1234-567890abcf04"
+#define DIAG_SYSTEM_UUID      "87654321-abcd-ef90-1234-567890abcf05"
+#define DIAG_BOOT_UUID        "87654321-abcd-ef90-1234-567890abcf06"
+#define DIAG_POWER_UUID       "87654321-abcd-ef90-1234-567890abcf07"
+
+/**
+ * Step timing read, little endian:
+ * [total_steps:4][step_rate_hz:4][intervals:4][dev_min_us:4][dev_max_us:4]
+ * [mean_us:4][p50_us:4][p90_us:4][p99_us:4][p999_us:4][max_us:4][buckets:4 x DIAG_HIST_BUCKETS]
+ * Percentiles are bucket upper bounds of |actual - commanded| step interval.
+ */
+#define DIAG_STEP_TIMING_LEN      (44 + 4 * 24)
+
+/** Writing this byte to the step timing characteristic clears the deviation statistics */
+#define DIAG_STEP_TIMING_RESET    0x01
+
+/**
+ * Command latency read, little endian: [over_budget:4][budget_us:4], then for
+ * each motor_latency_stage_t: [count:4][mean_us:4][p50_us:4][p99_us:4][max_us:4][buckets:4 x DIAG_HIST_BUCKETS]
+ */
+#define DIAG_LATENCY_STAGE_LEN    (20 + 4 * 24)
+#define DIAG_LATENCY_LEN          (8 + 4 * DIAG_LATENCY_STAGE_LEN)
+
+/** Writing this byte to the latency characteristic clears the latency statistics */
+#define DIAG_LATENCY_RESET        0x01
+
+/**
+ * Signal capture control opcodes; ARM is followed by [mask:1][value:1][pre_samples:2].
+ * Read: [state:1][count:4][trigger_index:4], little endian.
+ */
+typedef enum {
+    DIAG_CAPTURE_OP_ARM = 0x01,
+    DIAG_CAPTURE_OP_STOP,
+    DIAG_CAPTURE_OP_DUMP
+} diag_capture_op_t;
+
+#define DIAG_CAPTURE_ARM_LEN      5
+#define DIAG_CAPTURE_STATUS_LEN   9
+
+/**
+ * Profile read, little endian: [region_count:1][enabled_mask:1][cycles_per_us:2],
+ * then for each diag_prof_id_t: [count:4][min_cycles:4][avg_cycles:4][max_cycles:4]
+ */
+#define DIAG_PROFILE_HDR_LEN      4
+#define DIAG_PROFILE_REGION_LEN   16
+#define DIAG_PROFILE_MAX_REGIONS  8        // enabled_mask is one byte
+
+/** Profile characteristic writes: clear the statistics, or print the table to the log */
+#define DIAG_PROFILE_RESET        0x01
+#define DIAG_PROFILE_DUMP         0x02
+
+/**
+ * System snapshot read, little endian:
+ * [age_ms:4][period_ms:4][heap_free:4][heap_min_free:4][heap_largest:4]
+ * [queue_depth:2][queue_peak:2][queue_len:2][task_count:1][tasks_total:1]
+ * [att_reads:4][att_writes:4][att_errors:4][notifications:4][indications:4][tx_failures:4],
+ * then task_count x [name:16][cpu_permille:2][priority:1][core:1][stack_hwm_bytes:4]
+ */
+#define DIAG_SYSTEM_HDR_LEN       52
+#define DIAG_SYSTEM_TASK_LEN      24
+
+/**
+ * Boot timeline read, little endian: [stage_count:1][flags:1], then for each
+ * diag_boot_stage_t: [time_us:4], 0 if the stage was not reached yet.
+ * Times count from power-on when flags has DIAG_BOOT_FLAG_FROM_RESET.
+ */
+#define DIAG_BOOT_HDR_LEN         2
+
+/**
+ * Power read, little endian: [flags:1][reserved:1][saving_permille:2][window_ms:4]
+ * [sleep_ms:4][perf_ms:4][sleep_count:4][avg_ua:4][baseline_ua:4]
+ */
+#define DIAG_POWER_LEN            28
+
+/** Writing this byte to the power characteristic starts a new residency window */
+#define DIAG_POWER_RESET          0x01
+
+/** OTA control point opcodes; BEGIN is followed by [image_size:4][sha256:32] */
+typedef enum {
+    OTA_OP_BEGIN = 0x01,
+    OTA_OP_FINISH,
+    OTA_OP_ABORT,
+    OTA_OP_APPLY
+} ota_op_t;
+
+#define OTA_BEGIN_LEN             37
+
+/** OTA data write: [offset:4] followed by image data, little endian */
+#define OTA_DATA_HDR_LEN          4
+
+/** OTA status (control read/notify): [state:1][error:2][received:4][written:4][image_size:4] */
+#define OTA_STATUS_NOTIFY_LEN     15
+
+/** Move event notification: [move_id:2][result:1][position:2][elapsed_ms:4], little endian */
+#define MOTOR_EVENT_NOTIFY_LEN    9
+
+/** Motor alert notification/indication: [type:1][move_id:2][position:2], little endian */
+#define MOTOR_ALERT_NOTIFY_LEN    5
+
+/**
+ * Command stream frame: [seq:1][command:1][param_lo:1][param_hi:1],
+ * or [seq:1] followed by a TLV batch (see cmd_codec.h)
+ */
+#define MOTOR_STREAM_FRAME_LEN    4
+#define MOTOR_STREAM_MAX_WRITE_LEN 244  // One write at the largest common ATT MTU (247)
+
+/** Credits are re-granted once this many queue slots have been freed */
+#define MOTOR_STREAM_CREDIT_BATCH 4
+
+/** Per-frame result reported in command stream acks */
+typedef enum {
+    MOTOR_ACK_ACCEPTED = 0,
+    MOTOR_ACK_QUEUE_FULL,
+    MOTOR_ACK_INVALID_COMMAND,
+    MOTOR_ACK_NOT_READY,
+    MOTOR_ACK_NOT_PERMITTED,    // Rejected by the motion command policy
+    MOTOR_ACK_OUT_OF_SEQUENCE   // Sequence number skips ahead of the next expected frame
+} motor_ack_status_t;
 
 /**
  * @brief Initialize GATT server
@@ -49,6 +183,31 @@ void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
  */
 void gatt_svr_set_motor(void *motor);
 
+struct ble_gap_event;
+
+/**
+ * @brief Track client subscriptions (call from the GAP event handler)
+ * @param event BLE_GAP_EVENT_SUBSCRIBE event
+ */
+void gatt_svr_subscribe_cb(struct ble_gap_event *event);
+
+/**
+ * @brief Drop per-connection GATT state (call from the GAP event handler)
+ * @param conn_handle Handle of the connection that was closed
+ */
+void gatt_svr_disconnect_cb(uint16_t conn_handle);
+
+/**
+ * @brief Compare the GATT database signature with the one stored in NVS
+ *
+ * Call after the host has synced. If the attribute layout changed (e.g. after
+ * a firmware update) a Service Changed indication covering the whole database
+ * is queued for bonded clients, so they drop their cached handles.
+ *
+ * @return ESP_OK on success, NVS error code otherwise
+ */
+esp_err_t gatt_svr_db_check(void);
+
 #ifdef __cplusplus
 }
 #endif
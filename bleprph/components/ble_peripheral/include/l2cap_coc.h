@@ -0,0 +1,79 @@
+#ifndef L2CAP_COC_H
+#define L2CAP_COC_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** L2CAP connection-oriented channel for bulk trajectory upload and log streaming */
+#define L2CAP_COC_PSM             0x0080  // First dynamic LE PSM
+#define L2CAP_COC_MTU             512     // Largest SDU accepted from the peer
+#define L2CAP_COC_RX_BUF_COUNT    3       // SDU buffers: one posted to the stack, the rest waiting for the worker
+
+/**
+ * Every SDU starts with a frame type byte.
+ *
+ * Peer to device:
+ *   TRAJECTORY  [0x01][seq:1] followed by one or more command batches (cmd_codec.h)
+ *   LOG_START   [0x02]
+ *   LOG_STOP    [0x03]
+ *
+ * Device to peer:
+ *   TRAJ_ACK    [0x81][seq:1][status:1][accepted:2], status is a motor_ack_status_t
+ *   LOG_DATA    [0x82][text...]
+ */
+typedef enum {
+    L2CAP_FRAME_TRAJECTORY = 0x01,
+    L2CAP_FRAME_LOG_START  = 0x02,
+    L2CAP_FRAME_LOG_STOP   = 0x03,
+    L2CAP_FRAME_TRAJ_ACK   = 0x81,
+    L2CAP_FRAME_LOG_DATA   = 0x82
+} l2cap_frame_type_t;
+
+#define L2CAP_TRAJ_ACK_LEN        5
+
+/** Transfer counters for the current (or last) channel */
+typedef struct {
+    uint16_t conn_handle;       // BLE_HS_CONN_HANDLE_NONE when no channel is open
+    uint16_t peer_mtu;          // Largest SDU the peer accepts
+    uint32_t rx_sdus;           // Trajectory SDUs received
+    uint32_t rx_bytes;          // Trajectory bytes received
+    uint32_t rx_cmds;           // Commands handed to the motor queue
+    uint32_t rx_active_ms;      // Time between the first and the last trajectory SDU
+    uint32_t queue_waits;       // Times a batch waited for room in the motor queue
+    uint32_t tx_bytes;          // Log bytes sent
+    uint32_t log_dropped;       // Log bytes dropped because the ring was full
+} l2cap_coc_stats_t;
+
+/**
+ * @brief Register the L2CAP CoC server and start its worker task
+ *
+ * Call after nimble_port_init(). Installs an esp_log hook so log output can
+ * be streamed over the channel on request.
+ *
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM is 0,
+ *         error code otherwise
+ */
+esp_err_t l2cap_coc_init(void);
+
+/**
+ * @brief Set motor instance that receives trajectory commands
+ * @param motor Pointer to motor instance
+ */
+void l2cap_coc_set_motor(void *motor);
+
+/**
+ * @brief Get transfer counters
+ * @param stats Output
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if stats is NULL, ESP_ERR_NOT_SUPPORTED if CoC is disabled
+ */
+esp_err_t l2cap_coc_get_stats(l2cap_coc_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // L2CAP_COC_H
@@ -1,6 +1,9 @@
 #include "ble_peripheral.h"
 #include "gatt_svr.h"
+#include "l2cap_coc.h"
+#include "ota_update.h"
 #include "common_types.h"
+#include "diag_boot.h"
 #include "esp_log.h"
 #include "esp_nimble_hci.h"
 #include "nimble/nimble_port.h"
@@ -9,57 +12,239 @@
 #include "host/util/util.h"
 #include "host/ble_uuid.h"
 #include "services/gap/ble_svc_gap.h"
+#include "store/config/ble_store_config.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 static const char *TAG = "BLE_PERIPHERAL";
 
-// Connection handle
-static uint16_t conn_handle = BLE_HS_CONN_HANDLE_NONE;
-static bool is_connected = false;
+// Connection table; conn_handle is BLE_HS_CONN_HANDLE_NONE for a free slot
+typedef struct {
+    ble_conn_info_t info;
+    uint32_t order;             // Connect sequence number, lowest is the oldest link
+    int64_t connect_us;         // Link establishment time
+} ble_conn_t;
+
+// Changed by the GAP event handler on the host task, read from the GATT and
+// L2CAP paths; every access to the table goes through conns_lock
+static ble_conn_t conns[BLE_PERIPHERAL_MAX_CONNS];
+static int conn_count = 0;
+static uint32_t conn_order = 0;
+static portMUX_TYPE conns_lock = portMUX_INITIALIZER_UNLOCKED;
 
 // Advertising data
 static uint8_t ble_addr_type;
 
+#if CONFIG_EXAMPLE_EXTENDED_ADV
+#define BLE_ADV_INSTANCE        0
+#define BLE_ADV_EXT_DATA_LEN    64  // Flags, TX power, name and status record
+#endif
+
+// Advertising phases: directed burst to the last bonded peer, fast, then slow
+#define BLE_ADV_DIRECTED_DURATION_MS    1280    // Spec limit for high duty directed advertising
+#define BLE_ADV_MS_TO_ITVL(ms)          ((ms) * 8 / 5)  // 0.625 ms units
+#define BLE_ADV_SLOW_ITVL_MIN           BLE_ADV_MS_TO_ITVL(CONFIG_BLE_PERIPHERAL_SLOW_ADV_INTERVAL_MS)
+#define BLE_ADV_SLOW_ITVL_MAX           (BLE_ADV_SLOW_ITVL_MIN + BLE_ADV_SLOW_ITVL_MIN / 8)
+
+static ble_adv_phase_t adv_phase = BLE_ADV_PHASE_IDLE;
+static int64_t adv_phase_start_us = 0;
+static int64_t disconnect_us = 0;           // Start of the current reconnect wait, 0 if none
+static ble_addr_t reconnect_peer;           // Identity address of the last bonded peer
+static bool reconnect_peer_valid = false;
+static ble_adv_stats_t adv_stats;
+static ble_first_cmd_stats_t first_cmd_stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static ble_peripheral_conn_cb_t conn_cb = NULL;
+static void *conn_cb_arg = NULL;
+
+#ifdef CONFIG_BLE_PERIPHERAL_ADV_STATUS
+// Manufacturer data status record, see BLE_ADV_STATUS_LEN
+static uint8_t adv_status[BLE_ADV_STATUS_LEN] = {
+    CONFIG_BLE_PERIPHERAL_ADV_COMPANY_ID & 0xFF,
+    (CONFIG_BLE_PERIPHERAL_ADV_COMPANY_ID >> 8) & 0xFF,
+    BLE_ADV_STATUS_VERSION,
+};
+static portMUX_TYPE adv_status_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
 // Event handlers
 static int ble_gap_event(struct ble_gap_event *event, void *arg);
-static void ble_advertise(void);
+static void ble_advertise(ble_adv_phase_t phase);
+static void adv_phase_end(void);
+static void adv_record_reconnect(ble_adv_phase_t phase);
+
+static void conn_notify(uint16_t handle, bool connected) {
+    ble_peripheral_conn_cb_t cb = conn_cb;
+    if (cb != NULL) {
+        cb(handle, connected, conn_cb_arg);
+    }
+}
+
+// Table lookups; call with conns_lock held
+static ble_conn_t *conn_find(uint16_t handle) {
+    for (int i = 0; i < BLE_PERIPHERAL_MAX_CONNS; i++) {
+        if (conns[i].info.conn_handle == handle) {
+            return &conns[i];
+        }
+    }
+    return NULL;
+}
+
+// Oldest open connection, or NULL if none
+static ble_conn_t *conn_oldest(void) {
+    ble_conn_t *oldest = NULL;
+    for (int i = 0; i < BLE_PERIPHERAL_MAX_CONNS; i++) {
+        if (conns[i].info.conn_handle != BLE_HS_CONN_HANDLE_NONE &&
+            (oldest == NULL || conns[i].order < oldest->order)) {
+            oldest = &conns[i];
+        }
+    }
+    return oldest;
+}
+
+// Refresh negotiated connection parameters from the host
+static void conn_update_params(uint16_t handle) {
+    struct ble_gap_conn_desc desc;
+    if (ble_gap_conn_find(handle, &desc) != 0) {
+        return;
+    }
+    
+    taskENTER_CRITICAL(&conns_lock);
+    ble_conn_t *conn = conn_find(handle);
+    if (conn != NULL) {
+        conn->info.conn_itvl = desc.conn_itvl;
+        conn->info.conn_latency = desc.conn_latency;
+        conn->info.supervision_timeout = desc.supervision_timeout;
+    }
+    taskEXIT_CRITICAL(&conns_lock);
+}
+
+static void conn_add(uint16_t handle) {
+    uint16_t mtu = ble_att_mtu(handle);
+    int64_t now = esp_timer_get_time();
+    
+    taskENTER_CRITICAL(&conns_lock);
+    ble_conn_t *conn = conn_find(BLE_HS_CONN_HANDLE_NONE);
+    if (conn != NULL) {
+        memset(conn, 0, sizeof(*conn));
+        conn->info.conn_handle = handle;
+        conn->info.mtu = mtu;
+        conn->order = conn_order++;
+        conn->connect_us = now;
+        conn_count++;
+    }
+    taskEXIT_CRITICAL(&conns_lock);
+    
+    if (conn == NULL) {
+        // Controller accepted more links than we track; should not happen
+        ESP_LOGE(TAG, "No connection slot for handle %d", handle);
+        ble_gap_terminate(handle, BLE_ERR_REM_USER_CONN_TERM);
+        return;
+    }
+    conn_update_params(handle);
+}
+
+static void conn_remove(uint16_t handle) {
+    taskENTER_CRITICAL(&conns_lock);
+    ble_conn_t *conn = conn_find(handle);
+    if (conn != NULL) {
+        conn->info.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        conn_count--;
+    }
+    taskEXIT_CRITICAL(&conns_lock);
+}
 
 // Advertising callback
 static int ble_gap_event(struct ble_gap_event *event, void *arg) {
     switch (event->type) {
-        case BLE_GAP_EVENT_CONNECT:
+        case BLE_GAP_EVENT_CONNECT: {
             ESP_LOGI(TAG, "Connection %s; status=%d",
                     event->connect.status == 0 ? "established" : "failed",
                     event->connect.status);
-                    
+            
+            // A connection ends the advertising set that accepted it
+            ble_adv_phase_t phase = adv_phase;
+            adv_phase_end();
+            
             if (event->connect.status == 0) {
-                conn_handle = event->connect.conn_handle;
-                is_connected = true;
-                ESP_LOGI(TAG, "Connection handle: %d", conn_handle);
+                diag_boot_mark(BOOT_FIRST_CONNECT);
+                conn_add(event->connect.conn_handle);
+                ESP_LOGI(TAG, "Connection handle: %d (%d/%d)",
+                        event->connect.conn_handle, conn_count, BLE_PERIPHERAL_MAX_CONNS);
+                adv_record_reconnect(phase);
+                
+                // Remaining slots are for monitoring clients; advertise slowly
+                ble_advertise(BLE_ADV_PHASE_SLOW);
+                conn_notify(event->connect.conn_handle, true);
             } else {
-                // Connection failed, restart advertising
-                ble_advertise();
+                ble_advertise(phase == BLE_ADV_PHASE_IDLE ? BLE_ADV_PHASE_FAST : phase);
             }
             break;
+        }
             
-        case BLE_GAP_EVENT_DISCONNECT:
-            ESP_LOGI(TAG, "Disconnect; reason=%d", event->disconnect.reason);
-            conn_handle = BLE_HS_CONN_HANDLE_NONE;
-            is_connected = false;
+        case BLE_GAP_EVENT_DISCONNECT: {
+            ESP_LOGI(TAG, "Disconnect; conn_handle=%d reason=%d",
+                    event->disconnect.conn.conn_handle, event->disconnect.reason);
+            conn_remove(event->disconnect.conn.conn_handle);
+            gatt_svr_disconnect_cb(event->disconnect.conn.conn_handle);
+            
+            ble_adv_phase_t phase = BLE_ADV_PHASE_FAST;
+#ifdef CONFIG_BLE_PERIPHERAL_DIRECTED_ADV
+            // A bonded peer gets a directed burst so it can reconnect within a few ms
+            if (event->disconnect.conn.sec_state.bonded) {
+                reconnect_peer = event->disconnect.conn.peer_id_addr;
+                reconnect_peer_valid = true;
+                phase = BLE_ADV_PHASE_DIRECTED;
+            }
+#endif
             
             // Restart advertising
-            ble_advertise();
+            disconnect_us = esp_timer_get_time();
+            ble_advertise(phase);
+            conn_notify(event->disconnect.conn.conn_handle, false);
             break;
+        }
             
-        case BLE_GAP_EVENT_ADV_COMPLETE:
+        case BLE_GAP_EVENT_ADV_COMPLETE: {
             ESP_LOGI(TAG, "Advertising complete; reason=%d", event->adv_complete.reason);
-            ble_advertise();
+            
+            // Reason 0 means the set connected; the connect event handles that
+            if (event->adv_complete.reason == 0) {
+                break;
+            }
+            
+            ble_adv_phase_t phase = adv_phase;
+            adv_phase_end();
+            if (event->adv_complete.reason == BLE_HS_ETIMEOUT) {
+                // Phase timed out: directed -> fast -> slow
+                phase = phase == BLE_ADV_PHASE_DIRECTED ? BLE_ADV_PHASE_FAST : BLE_ADV_PHASE_SLOW;
+            }
+            ble_advertise(phase == BLE_ADV_PHASE_IDLE ? BLE_ADV_PHASE_FAST : phase);
             break;
+        }
             
-        case BLE_GAP_EVENT_CONN_UPDATE:
+        case BLE_GAP_EVENT_ENC_CHANGE:
+            ESP_LOGI(TAG, "Encryption change; conn_handle=%d status=%d",
+                    event->enc_change.conn_handle, event->enc_change.status);
+            break;
+            
+        case BLE_GAP_EVENT_REPEAT_PAIRING: {
+            // Peer lost its bond; delete ours and let it pair again
+            struct ble_gap_conn_desc desc;
+            if (ble_gap_conn_find(event->repeat_pairing.conn_handle, &desc) == 0) {
+                ble_store_util_delete_peer(&desc.peer_id_addr);
+            }
+            return BLE_GAP_REPEAT_PAIRING_RETRY;
+        }
+            
+        case BLE_GAP_EVENT_CONN_UPDATE: {
             ESP_LOGI(TAG, "Connection updated; status=%d", event->conn_update.status);
+            if (event->conn_update.status == 0) {
+                conn_update_params(event->conn_update.conn_handle);
+            }
             break;
+        }
             
         case BLE_GAP_EVENT_SUBSCRIBE:
             ESP_LOGI(TAG, "Subscribe event; conn_handle=%d attr_handle=%d "
@@ -71,14 +256,22 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg) {
                     event->subscribe.cur_notify,
                     event->subscribe.prev_indicate,
                     event->subscribe.cur_indicate);
+            gatt_svr_subscribe_cb(event);
             break;
             
-        case BLE_GAP_EVENT_MTU:
+        case BLE_GAP_EVENT_MTU: {
             ESP_LOGI(TAG, "MTU update event; conn_handle=%d cid=%d mtu=%d",
                     event->mtu.conn_handle,
                     event->mtu.channel_id,
                     event->mtu.value);
+            taskENTER_CRITICAL(&conns_lock);
+            ble_conn_t *conn = conn_find(event->mtu.conn_handle);
+            if (conn != NULL) {
+                conn->info.mtu = event->mtu.value;
+            }
+            taskEXIT_CRITICAL(&conns_lock);
             break;
+        }
             
         default:
             ESP_LOGD(TAG, "Unhandled GAP event: %d", event->type);
@@ -88,43 +281,261 @@ static int ble_gap_event(struct ble_gap_event *event, void *arg) {
     return 0;
 }
 
-// Start advertising
-static void ble_advertise(void) {
-    struct ble_gap_adv_params adv_params;
+// Copy the status record out of the lock; returns NULL when status broadcast is disabled
+static const uint8_t *ble_adv_status_snapshot(uint8_t *buf) {
+#ifdef CONFIG_BLE_PERIPHERAL_ADV_STATUS
+    taskENTER_CRITICAL(&adv_status_lock);
+    memcpy(buf, adv_status, BLE_ADV_STATUS_LEN);
+    taskEXIT_CRITICAL(&adv_status_lock);
+    return buf;
+#else
+    return NULL;
+#endif
+}
+
+// Fill the advertising fields shared by the legacy and extended paths
+static void ble_adv_fill_fields(struct ble_hs_adv_fields *fields, bool with_name, const uint8_t *status) {
+    memset(fields, 0, sizeof(*fields));
+    fields->flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    fields->tx_pwr_lvl_is_present = 1;
+    fields->tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
+    
+    if (with_name) {
+        fields->name = (uint8_t *)BLE_DEVICE_NAME;
+        fields->name_len = strlen(BLE_DEVICE_NAME);
+        fields->name_is_complete = 1;
+    }
+    
+    if (status != NULL) {
+        fields->mfg_data = status;
+        fields->mfg_data_len = BLE_ADV_STATUS_LEN;
+    }
+}
+
+#if CONFIG_EXAMPLE_EXTENDED_ADV
+// Load advertising data into the extended advertising instance
+static int ble_adv_set_data(void) {
     struct ble_hs_adv_fields fields;
+    uint8_t status[BLE_ADV_STATUS_LEN];
+    
+    // Extended PDUs hold the name and the status record together
+    struct os_mbuf *data = os_msys_get_pkthdr(BLE_ADV_EXT_DATA_LEN, 0);
+    if (data == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+    
+    ble_adv_fill_fields(&fields, true, ble_adv_status_snapshot(status));
+    int rc = ble_hs_adv_set_fields_mbuf(&fields, data);
+    if (rc != 0) {
+        os_mbuf_free_chain(data);
+        return rc;
+    }
+    
+    // Takes ownership of the mbuf
+    return ble_gap_ext_adv_set_data(BLE_ADV_INSTANCE, data);
+}
+
+static bool ble_adv_active(void) {
+    return ble_gap_ext_adv_active(BLE_ADV_INSTANCE);
+}
+
+static int ble_adv_stop(void) {
+    return ble_gap_ext_adv_stop(BLE_ADV_INSTANCE);
+}
+
+// Configure and start the advertising instance for one phase
+static int ble_adv_start_phase(ble_adv_phase_t phase) {
+    struct ble_gap_ext_adv_params adv_params;
+    int duration = 0;   // 10 ms units, 0 = until stopped
     int rc;
     
-    // Configure advertising parameters
     memset(&adv_params, 0, sizeof(adv_params));
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
-    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
-    adv_params.itvl_min = BLE_ADV_INTERVAL_MIN;
-    adv_params.itvl_max = BLE_ADV_INTERVAL_MAX;
+    adv_params.connectable = 1;
+    adv_params.own_addr_type = ble_addr_type;
+    adv_params.primary_phy = BLE_HCI_LE_PHY_1M;
+    adv_params.secondary_phy = BLE_HCI_LE_PHY_1M;
+    adv_params.sid = BLE_ADV_INSTANCE;
+    adv_params.tx_power = 127;
+    
+    switch (phase) {
+        case BLE_ADV_PHASE_DIRECTED:
+            // High duty directed advertising only exists as a legacy PDU
+            adv_params.directed = 1;
+            adv_params.high_duty_directed = 1;
+            adv_params.legacy_pdu = 1;
+            adv_params.peer = reconnect_peer;
+            duration = BLE_ADV_DIRECTED_DURATION_MS / 10;
+            break;
+        case BLE_ADV_PHASE_FAST:
+            adv_params.itvl_min = BLE_ADV_INTERVAL_MIN;
+            adv_params.itvl_max = BLE_ADV_INTERVAL_MAX;
+            duration = CONFIG_BLE_PERIPHERAL_FAST_ADV_DURATION_S * 100;
+            break;
+        default:
+            adv_params.itvl_min = BLE_ADV_SLOW_ITVL_MIN;
+            adv_params.itvl_max = BLE_ADV_SLOW_ITVL_MAX;
+            break;
+    }
+    
+    rc = ble_gap_ext_adv_configure(BLE_ADV_INSTANCE, &adv_params, NULL, ble_gap_event, NULL);
+    if (rc != 0) {
+        return rc;
+    }
+    
+    // Directed PDUs carry no advertising data
+    if (phase != BLE_ADV_PHASE_DIRECTED) {
+        rc = ble_adv_set_data();
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    
+    return ble_gap_ext_adv_start(BLE_ADV_INSTANCE, duration, 0);
+}
+#else
+// Load advertising data; the name moves to the scan response when the status record is present
+static int ble_adv_set_data(void) {
+    struct ble_hs_adv_fields fields;
+    uint8_t status_buf[BLE_ADV_STATUS_LEN];
+    const uint8_t *status = ble_adv_status_snapshot(status_buf);
+    
+    // Legacy PDUs are 31 bytes; the name does not fit next to the status record
+    ble_adv_fill_fields(&fields, status == NULL, status);
+    int rc = ble_gap_adv_set_fields(&fields);
+    if (rc != 0 || status == NULL) {
+        return rc;
+    }
     
-    // Configure advertising data
     memset(&fields, 0, sizeof(fields));
-    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
-    fields.tx_pwr_lvl_is_present = 1;
-    fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
     fields.name = (uint8_t *)BLE_DEVICE_NAME;
     fields.name_len = strlen(BLE_DEVICE_NAME);
     fields.name_is_complete = 1;
+    return ble_gap_adv_rsp_set_fields(&fields);
+}
+
+static bool ble_adv_active(void) {
+    return ble_gap_adv_active();
+}
+
+static int ble_adv_stop(void) {
+    return ble_gap_adv_stop();
+}
+
+// Start legacy advertising for one phase
+static int ble_adv_start_phase(ble_adv_phase_t phase) {
+    struct ble_gap_adv_params adv_params;
+    int32_t duration_ms = BLE_HS_FOREVER;
+    int rc;
+    
+    memset(&adv_params, 0, sizeof(adv_params));
+    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
+    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
     
-    rc = ble_gap_adv_set_fields(&fields);
+    switch (phase) {
+        case BLE_ADV_PHASE_DIRECTED:
+            adv_params.conn_mode = BLE_GAP_CONN_MODE_DIR;
+            adv_params.disc_mode = BLE_GAP_DISC_MODE_NON;
+            adv_params.high_duty_cycle = 1;
+            return ble_gap_adv_start(ble_addr_type, &reconnect_peer, BLE_ADV_DIRECTED_DURATION_MS,
+                                     &adv_params, ble_gap_event, NULL);
+        case BLE_ADV_PHASE_FAST:
+            adv_params.itvl_min = BLE_ADV_INTERVAL_MIN;
+            adv_params.itvl_max = BLE_ADV_INTERVAL_MAX;
+            duration_ms = CONFIG_BLE_PERIPHERAL_FAST_ADV_DURATION_S * 1000;
+            break;
+        default:
+            adv_params.itvl_min = BLE_ADV_SLOW_ITVL_MIN;
+            adv_params.itvl_max = BLE_ADV_SLOW_ITVL_MAX;
+            break;
+    }
+    
+    // Configure advertising data
+    rc = ble_adv_set_data();
     if (rc != 0) {
-        ESP_LOGE(TAG, "Error setting advertisement data; rc=%d", rc);
+        return rc;
+    }
+    
+    return ble_gap_adv_start(ble_addr_type, NULL, duration_ms,
+                             &adv_params, ble_gap_event, NULL);
+}
+#endif // CONFIG_EXAMPLE_EXTENDED_ADV
+
+static const char *adv_phase_name(ble_adv_phase_t phase) {
+    switch (phase) {
+        case BLE_ADV_PHASE_DIRECTED:
+            return "directed";
+        case BLE_ADV_PHASE_FAST:
+            return "fast";
+        case BLE_ADV_PHASE_SLOW:
+            return "slow";
+        default:
+            return "idle";
+    }
+}
+
+// Close the running phase and account its advertising time
+static void adv_phase_end(void) {
+    if (adv_phase == BLE_ADV_PHASE_IDLE) {
         return;
     }
     
-    // Start advertising
-    rc = ble_gap_adv_start(ble_addr_type, NULL, BLE_HS_FOREVER,
-                          &adv_params, ble_gap_event, NULL);
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - adv_phase_start_us) / 1000);
+    taskENTER_CRITICAL(&stats_lock);
+    adv_stats.active_ms[adv_phase] += elapsed_ms;
+    taskEXIT_CRITICAL(&stats_lock);
+    adv_phase = BLE_ADV_PHASE_IDLE;
+}
+
+// Record the disconnect-to-connect time against the phase that produced the link
+static void adv_record_reconnect(ble_adv_phase_t phase) {
+    if (disconnect_us == 0) {
+        return;
+    }
+    
+    uint32_t elapsed_ms = (uint32_t)((esp_timer_get_time() - disconnect_us) / 1000);
+    disconnect_us = 0;
+    
+    taskENTER_CRITICAL(&stats_lock);
+    adv_stats.reconnects[phase]++;
+    adv_stats.reconnect_ms_sum[phase] += elapsed_ms;
+    if (elapsed_ms > adv_stats.reconnect_ms_max[phase]) {
+        adv_stats.reconnect_ms_max[phase] = elapsed_ms;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+    
+    ESP_LOGI(TAG, "Reconnected after %lu ms (%s advertising)", (unsigned long)elapsed_ms, adv_phase_name(phase));
+}
+
+// Start advertising in the given phase, replacing a different running phase
+static void ble_advertise(ble_adv_phase_t phase) {
+    int rc;
+    
+    if (conn_count >= BLE_PERIPHERAL_MAX_CONNS) {
+        ESP_LOGI(TAG, "All %d connection slots in use; advertising paused", BLE_PERIPHERAL_MAX_CONNS);
+        return;
+    }
+    if (phase == BLE_ADV_PHASE_DIRECTED && !reconnect_peer_valid) {
+        phase = BLE_ADV_PHASE_FAST;
+    }
+    
+    if (ble_adv_active()) {
+        if (phase == adv_phase) {
+            return;
+        }
+        ble_adv_stop();
+    }
+    adv_phase_end();
+    
+    rc = ble_adv_start_phase(phase);
     if (rc != 0) {
-        ESP_LOGE(TAG, "Error enabling advertisement; rc=%d", rc);
+        ESP_LOGE(TAG, "Error enabling %s advertisement; rc=%d", adv_phase_name(phase), rc);
         return;
     }
     
-    ESP_LOGI(TAG, "Advertising started");
+    adv_phase = phase;
+    adv_phase_start_us = esp_timer_get_time();
+    diag_boot_mark(BOOT_FIRST_ADV);
+    ESP_LOGI(TAG, "Advertising started (%s)", adv_phase_name(phase));
 }
 
 // BLE stack reset callback
@@ -136,6 +547,8 @@ static void ble_on_reset(int reason) {
 static void ble_on_sync(void) {
     int rc;
     
+    diag_boot_mark(BOOT_BLE_SYNC);
+    
     // Determine the best address type
     rc = ble_hs_util_ensure_addr(0);
     if (rc != 0) {
@@ -159,8 +572,24 @@ static void ble_on_sync(void) {
                 addr_val[2], addr_val[1], addr_val[0]);
     }
     
+    ble_adv_phase_t phase = BLE_ADV_PHASE_FAST;
+#ifdef CONFIG_BLE_PERIPHERAL_DIRECTED_ADV
+    // After a reboot, give the bonded controller the first chance to reconnect
+    ble_addr_t peers[1];
+    int num_peers = 0;
+    if (ble_store_util_bonded_peers(peers, &num_peers, 1) == 0 && num_peers > 0) {
+        reconnect_peer = peers[0];
+        reconnect_peer_valid = true;
+        disconnect_us = esp_timer_get_time();
+        phase = BLE_ADV_PHASE_DIRECTED;
+    }
+#endif
+    
+    // Indicate Service Changed to bonded clients if the GATT database differs from their cache
+    gatt_svr_db_check();
+    
     // Start advertising
-    ble_advertise();
+    ble_advertise(phase);
 }
 
 // BLE host task
@@ -178,6 +607,10 @@ esp_err_t ble_peripheral_init(void) {
     
     ESP_LOGI(TAG, "Initializing BLE peripheral");
     
+    for (int i = 0; i < BLE_PERIPHERAL_MAX_CONNS; i++) {
+        conns[i].info.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    
     // Initialize NVS for BLE stack
     ret = nimble_port_init();
     if (ret != ESP_OK) {
@@ -191,6 +624,22 @@ esp_err_t ble_peripheral_init(void) {
     ble_hs_cfg.gatts_register_cb = gatt_svr_register_cb;
     ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
     
+    // Security manager; bonding keeps the keys needed for directed reconnection
+    ble_hs_cfg.sm_io_cap = CONFIG_EXAMPLE_IO_TYPE;
+#ifdef CONFIG_EXAMPLE_BONDING
+    ble_hs_cfg.sm_bonding = 1;
+    ble_hs_cfg.sm_our_key_dist |= BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+    ble_hs_cfg.sm_their_key_dist |= BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID;
+#endif
+#ifdef CONFIG_EXAMPLE_MITM
+    ble_hs_cfg.sm_mitm = 1;
+#endif
+#ifdef CONFIG_EXAMPLE_USE_SC
+    ble_hs_cfg.sm_sc = 1;
+#else
+    ble_hs_cfg.sm_sc = 0;
+#endif
+    
     // Set device name
     ble_svc_gap_device_name_set(BLE_DEVICE_NAME);
     ble_svc_gap_device_appearance_set(BLE_APPEARANCE);
@@ -202,6 +651,16 @@ esp_err_t ble_peripheral_init(void) {
         return ret;
     }
     
+    // Bulk transfer channel; the GATT service works without it
+    ret = l2cap_coc_init();
+    if (ret != ESP_OK && ret != ESP_ERR_NOT_SUPPORTED) {
+        ESP_LOGE(TAG, "Failed to initialize L2CAP CoC server");
+        return ret;
+    }
+    
+    // Bond storage (persisted in NVS when CONFIG_BT_NIMBLE_NVS_PERSIST is set)
+    ble_store_config_init();
+    
     // Start the FreeRTOS task for BLE host
     nimble_port_freertos_init(ble_host_task);
     
@@ -210,30 +669,191 @@ esp_err_t ble_peripheral_init(void) {
 }
 
 esp_err_t ble_peripheral_start_advertising(void) {
-    if (is_connected) {
-        ESP_LOGW(TAG, "Already connected, cannot start advertising");
+    if (conn_count >= BLE_PERIPHERAL_MAX_CONNS) {
+        ESP_LOGW(TAG, "No free connection slot, cannot start advertising");
         return ESP_ERR_INVALID_STATE;
     }
     
-    ble_advertise();
+    ble_advertise(BLE_ADV_PHASE_FAST);
     return ESP_OK;
 }
 
 esp_err_t ble_peripheral_stop_advertising(void) {
-    int rc = ble_gap_adv_stop();
+    int rc = ble_adv_stop();
     if (rc != 0) {
         ESP_LOGE(TAG, "Failed to stop advertising: %d", rc);
         return ESP_FAIL;
     }
     
+    adv_phase_end();
     ESP_LOGI(TAG, "Advertising stopped");
     return ESP_OK;
 }
 
 bool ble_peripheral_is_connected(void) {
-    return is_connected;
+    return conn_count > 0;
 }
 
 uint16_t ble_peripheral_get_conn_handle(void) {
-    return conn_handle;
-} 
\ No newline at end of file
+    taskENTER_CRITICAL(&conns_lock);
+    ble_conn_t *conn = conn_oldest();
+    uint16_t handle = conn != NULL ? conn->info.conn_handle : BLE_HS_CONN_HANDLE_NONE;
+    taskEXIT_CRITICAL(&conns_lock);
+    return handle;
+}
+
+int ble_peripheral_get_conn_count(void) {
+    return conn_count;
+}
+
+void ble_peripheral_set_conn_callback(ble_peripheral_conn_cb_t cb, void *arg) {
+    conn_cb_arg = arg;
+    conn_cb = cb;
+}
+
+esp_err_t ble_peripheral_get_conn_info(uint16_t conn_handle, ble_conn_info_t *info) {
+    if (info == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    
+    taskENTER_CRITICAL(&conns_lock);
+    ble_conn_t *conn = conn_find(conn_handle);
+    if (conn != NULL) {
+        *info = conn->info;
+    }
+    taskEXIT_CRITICAL(&conns_lock);
+    return conn != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+bool ble_peripheral_motion_allowed(uint16_t conn_handle) {
+    // No motion while a firmware image is being received or waits for restart
+    if (ota_update_is_active()) {
+        return false;
+    }
+    
+#ifdef CONFIG_BLE_PERIPHERAL_MOTION_FIRST_CONN
+    // The oldest connection controls the axis; control passes on when it disconnects
+    taskENTER_CRITICAL(&conns_lock);
+    ble_conn_t *conn = conn_oldest();
+    bool allowed = conn != NULL && conn->info.conn_handle == conn_handle;
+    taskEXIT_CRITICAL(&conns_lock);
+    return allowed;
+#else
+    return true;
+#endif
+}
+
+esp_err_t ble_peripheral_set_adv_status(const ble_adv_status_t *status) {
+#ifdef CONFIG_BLE_PERIPHERAL_ADV_STATUS
+    if (status == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    uint8_t flags = status->fault ? BLE_ADV_STATUS_F_FAULT : 0;
+    
+    taskENTER_CRITICAL(&adv_status_lock);
+    bool changed = adv_status[4] != status->status ||
+                   adv_status[5] != (uint8_t)(status->position & 0xFF) ||
+                   adv_status[6] != (uint8_t)((status->position >> 8) & 0xFF) ||
+                   adv_status[7] != flags;
+    if (changed) {
+        adv_status[3]++;    // Sequence number lets scanners spot missed updates
+        adv_status[4] = status->status;
+        adv_status[5] = status->position & 0xFF;
+        adv_status[6] = (status->position >> 8) & 0xFF;
+        adv_status[7] = flags;
+    }
+    taskEXIT_CRITICAL(&adv_status_lock);
+    
+    // Advertising data can be replaced while advertising is active; directed PDUs carry none
+    if (!changed || !ble_hs_synced() || adv_phase == BLE_ADV_PHASE_DIRECTED) {
+        return ESP_OK;
+    }
+    
+    int rc = ble_adv_set_data();
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Failed to refresh advertised status; rc=%d", rc);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+ble_adv_phase_t ble_peripheral_get_adv_phase(void) {
+    return adv_phase;
+}
+
+esp_err_t ble_peripheral_get_adv_stats(ble_adv_stats_t *stats) {
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    taskENTER_CRITICAL(&stats_lock);
+    *stats = adv_stats;
+    taskEXIT_CRITICAL(&stats_lock);
+    
+    // Include the running phase up to now
+    ble_adv_phase_t phase = adv_phase;
+    if (phase != BLE_ADV_PHASE_IDLE) {
+        stats->active_ms[phase] += (uint32_t)((esp_timer_get_time() - adv_phase_start_us) / 1000);
+    }
+    return ESP_OK;
+}
+
+void ble_peripheral_command_accepted(uint16_t conn_handle) {
+    if (conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return;
+    }
+    
+    // Claim the first command under the lock so two transports cannot both count it
+    int64_t now = esp_timer_get_time();
+    uint32_t elapsed_ms = 0;
+    taskENTER_CRITICAL(&conns_lock);
+    ble_conn_t *conn = conn_find(conn_handle);
+    bool first = conn != NULL && conn->info.first_cmd_ms == 0;
+    if (first) {
+        elapsed_ms = (uint32_t)((now - conn->connect_us) / 1000);
+        conn->info.first_cmd_ms = elapsed_ms > 0 ? elapsed_ms : 1;
+    }
+    taskEXIT_CRITICAL(&conns_lock);
+    if (!first) {
+        return;
+    }
+    
+    // Bonded links can skip discovery by reusing cached handles
+    struct ble_gap_conn_desc desc;
+    int bonded = ble_gap_conn_find(conn_handle, &desc) == 0 && desc.sec_state.bonded ? 1 : 0;
+    
+    taskENTER_CRITICAL(&stats_lock);
+    first_cmd_stats.count[bonded]++;
+    first_cmd_stats.sum_ms[bonded] += elapsed_ms;
+    if (elapsed_ms > first_cmd_stats.max_ms[bonded]) {
+        first_cmd_stats.max_ms[bonded] = elapsed_ms;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+    
+    ESP_LOGI(TAG, "First command %lu ms after connect; conn_handle=%d %s",
+            (unsigned long)elapsed_ms, conn_handle, bonded ? "bonded" : "unbonded");
+    
+    // The boot timeline is complete with the first command since power-on
+    if (diag_boot_mark(BOOT_FIRST_MOTION)) {
+        diag_boot_dump();
+    }
+}
+
+esp_err_t ble_peripheral_get_first_cmd_stats(ble_first_cmd_stats_t *stats) {
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    taskENTER_CRITICAL(&stats_lock);
+    *stats = first_cmd_stats;
+    taskEXIT_CRITICAL(&stats_lock);
+    return ESP_OK;
+}
@@ -0,0 +1,169 @@
+#include "cmd_codec.h"
+
+// Commands that start a move and can carry a move ID
+static bool cmd_is_motion(uint8_t command) {
+    return command == MOTOR_CMD_MOVE_ABSOLUTE ||
+           command == MOTOR_CMD_MOVE_RELATIVE ||
+           command == MOTOR_CMD_HOME;
+}
+
+// Parameter length carried by each command type
+static int cmd_param_len(uint8_t command) {
+    switch (command) {
+        case MOTOR_CMD_MOVE_ABSOLUTE:
+        case MOTOR_CMD_MOVE_RELATIVE:
+        case MOTOR_CMD_SET_SPEED:
+            return 2;
+        case MOTOR_CMD_STOP:
+        case MOTOR_CMD_HOME:
+        case MOTOR_CMD_ENABLE:
+        case MOTOR_CMD_DISABLE:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+esp_err_t cmd_codec_decode_single(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmd) {
+    if (len < CMD_CODEC_SINGLE_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    if (cmd_param_len(buf[0]) < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    cmd->command = (motor_command_t)buf[0];
+    cmd->parameter = (int16_t)((buf[2] << 8) | buf[1]); // Little endian
+    cmd->move_id = 0;
+    cmd->rx_us = 0;
+    
+    if (len == CMD_CODEC_TAGGED_LEN) {
+        if (!cmd_is_motion(buf[0])) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        cmd->move_id = (uint16_t)((buf[4] << 8) | buf[3]);
+    }
+    return ESP_OK;
+}
+
+esp_err_t cmd_codec_decode_batch(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmds,
+                                 size_t max_cmds, size_t *count, size_t *consumed) {
+    *count = 0;
+    *consumed = 0;
+    
+    if (len < CMD_CODEC_BATCH_HDR_LEN || buf[0] != CMD_CODEC_BATCH_MARKER) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    size_t tlv_len = buf[1];
+    if (len < CMD_CODEC_BATCH_HDR_LEN + tlv_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *consumed = CMD_CODEC_BATCH_HDR_LEN + tlv_len;
+    
+    const uint8_t *p = buf + CMD_CODEC_BATCH_HDR_LEN;
+    const uint8_t *end = p + tlv_len;
+    size_t n = 0;
+    bool id_pending = false;
+    uint16_t pending_id = 0;
+    
+    while (p < end) {
+        if (end - p < CMD_CODEC_TLV_HDR_LEN) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        
+        uint8_t type = p[0];
+        uint8_t value_len = p[1];
+        if (end - p - CMD_CODEC_TLV_HDR_LEN < value_len) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        
+        if (type == CMD_CODEC_TLV_MOVE_ID) {
+            if (value_len != 2 || id_pending) {
+                return ESP_ERR_INVALID_ARG;
+            }
+            pending_id = (uint16_t)((p[3] << 8) | p[2]);
+            id_pending = true;
+            p += CMD_CODEC_TLV_HDR_LEN + value_len;
+            continue;
+        }
+        
+        if (cmd_param_len(type) != value_len || n >= max_cmds) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        
+        cmds[n].command = (motor_command_t)type;
+        cmds[n].parameter = value_len == 2 ? (int16_t)((p[3] << 8) | p[2]) : 0;
+        cmds[n].move_id = 0;
+        cmds[n].rx_us = 0;
+        if (id_pending && cmd_is_motion(type)) {
+            cmds[n].move_id = pending_id;
+            id_pending = false;
+        }
+        n++;
+        p += CMD_CODEC_TLV_HDR_LEN + value_len;
+    }
+    
+    // A move ID must be followed by the motion command it tags
+    if (n == 0 || id_pending) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    *count = n;
+    return ESP_OK;
+}
+
+// Decode a single little endian 16-bit value into one command
+static esp_err_t decode_le16_cmd(motor_command_t command, const uint8_t *buf, size_t len,
+                                 stepper_motor_cmd_t *cmds, size_t max_cmds, size_t *count) {
+    *count = 0;
+    if (len != 2 || max_cmds < 1) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    cmds[0].command = command;
+    cmds[0].parameter = (int16_t)((buf[1] << 8) | buf[0]);
+    cmds[0].move_id = 0;
+    cmds[0].rx_us = 0;
+    *count = 1;
+    return ESP_OK;
+}
+
+esp_err_t cmd_codec_decode_position(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmds,
+                                    size_t max_cmds, size_t *count) {
+    return decode_le16_cmd(MOTOR_CMD_MOVE_ABSOLUTE, buf, len, cmds, max_cmds, count);
+}
+
+esp_err_t cmd_codec_decode_speed(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmds,
+                                 size_t max_cmds, size_t *count) {
+    return decode_le16_cmd(MOTOR_CMD_SET_SPEED, buf, len, cmds, max_cmds, count);
+}
+
+esp_err_t cmd_codec_decode_command(const uint8_t *buf, size_t len, stepper_motor_cmd_t *cmds,
+                                   size_t max_cmds, size_t *count) {
+    *count = 0;
+    if (len == 0 || max_cmds < 1) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    if (buf[0] == CMD_CODEC_BATCH_MARKER) {
+        size_t consumed;
+        esp_err_t ret = cmd_codec_decode_batch(buf, len, cmds, max_cmds, count, &consumed);
+        if (ret == ESP_OK && consumed != len) {
+            *count = 0;
+            return ESP_ERR_INVALID_SIZE;
+        }
+        return ret;
+    }
+    
+    if (len != CMD_CODEC_SINGLE_LEN && len != CMD_CODEC_TAGGED_LEN) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    esp_err_t ret = cmd_codec_decode_single(buf, len, &cmds[0]);
+    if (ret == ESP_OK) {
+        *count = 1;
+    }
+    return ret;
+}
@@ -1,7 +1,20 @@
+#include <string.h>
 #include "gatt_svr.h"
+#include "ble_peripheral.h"
+#include "cmd_codec.h"
 #include "common_types.h"
 #include "stepper_motor.h"
+#include "ota_update.h"
+#include "diag_boot.h"
+#include "diag_capture.h"
+#include "diag_power.h"
+#include "diag_prof.h"
+#include "diag_sys.h"
+#include "diag_trace.h"
+#include "timer_wheel.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
 #include "host/ble_hs.h"
 #include "host/ble_uuid.h"
 #include "services/gap/ble_svc_gap.h"
@@ -19,12 +32,96 @@ static stepper_motor_t *g_motor = NULL;
 // LED states
 static uint8_t led_states[4] = {0, 0, 0, 0};
 
-// Characteristic handles
-static uint16_t led_handles[4];
-static uint16_t motor_position_handle;
-static uint16_t motor_command_handle;
-static uint16_t motor_status_handle;
-static uint16_t motor_speed_handle;
+// LED flashes run on the timer wheel, so the host task never waits for one
+#define LED_FLASH_GAP_MS    50      // Dark time between the flashes of a sequence
+
+typedef struct {
+    timer_wheel_timer_t timer;
+    uint16_t on_ms;
+    uint8_t flashes;                // Left to show, including the one lit now
+    bool lit;
+} led_flash_t;
+
+static led_flash_t led_flashes[4];
+static const char *const led_flash_names[4] = { "led1_flash", "led2_flash", "led3_flash", "led4_flash" };
+static portMUX_TYPE led_flash_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void led_flash_cb(void *arg);
+
+// Characteristic table index; each entry has a value handle and an op
+typedef enum {
+    CHR_LED1 = 0,
+    CHR_LED2,
+    CHR_LED3,
+    CHR_LED4,
+    CHR_MOTOR_POSITION,
+    CHR_MOTOR_COMMAND,
+    CHR_MOTOR_STATUS,
+    CHR_MOTOR_SPEED,
+    CHR_MOTOR_STREAM,
+    CHR_MOTOR_ACK,
+    CHR_MOTOR_EVENT,
+    CHR_MOTOR_DB_SIG,
+    CHR_MOTOR_ALERT,
+    CHR_OTA_CONTROL,
+    CHR_OTA_DATA,
+    CHR_DIAG_STEP_TIMING,
+    CHR_DIAG_LATENCY,
+    CHR_DIAG_CAPTURE,
+    CHR_DIAG_PROFILE,
+    CHR_DIAG_SYSTEM,
+    CHR_DIAG_BOOT,
+    CHR_DIAG_POWER,
+    CHR_COUNT
+} gatt_chr_id_t;
+
+// Characteristic handles, filled in at registration
+static uint16_t chr_handles[CHR_COUNT];
+
+// Per-connection GATT state
+typedef struct {
+    uint16_t conn_handle;       // BLE_HS_CONN_HANDLE_NONE when the slot is free
+    uint32_t notify_mask;       // Bit per gatt_chr_id_t with notifications or indications enabled
+    uint32_t indicate_mask;     // Subset of notify_mask that asked for indications
+    uint8_t stream_last_seq;    // Last stream sequence number accepted; the next one expected follows it
+} gatt_conn_t;
+
+// Written by the host task, snapshotted by the motor task before notifying
+static gatt_conn_t gatt_conns[BLE_PERIPHERAL_MAX_CONNS];
+static portMUX_TYPE gatt_conns_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Credits last granted; the motor queue is shared by all connections. Set by the
+// host task on writes and subscriptions and by the motor task on queue space.
+static uint8_t stream_credits = 0;
+
+// ATT operation counters since boot, bumped from the host and motor tasks
+typedef enum {
+    ATT_CNT_READ = 0,
+    ATT_CNT_WRITE,
+    ATT_CNT_ERROR,          // Reads and writes answered with an ATT error
+    ATT_CNT_NOTIFY,
+    ATT_CNT_INDICATE,
+    ATT_CNT_TX_FAIL,        // Notifications and indications NimBLE refused
+    ATT_CNT_COUNT
+} att_counter_t;
+
+static uint32_t att_counters[ATT_CNT_COUNT];
+
+#define ATT_COUNT(c)    __atomic_fetch_add(&att_counters[c], 1, __ATOMIC_RELAXED)
+
+// Most recent move event and alert
+static uint8_t last_event[MOTOR_EVENT_NOTIFY_LEN];
+static uint8_t last_alert[MOTOR_ALERT_NOTIFY_LEN];
+
+// Set once a rejected OTA data write was answered with a status notification
+static bool ota_resync_sent = false;
+
+// Signature of the registered attribute layout (FNV-1a), compared across boots
+#define GATT_DB_SIG_SEED        0x811C9DC5UL
+#define GATT_DB_SIG_PRIME       0x01000193UL
+#define GATT_DB_NVS_NAMESPACE   "gatt_svr"
+#define GATT_DB_NVS_KEY         "db_sig"
+static uint32_t gatt_db_sig = GATT_DB_SIG_SEED;
 
 // Service UUIDs
 static const ble_uuid128_t led_svc_uuid =
@@ -64,15 +161,111 @@ static const ble_uuid128_t motor_speed_chr_uuid =
     BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
                      0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcd, 0x04);
 
+static const ble_uuid128_t motor_stream_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcd, 0x05);
+
+static const ble_uuid128_t motor_ack_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcd, 0x06);
+
+static const ble_uuid128_t motor_event_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcd, 0x07);
+
+static const ble_uuid128_t motor_db_sig_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcd, 0x08);
+
+static const ble_uuid128_t motor_alert_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcd, 0x09);
+
+static const ble_uuid128_t ota_svc_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xce, 0x00);
+
+static const ble_uuid128_t ota_control_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xce, 0x01);
+
+static const ble_uuid128_t ota_data_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xce, 0x02);
+
+static const ble_uuid128_t diag_svc_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcf, 0x00);
+
+static const ble_uuid128_t diag_step_timing_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcf, 0x01);
+
+static const ble_uuid128_t diag_latency_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcf, 0x02);
+
+static const ble_uuid128_t diag_capture_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcf, 0x03);
+
+static const ble_uuid128_t diag_profile_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcf, 0x04);
+
+static const ble_uuid128_t diag_system_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcf, 0x05);
+
+static const ble_uuid128_t diag_boot_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcf, 0x06);
+
+static const ble_uuid128_t diag_power_chr_uuid =
+    BLE_UUID128_INIT(0x87, 0x65, 0x43, 0x21, 0xab, 0xcd, 0xef, 0x90,
+                     0x12, 0x34, 0x56, 0x78, 0x90, 0xab, 0xcf, 0x07);
+
 // GPIO pin mappings
 static const gpio_num_t led_gpios[4] = {
     DEFAULT_LED1_GPIO, DEFAULT_LED2_GPIO, DEFAULT_LED3_GPIO, DEFAULT_LED4_GPIO
 };
 
+// Largest write accepted by any characteristic
+#define GATT_CHR_MAX_WRITE_LEN  MOTOR_STREAM_MAX_WRITE_LEN
+
+// Op flags
+#define CHR_OP_NEEDS_MOTOR      0x01    // Reject access until gatt_svr_set_motor() was called
+#define CHR_OP_ACTIVITY_LED     0x02    // Quick LED1 flash on every access
+#define CHR_OP_QUIET            0x04    // No per-access log line (hot path)
+
+typedef struct gatt_chr_op gatt_chr_op_t;
+
+// Write payload after length validation and, if the op has one, decoding
+typedef struct {
+    const uint8_t *data;
+    uint16_t len;
+    stepper_motor_cmd_t cmds[CMD_CODEC_BATCH_MAX_CMDS];
+    size_t count;
+} gatt_chr_payload_t;
+
+typedef int (*gatt_chr_read_fn)(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om);
+typedef int (*gatt_chr_write_fn)(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload);
+
+// Declarative description of one characteristic's behaviour
+struct gatt_chr_op {
+    const char *name;               // Used in log lines
+    gatt_chr_read_fn read;          // NULL if not readable
+    gatt_chr_write_fn write;        // NULL if not writable
+    cmd_codec_decode_fn decode;     // Optional payload -> motor commands decoder
+    uint16_t min_len;               // Accepted write payload length
+    uint16_t max_len;
+    uint8_t flags;                  // CHR_OP_* flags
+    uint8_t index;                  // Per-op argument (LED number)
+};
+
 // Forward declarations
 static int gatt_svr_write(struct os_mbuf *om, uint16_t min_len, uint16_t max_len, void *dst, uint16_t *len);
-static int led_svc_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
-static int motor_svc_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+static int gatt_chr_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
 
 // Initialize LED GPIOs
 static esp_err_t led_gpio_init(void) {
@@ -94,6 +287,7 @@ static esp_err_t led_gpio_init(void) {
     for (int i = 0; i < 4; i++) {
         gpio_set_level(led_gpios[i], 0);
         led_states[i] = 0;
+        timer_wheel_timer_init(&led_flashes[i].timer, led_flash_names[i], led_flash_cb, (void *)(intptr_t)i);
     }
     
     ESP_LOGI(TAG, "LED GPIOs initialized");
@@ -109,12 +303,44 @@ static void led_control(int led_index, uint8_t state) {
     }
 }
 
-// Flash LED for command indication
-static void flash_led(int led_index, int duration_ms) {
+// Next step of a flash sequence; runs in the timer wheel task
+static void led_flash_cb(void *arg) {
+    int i = (int)(intptr_t)arg;
+    led_flash_t *f = &led_flashes[i];
+    uint32_t next_ms = 0;
+    
+    portENTER_CRITICAL(&led_flash_lock);
+    if (f->lit) {
+        gpio_set_level(led_gpios[i], led_states[i]); // Restore previous state
+        f->lit = false;
+        if (f->flashes > 0 && --f->flashes > 0) {
+            next_ms = LED_FLASH_GAP_MS;
+        }
+    } else if (f->flashes > 0) {
+        gpio_set_level(led_gpios[i], 1);
+        f->lit = true;
+        next_ms = f->on_ms;
+    }
+    portEXIT_CRITICAL(&led_flash_lock);
+    
+    if (next_ms > 0) {
+        timer_wheel_start(&f->timer, next_ms, 0);
+    }
+}
+
+// Flash LED for command indication; returns at once, a new flash replaces one in progress
+static void flash_led(int led_index, int duration_ms, int count) {
     if (led_index >= 0 && led_index < 4) {
+        led_flash_t *f = &led_flashes[led_index];
+        
+        portENTER_CRITICAL(&led_flash_lock);
         gpio_set_level(led_gpios[led_index], 1);
-        vTaskDelay(pdMS_TO_TICKS(duration_ms));
-        gpio_set_level(led_gpios[led_index], led_states[led_index]); // Restore previous state
+        f->on_ms = (uint16_t)duration_ms;
+        f->flashes = (uint8_t)count;
+        f->lit = true;
+        portEXIT_CRITICAL(&led_flash_lock);
+        
+        timer_wheel_start(&f->timer, duration_ms, 0);
     }
 }
 
@@ -134,155 +360,907 @@ static int gatt_svr_write(struct os_mbuf *om, uint16_t min_len, uint16_t max_len
     return 0;
 }
 
-// LED service access callback
-static int led_svc_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
-    int led_index = -1;
+// Find the state slot of a connection, optionally claiming a free one (host task only)
+static gatt_conn_t *gatt_conn_get(uint16_t conn_handle, bool create) {
+    gatt_conn_t *free_slot = NULL;
     
-    // Find which LED this handle corresponds to
-    for (int i = 0; i < 4; i++) {
-        if (attr_handle == led_handles[i]) {
-            led_index = i;
+    for (int i = 0; i < BLE_PERIPHERAL_MAX_CONNS; i++) {
+        if (gatt_conns[i].conn_handle == conn_handle) {
+            return &gatt_conns[i];
+        }
+        if (free_slot == NULL && gatt_conns[i].conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+            free_slot = &gatt_conns[i];
+        }
+    }
+    
+    if (!create || free_slot == NULL) {
+        return NULL;
+    }
+    
+    taskENTER_CRITICAL(&gatt_conns_lock);
+    free_slot->conn_handle = conn_handle;
+    free_slot->notify_mask = 0;
+    free_slot->indicate_mask = 0;
+    free_slot->stream_last_seq = 0;
+    taskEXIT_CRITICAL(&gatt_conns_lock);
+    return free_slot;
+}
+
+// Copy out the connections subscribed to a characteristic; returns the count
+static size_t gatt_subscribers(gatt_chr_id_t id, gatt_conn_t *out) {
+    size_t count = 0;
+    
+    taskENTER_CRITICAL(&gatt_conns_lock);
+    for (int i = 0; i < BLE_PERIPHERAL_MAX_CONNS; i++) {
+        if (gatt_conns[i].conn_handle != BLE_HS_CONN_HANDLE_NONE &&
+            (gatt_conns[i].notify_mask & (1UL << id))) {
+            out[count++] = gatt_conns[i];
+        }
+    }
+    taskEXIT_CRITICAL(&gatt_conns_lock);
+    
+    return count;
+}
+
+// Send one notification, or an indication if the client asked for one; NimBLE consumes the mbuf
+static void gatt_notify(uint16_t conn_handle, gatt_chr_id_t id, const uint8_t *data, uint16_t len) {
+    bool indicate = false;
+    
+    taskENTER_CRITICAL(&gatt_conns_lock);
+    for (int i = 0; i < BLE_PERIPHERAL_MAX_CONNS; i++) {
+        if (gatt_conns[i].conn_handle == conn_handle) {
+            indicate = (gatt_conns[i].indicate_mask & (1UL << id)) != 0;
             break;
         }
     }
+    taskEXIT_CRITICAL(&gatt_conns_lock);
+    
+    struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+    if (om == NULL) {
+        ESP_LOGW(TAG, "No mbuf for notification");
+        return;
+    }
+    
+    int rc = indicate ? ble_gatts_indicate_custom(conn_handle, chr_handles[id], om) :
+                        ble_gatts_notify_custom(conn_handle, chr_handles[id], om);
+    ATT_COUNT(indicate ? ATT_CNT_INDICATE : ATT_CNT_NOTIFY);
+    if (rc != 0) {
+        ATT_COUNT(ATT_CNT_TX_FAIL);
+        ESP_LOGW(TAG, "%s failed; conn_handle=%d rc=%d", indicate ? "Indicate" : "Notify", conn_handle, rc);
+    }
+}
+
+// Fan an already encoded value out to every subscribed connection
+static void gatt_notify_subscribers(gatt_chr_id_t id, const uint8_t *data, uint16_t len) {
+    gatt_conn_t subs[BLE_PERIPHERAL_MAX_CONNS];
+    size_t count = gatt_subscribers(id, subs);
+    
+    for (size_t i = 0; i < count; i++) {
+        gatt_notify(subs[i].conn_handle, id, data, len);
+    }
+}
+
+// Motion policy check; STOP is always accepted so any client can halt the axis
+static bool motor_cmds_permitted(uint16_t conn_handle, const stepper_motor_cmd_t *cmds, size_t count) {
+    if (ble_peripheral_motion_allowed(conn_handle)) {
+        return true;
+    }
+    
+    for (size_t i = 0; i < count; i++) {
+        if (cmds[i].command != MOTOR_CMD_STOP) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Dispatch an access to its op; arg points at the op
+static int gatt_chr_dispatch(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    const gatt_chr_op_t *op = (const gatt_chr_op_t *)arg;
+    uint32_t rx_us = (uint32_t)esp_timer_get_time();    // First latency checkpoint
     
-    if (led_index == -1) {
+    if ((op->flags & CHR_OP_NEEDS_MOTOR) && g_motor == NULL) {
+        ESP_LOGE(TAG, "Motor instance not set");
         return BLE_ATT_ERR_UNLIKELY;
     }
     
+    if (op->flags & CHR_OP_ACTIVITY_LED) {
+        flash_led(0, 50, 1); // Quick flash LED1
+    }
+    
     switch (ctxt->op) {
         case BLE_GATT_ACCESS_OP_READ_CHR:
-            ESP_LOGI(TAG, "LED%d read; conn_handle=%d", led_index + 1, conn_handle);
-            return os_mbuf_append(ctxt->om, &led_states[led_index], sizeof(uint8_t));
+            if (op->read == NULL) {
+                return BLE_ATT_ERR_READ_NOT_PERMITTED;
+            }
+            if (!(op->flags & CHR_OP_QUIET)) {
+                DIAG_TRACE(TRACE_EVT_GATT_READ, attr_handle, conn_handle, 0);
+            }
+            return op->read(conn_handle, op, ctxt->om);
+            
+        case BLE_GATT_ACCESS_OP_WRITE_CHR: {
+            if (op->write == NULL) {
+                return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+            }
+            if (!(op->flags & CHR_OP_QUIET)) {
+                DIAG_TRACE(TRACE_EVT_GATT_WRITE, attr_handle, conn_handle, OS_MBUF_PKTLEN(ctxt->om));
+            }
             
-        case BLE_GATT_ACCESS_OP_WRITE_CHR:
-            ESP_LOGI(TAG, "LED%d write; conn_handle=%d", led_index + 1, conn_handle);
-            uint8_t new_state;
-            int rc = gatt_svr_write(ctxt->om, sizeof(uint8_t), sizeof(uint8_t), &new_state, NULL);
-            if (rc == 0) {
-                led_control(led_index, new_state);
+            uint8_t data[GATT_CHR_MAX_WRITE_LEN];
+            gatt_chr_payload_t payload = { .data = data, .count = 0 };
+            int rc = gatt_svr_write(ctxt->om, op->min_len, op->max_len, data, &payload.len);
+            if (rc != 0) {
+                return rc;
             }
-            return rc;
             
+            if (op->decode != NULL &&
+                op->decode(data, payload.len, payload.cmds, CMD_CODEC_BATCH_MAX_CMDS, &payload.count) != ESP_OK) {
+                ESP_LOGW(TAG, "%s: malformed payload", op->name);
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            for (size_t i = 0; i < payload.count; i++) {
+                payload.cmds[i].rx_us = rx_us;
+            }
+            
+            return op->write(conn_handle, op, &payload);
+        }
+        
         default:
             return BLE_ATT_ERR_UNLIKELY;
     }
 }
 
-// Motor service access callback
-static int motor_svc_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
-    if (g_motor == NULL) {
-        ESP_LOGE(TAG, "Motor instance not set");
+// Single access callback for every characteristic
+static int gatt_chr_access(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
+    DIAG_PROF_BEGIN(PROF_GATT_ACCESS);
+    int rc = gatt_chr_dispatch(conn_handle, attr_handle, ctxt, arg);
+    DIAG_PROF_END(PROF_GATT_ACCESS);
+    
+    ATT_COUNT(ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR ? ATT_CNT_READ : ATT_CNT_WRITE);
+    if (rc != 0) {
+        ATT_COUNT(ATT_CNT_ERROR);
+    }
+    return rc;
+}
+
+// LED characteristics
+static int led_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    return os_mbuf_append(om, &led_states[op->index], sizeof(uint8_t));
+}
+
+static int led_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    led_control(op->index, payload->data[0]);
+    return 0;
+}
+
+// LED feedback for a motor command
+static void motor_cmd_feedback(motor_command_t command) {
+    switch (command) {
+        case MOTOR_CMD_STOP:
+            flash_led(3, 100, 1); // LED4 for stop
+            break;
+        case MOTOR_CMD_MOVE_ABSOLUTE:
+            flash_led(0, 200, 1); // LED1 for absolute move
+            break;
+        case MOTOR_CMD_MOVE_RELATIVE:
+            flash_led(1, 200, 1); // LED2 for relative move
+            break;
+        case MOTOR_CMD_HOME:
+            flash_led(2, 500, 1); // LED3 for home
+            break;
+        case MOTOR_CMD_SET_SPEED:
+            flash_led(0, 100, 2); // Double flash for speed
+            break;
+        case MOTOR_CMD_ENABLE:
+            led_control(1, 1); // LED2 solid on for enable
+            break;
+        case MOTOR_CMD_DISABLE:
+            led_control(1, 0); // LED2 off for disable
+            break;
+        default:
+            break;
+    }
+}
+
+// Shared write handler for position, speed and command characteristics
+static int motor_cmds_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    esp_err_t err;
+    
+    if (!motor_cmds_permitted(conn_handle, payload->cmds, payload->count)) {
+        ESP_LOGW(TAG, "%s: motion not permitted for conn_handle=%d", op->name, conn_handle);
+        return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+    }
+    
+    // Every command, driver enable/disable included, is applied by the motor task
+    if (payload->count == 1) {
+        motor_cmd_feedback(payload->cmds[0].command);
+        err = stepper_motor_submit_batch(g_motor, payload->cmds, 1);
+    } else {
+        err = stepper_motor_submit_batch(g_motor, payload->cmds, payload->count);
+        if (err == ESP_OK) {
+            DIAG_TRACE(TRACE_EVT_MOTOR_BATCH, payload->count, conn_handle, 0);
+        }
+    }
+    
+    if (err == ESP_ERR_NO_MEM) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    if (err != ESP_OK) {
         return BLE_ATT_ERR_UNLIKELY;
     }
     
-    // Flash LED to indicate motor BLE activity
-    flash_led(0, 50); // Quick flash LED1
+    ble_peripheral_command_accepted(conn_handle);
+    return 0;
+}
+
+static int motor_position_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    int16_t position = stepper_motor_get_position(g_motor);
+    return os_mbuf_append(om, &position, sizeof(int16_t));
+}
+
+static int motor_status_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    DIAG_PROF_BEGIN(PROF_STATUS_READ);
+    uint8_t status_data[4];
+    status_data[0] = (uint8_t)stepper_motor_get_status(g_motor);
+    int16_t pos = stepper_motor_get_position(g_motor);
+    status_data[1] = pos & 0xFF;
+    status_data[2] = (pos >> 8) & 0xFF;
+    status_data[3] = stepper_motor_is_fault(g_motor) ? 1 : 0;
     
-    if (attr_handle == motor_position_handle) {
-        switch (ctxt->op) {
-            case BLE_GATT_ACCESS_OP_READ_CHR: {
-                ESP_LOGI(TAG, "Motor position read; conn_handle=%d", conn_handle);
-                int16_t position = stepper_motor_get_position(g_motor);
-                return os_mbuf_append(ctxt->om, &position, sizeof(int16_t));
+    int rc = os_mbuf_append(om, status_data, sizeof(status_data));
+    DIAG_PROF_END(PROF_STATUS_READ);
+    return rc;
+}
+
+static int motor_speed_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    uint16_t speed = g_motor->speed_delay_ms;
+    return os_mbuf_append(om, &speed, sizeof(uint16_t));
+}
+
+// Current credit grant: free command queue slots, capped to one byte
+static uint8_t stream_credit_count(void) {
+    uint32_t space = stepper_motor_queue_space();
+    return space > UINT8_MAX ? UINT8_MAX : (uint8_t)space;
+}
+
+// Record the current grant as sent and return it
+static uint8_t stream_credits_grant(void) {
+    uint8_t credits = stream_credit_count();
+    __atomic_store_n(&stream_credits, credits, __ATOMIC_RELAXED);
+    return credits;
+}
+
+// Called from the motor task when it frees a command slot
+static void stream_queue_space_cb(uint32_t free_slots, void *arg) {
+    gatt_conn_t subs[BLE_PERIPHERAL_MAX_CONNS];
+    size_t count = gatt_subscribers(CHR_MOTOR_ACK, subs);
+    if (count == 0) {
+        return;
+    }
+    
+    // Batch grants so a draining queue does not cost one notification per command,
+    // but always report a fully drained queue so the client can never stall
+    uint8_t credits = free_slots > UINT8_MAX ? UINT8_MAX : (uint8_t)free_slots;
+    uint8_t granted = __atomic_load_n(&stream_credits, __ATOMIC_RELAXED);
+    bool drained = free_slots >= MOTOR_CMD_QUEUE_LENGTH && credits != granted;
+    if (!drained && credits < granted + MOTOR_STREAM_CREDIT_BATCH) {
+        return;
+    }
+    
+    // A write handled meanwhile on the host task already sent a fresher grant
+    if (!__atomic_compare_exchange_n(&stream_credits, &granted, credits, false, __ATOMIC_RELAXED,
+                                     __ATOMIC_RELAXED)) {
+        return;
+    }
+    
+    // Grant is [last_seq][credits]; last_seq differs per connection
+    for (size_t i = 0; i < count; i++) {
+        uint8_t grant[2] = { subs[i].stream_last_seq, credits };
+        gatt_notify(subs[i].conn_handle, CHR_MOTOR_ACK, grant, sizeof(grant));
+    }
+}
+
+static int motor_ack_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    gatt_conn_t *conn = gatt_conn_get(conn_handle, false);
+    uint8_t grant[2] = { conn != NULL ? conn->stream_last_seq : 0, stream_credit_count() };
+    return os_mbuf_append(om, grant, sizeof(grant));
+}
+
+// Motor command stream: write-without-response frames with sequence numbers
+static int motor_stream_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    uint32_t rx_us = (uint32_t)esp_timer_get_time();
+    const uint8_t *frames = payload->data;
+    uint16_t len = payload->len;
+    gatt_conn_t *conn = gatt_conn_get(conn_handle, true);
+    if (conn == NULL) {
+        return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+    
+    // Frames are applied in order; no LED feedback, it would flash at the stream rate
+    uint8_t ack[2 + 2 * (MOTOR_STREAM_MAX_WRITE_LEN / MOTOR_STREAM_FRAME_LEN)];
+    uint16_t ack_len = 2;
+    uint16_t off = 0;
+    uint8_t status = MOTOR_ACK_ACCEPTED;
+    int rc = 0;
+    // Frames after a rejected one would open a gap, so the rest of the write is dropped
+    while (off < len && status == MOTOR_ACK_ACCEPTED) {
+        uint8_t seq = frames[off];
+        
+        // A tail too short for a frame is rejected, even a well-formed empty batch
+        if (len - off < MOTOR_STREAM_FRAME_LEN) {
+            ack[ack_len++] = seq;
+            ack[ack_len++] = MOTOR_ACK_INVALID_COMMAND;
+            rc = BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            break;
+        }
+        
+        const uint8_t *body = &frames[off + 1];
+        size_t body_len = len - off - 1;
+        stepper_motor_cmd_t cmds[CMD_CODEC_BATCH_MAX_CMDS];
+        size_t count = 1;
+        size_t consumed = CMD_CODEC_SINGLE_LEN;
+        esp_err_t err;
+        
+        if (body[0] == CMD_CODEC_BATCH_MARKER) {
+            err = cmd_codec_decode_batch(body, body_len, cmds, CMD_CODEC_BATCH_MAX_CMDS, &count, &consumed);
+            if (err == ESP_OK && count == 0) {
+                err = ESP_ERR_INVALID_SIZE;
             }
-            case BLE_GATT_ACCESS_OP_WRITE_CHR: {
-                ESP_LOGI(TAG, "Motor position write; conn_handle=%d", conn_handle);
-                int16_t new_position;
-                int rc = gatt_svr_write(ctxt->om, sizeof(int16_t), sizeof(int16_t), &new_position, NULL);
-                if (rc == 0) {
-                    flash_led(0, 200); // Flash LED1 for position command
-                    stepper_motor_move_to_position(g_motor, new_position);
-                }
-                return rc;
+        } else {
+            err = cmd_codec_decode_single(body, CMD_CODEC_SINGLE_LEN, &cmds[0]);
+        }
+        
+        for (size_t i = 0; err == ESP_OK && i < count; i++) {
+            cmds[i].rx_us = rx_us;
+        }
+        
+        // The half of the sequence space up to last_seq holds replays
+        uint8_t expected = conn->stream_last_seq + 1;
+        bool replay = (uint8_t)(conn->stream_last_seq - seq) < 128;
+        
+        if (err != ESP_OK) {
+            status = MOTOR_ACK_INVALID_COMMAND;
+        } else if (replay) {
+            status = MOTOR_ACK_ACCEPTED;    // Already queued; ack again without executing
+        } else if (seq != expected) {
+            status = MOTOR_ACK_OUT_OF_SEQUENCE;
+        } else if (g_motor == NULL) {
+            status = MOTOR_ACK_NOT_READY;
+        } else if (!motor_cmds_permitted(conn_handle, cmds, count)) {
+            status = MOTOR_ACK_NOT_PERMITTED;
+        } else {
+            err = stepper_motor_submit_batch(g_motor, cmds, count);
+            if (err == ESP_OK) {
+                status = MOTOR_ACK_ACCEPTED;
+                conn->stream_last_seq = seq;
+                ble_peripheral_command_accepted(conn_handle);
+            } else if (err == ESP_ERR_NO_MEM) {
+                status = MOTOR_ACK_QUEUE_FULL;
+            } else if (err == ESP_ERR_INVALID_ARG) {
+                status = MOTOR_ACK_INVALID_COMMAND;
+            } else {
+                status = MOTOR_ACK_NOT_READY;
             }
         }
-    } else if (attr_handle == motor_command_handle) {
-        if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
-            ESP_LOGI(TAG, "Motor command write; conn_handle=%d", conn_handle);
-            
-            uint8_t cmd_data[3];
-            int rc = gatt_svr_write(ctxt->om, 3, 3, cmd_data, NULL);
-            if (rc == 0) {
-                uint8_t command = cmd_data[0];
-                int16_t parameter = (cmd_data[2] << 8) | cmd_data[1]; // Little endian
-                
-                switch (command) {
-                    case MOTOR_CMD_STOP:
-                        flash_led(3, 100); // LED4 for stop
-                        stepper_motor_stop(g_motor);
-                        break;
-                    case MOTOR_CMD_MOVE_ABSOLUTE:
-                        flash_led(0, 200); // LED1 for absolute move
-                        stepper_motor_move_to_position(g_motor, parameter);
-                        break;
-                    case MOTOR_CMD_MOVE_RELATIVE:
-                        flash_led(1, 200); // LED2 for relative move
-                        stepper_motor_move_relative(g_motor, parameter);
-                        break;
-                    case MOTOR_CMD_HOME:
-                        flash_led(2, 500); // LED3 for home
-                        stepper_motor_home(g_motor);
-                        break;
-                    case MOTOR_CMD_SET_SPEED:
-                        flash_led(0, 100); // Double flash for speed
-                        vTaskDelay(pdMS_TO_TICKS(50));
-                        flash_led(0, 100);
-                        stepper_motor_set_speed(g_motor, (uint16_t)parameter);
-                        break;
-                    case MOTOR_CMD_ENABLE:
-                        led_control(1, 1); // LED2 solid on for enable
-                        stepper_motor_enable(g_motor);
-                        break;
-                    case MOTOR_CMD_DISABLE:
-                        led_control(1, 0); // LED2 off for disable
-                        stepper_motor_disable(g_motor);
-                        break;
-                    default:
-                        ESP_LOGW(TAG, "Unknown motor command: %d", command);
-                        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        
+        ack[ack_len++] = seq;
+        ack[ack_len++] = status;
+        off += 1 + consumed;
+    }
+    
+    // Client may send frames up to last_seq + credits
+    ack[0] = conn->stream_last_seq;
+    ack[1] = stream_credits_grant();
+    
+    if (conn->notify_mask & (1UL << CHR_MOTOR_ACK)) {
+        gatt_notify(conn_handle, CHR_MOTOR_ACK, ack, ack_len);
+    }
+    return rc;
+}
+
+// Encode a motion event once and notify every subscribed client (runs in the motor task)
+static void motor_event_cb(const motor_event_t *event, void *arg) {
+    uint8_t data[MOTOR_EVENT_NOTIFY_LEN];
+    data[0] = event->move_id & 0xFF;
+    data[1] = (event->move_id >> 8) & 0xFF;
+    data[2] = (uint8_t)event->type;
+    data[3] = event->position & 0xFF;
+    data[4] = (event->position >> 8) & 0xFF;
+    data[5] = event->elapsed_ms & 0xFF;
+    data[6] = (event->elapsed_ms >> 8) & 0xFF;
+    data[7] = (event->elapsed_ms >> 16) & 0xFF;
+    data[8] = (event->elapsed_ms >> 24) & 0xFF;
+    memcpy(last_event, data, sizeof(data));
+    
+    gatt_notify_subscribers(CHR_MOTOR_EVENT, data, sizeof(data));
+}
+
+// Fault and limit alerts go out from the motor task as soon as the outputs are safe
+static void motor_alert_cb(const motor_alert_t *alert, void *arg) {
+    uint8_t data[MOTOR_ALERT_NOTIFY_LEN];
+    data[0] = (uint8_t)alert->type;
+    data[1] = alert->move_id & 0xFF;
+    data[2] = (alert->move_id >> 8) & 0xFF;
+    data[3] = alert->position & 0xFF;
+    data[4] = (alert->position >> 8) & 0xFF;
+    memcpy(last_alert, data, sizeof(data));
+    
+    gatt_notify_subscribers(CHR_MOTOR_ALERT, data, sizeof(data));
+}
+
+// Alert characteristic: read returns the most recent alert
+static int motor_alert_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    return os_mbuf_append(om, last_alert, sizeof(last_alert));
+}
+
+// Move event characteristic: read returns the most recent event
+static int motor_event_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    return os_mbuf_append(om, last_event, sizeof(last_event));
+}
+
+// Database signature: fallback for clients without Robust Caching; the stack serves
+// the standard Database Hash (0x2B2A) with CONFIG_BT_NIMBLE_GATT_CACHING
+static int motor_db_sig_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    uint8_t sig[4] = {
+        gatt_db_sig & 0xFF, (gatt_db_sig >> 8) & 0xFF,
+        (gatt_db_sig >> 16) & 0xFF, (gatt_db_sig >> 24) & 0xFF,
+    };
+    return os_mbuf_append(om, sig, sizeof(sig));
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+static void ota_status_encode(const ota_update_status_t *status, uint8_t *data) {
+    data[0] = (uint8_t)status->state;
+    data[1] = status->error & 0xFF;
+    data[2] = (status->error >> 8) & 0xFF;
+    put_le32(&data[3], status->received);
+    put_le32(&data[7], status->written);
+    put_le32(&data[11], status->image_size);
+}
+
+// Writer task progress: every flushed block moves the sender's window forward
+static void ota_progress_cb(const ota_update_status_t *status, void *arg) {
+    uint8_t data[OTA_STATUS_NOTIFY_LEN];
+    ota_status_encode(status, data);
+    gatt_notify_subscribers(CHR_OTA_CONTROL, data, sizeof(data));
+}
+
+static int ota_control_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    ota_update_status_t status;
+    uint8_t data[OTA_STATUS_NOTIFY_LEN];
+    
+    ota_update_get_status(&status);
+    ota_status_encode(&status, data);
+    return os_mbuf_append(om, data, sizeof(data));
+}
+
+static int ota_control_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    const uint8_t *data = payload->data;
+    esp_err_t err;
+    
+    switch (data[0]) {
+        case OTA_OP_BEGIN: {
+            if (payload->len != OTA_BEGIN_LEN) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            uint32_t size = data[1] | (data[2] << 8) | (data[3] << 16) | ((uint32_t)data[4] << 24);
+            err = ota_update_begin(size, &data[5]);
+            if (err == ESP_OK && g_motor != NULL) {
+                // Drop whatever is still queued, then stop and power down without blocking the
+                // host task. The motor task's motion gate refuses ENABLE and moves until the
+                // session ends, so nothing queued later can move the axis either.
+                static const stepper_motor_cmd_t halt[] = {
+                    { .command = MOTOR_CMD_STOP },
+                    { .command = MOTOR_CMD_DISABLE },
+                };
+                stepper_motor_flush(g_motor);
+                if (stepper_motor_submit_batch(g_motor, halt, 2) != ESP_OK) {
+                    ESP_LOGW(TAG, "OTA: driver disable not queued; the flush stopped the motor");
                 }
             }
-            return rc;
+            ota_resync_sent = false;
+            break;
         }
-    } else if (attr_handle == motor_status_handle) {
-        if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
-            ESP_LOGI(TAG, "Motor status read; conn_handle=%d", conn_handle);
-            
-            uint8_t status_data[4];
-            status_data[0] = (uint8_t)stepper_motor_get_status(g_motor);
-            int16_t pos = stepper_motor_get_position(g_motor);
-            status_data[1] = pos & 0xFF;
-            status_data[2] = (pos >> 8) & 0xFF;
-            status_data[3] = stepper_motor_is_fault(g_motor) ? 1 : 0;
-            
-            return os_mbuf_append(ctxt->om, status_data, sizeof(status_data));
+        case OTA_OP_FINISH:
+            err = ota_update_finish();
+            break;
+        case OTA_OP_ABORT:
+            err = ota_update_abort();
+            break;
+        case OTA_OP_APPLY:
+            err = ota_update_apply();
+            break;
+        default:
+            return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+    
+    ESP_LOGI(TAG, "OTA op %d from conn_handle=%d: %s", data[0], conn_handle, esp_err_to_name(err));
+    switch (err) {
+        case ESP_OK:
+            return 0;
+        case ESP_ERR_INVALID_STATE:
+            return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+        case ESP_ERR_INVALID_SIZE:
+        case ESP_ERR_NOT_FOUND:
+            return BLE_ATT_ERR_INSUFFICIENT_RES;
+        default:
+            return BLE_ATT_ERR_UNLIKELY;
+    }
+}
+
+// OTA data: write-without-response, so a rejected chunk is answered with the status
+// (once until the next accepted chunk) and the sender resumes from status.received
+static int ota_data_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    const uint8_t *data = payload->data;
+    uint32_t offset = data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+    
+    esp_err_t err = ota_update_write(offset, &data[OTA_DATA_HDR_LEN], payload->len - OTA_DATA_HDR_LEN);
+    if (err == ESP_OK) {
+        ota_resync_sent = false;
+        return 0;
+    }
+    
+    gatt_conn_t *conn = gatt_conn_get(conn_handle, false);
+    if (!ota_resync_sent && conn != NULL && (conn->notify_mask & (1UL << CHR_OTA_CONTROL))) {
+        ota_update_status_t status;
+        uint8_t status_data[OTA_STATUS_NOTIFY_LEN];
+        
+        ota_update_get_status(&status);
+        ota_status_encode(&status, status_data);
+        gatt_notify(conn_handle, CHR_OTA_CONTROL, status_data, sizeof(status_data));
+        ota_resync_sent = true;
+    }
+    return 0;
+}
+
+_Static_assert(DIAG_STEP_TIMING_LEN == 44 + 4 * DIAG_HIST_BUCKETS, "step timing layout out of sync with diag_hist.h");
+
+// Step timing: interval deviation summary followed by the raw log2 histogram
+static int diag_step_timing_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    stepper_motor_step_stats_t stats;
+    uint8_t data[DIAG_STEP_TIMING_LEN];
+    
+    stepper_motor_get_step_stats(&stats);
+    const diag_hist_t *hist = &stats.jitter_us;
+    put_le32(&data[0], stats.total_steps);
+    put_le32(&data[4], stats.step_rate_hz);
+    put_le32(&data[8], hist->count);
+    put_le32(&data[12], (uint32_t)stats.dev_min_us);
+    put_le32(&data[16], (uint32_t)stats.dev_max_us);
+    put_le32(&data[20], diag_hist_mean(hist));
+    put_le32(&data[24], diag_hist_percentile(hist, 500));
+    put_le32(&data[28], diag_hist_percentile(hist, 900));
+    put_le32(&data[32], diag_hist_percentile(hist, 990));
+    put_le32(&data[36], diag_hist_percentile(hist, 999));
+    put_le32(&data[40], hist->count > 0 ? hist->max : 0);
+    for (int k = 0; k < DIAG_HIST_BUCKETS; k++) {
+        put_le32(&data[44 + 4 * k], hist->buckets[k]);
+    }
+    
+    return os_mbuf_append(om, data, sizeof(data));
+}
+
+static int diag_step_timing_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    if (payload->data[0] != DIAG_STEP_TIMING_RESET) {
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+    stepper_motor_reset_step_stats();
+    return 0;
+}
+
+_Static_assert(DIAG_LATENCY_STAGE_LEN == 20 + 4 * DIAG_HIST_BUCKETS, "latency layout out of sync with diag_hist.h");
+
+// Command latency: per-stage summary and raw histogram, stage by stage
+static int diag_latency_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    // Nearly 1 KB together; static keeps it off the host task stack (only the host task gets here)
+    static stepper_motor_latency_stats_t stats;
+    static uint8_t data[DIAG_LATENCY_LEN];
+    
+    stepper_motor_get_latency_stats(&stats);
+    put_le32(&data[0], stats.over_budget);
+    put_le32(&data[4], CONFIG_STEPPER_MOTOR_LATENCY_BUDGET_US);
+    for (int i = 0; i < MOTOR_LATENCY_STAGE_COUNT; i++) {
+        const diag_hist_t *hist = &stats.stage_us[i];
+        uint8_t *p = &data[8 + i * DIAG_LATENCY_STAGE_LEN];
+        put_le32(&p[0], hist->count);
+        put_le32(&p[4], diag_hist_mean(hist));
+        put_le32(&p[8], diag_hist_percentile(hist, 500));
+        put_le32(&p[12], diag_hist_percentile(hist, 990));
+        put_le32(&p[16], hist->count > 0 ? hist->max : 0);
+        for (int k = 0; k < DIAG_HIST_BUCKETS; k++) {
+            put_le32(&p[20 + 4 * k], hist->buckets[k]);
         }
-    } else if (attr_handle == motor_speed_handle) {
-        switch (ctxt->op) {
-            case BLE_GATT_ACCESS_OP_READ_CHR: {
-                ESP_LOGI(TAG, "Motor speed read; conn_handle=%d", conn_handle);
-                uint16_t speed = g_motor->speed_delay_ms;
-                return os_mbuf_append(ctxt->om, &speed, sizeof(uint16_t));
-            }
-            case BLE_GATT_ACCESS_OP_WRITE_CHR: {
-                ESP_LOGI(TAG, "Motor speed write; conn_handle=%d", conn_handle);
-                uint16_t new_speed;
-                int rc = gatt_svr_write(ctxt->om, sizeof(uint16_t), sizeof(uint16_t), &new_speed, NULL);
-                if (rc == 0) {
-                    flash_led(0, 100);
-                    vTaskDelay(pdMS_TO_TICKS(50));
-                    flash_led(0, 100);
-                    stepper_motor_set_speed(g_motor, new_speed);
-                }
-                return rc;
+    }
+    
+    return os_mbuf_append(om, data, sizeof(data));
+}
+
+static int diag_latency_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    if (payload->data[0] != DIAG_LATENCY_RESET) {
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+    stepper_motor_reset_latency_stats();
+    return 0;
+}
+
+static int diag_capture_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    diag_capture_status_t status;
+    uint8_t data[DIAG_CAPTURE_STATUS_LEN];
+    
+    diag_capture_get_status(&status);
+    data[0] = (uint8_t)status.state;
+    put_le32(&data[1], status.count);
+    put_le32(&data[5], status.trigger_index);
+    return os_mbuf_append(om, data, sizeof(data));
+}
+
+// Signal capture control; the dump itself goes out on the log (see diag_capture_dump)
+static int diag_capture_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    const uint8_t *data = payload->data;
+    esp_err_t err;
+    
+    switch (data[0]) {
+        case DIAG_CAPTURE_OP_ARM: {
+            if (payload->len != DIAG_CAPTURE_ARM_LEN) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
             }
+            diag_capture_trigger_t trigger = {
+                .mask = data[1],
+                .value = data[2],
+                .pre_samples = data[3] | (data[4] << 8),
+            };
+            err = diag_capture_arm(&trigger);
+            break;
         }
+        case DIAG_CAPTURE_OP_STOP:
+            diag_capture_stop();
+            err = ESP_OK;
+            break;
+        case DIAG_CAPTURE_OP_DUMP:
+            err = diag_capture_dump();
+            break;
+        default:
+            return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+    
+    switch (err) {
+        case ESP_OK:
+            return 0;
+        case ESP_ERR_INVALID_ARG:
+            return BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+        case ESP_ERR_INVALID_STATE:
+            return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+        case ESP_ERR_NOT_SUPPORTED:
+            return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+        default:
+            return BLE_ATT_ERR_INSUFFICIENT_RES;
+    }
+}
+
+_Static_assert(PROF_REGION_COUNT <= DIAG_PROFILE_MAX_REGIONS, "profile enabled_mask is one byte");
+
+// Profile table: cycle statistics of every region, compiled in or not
+static int diag_profile_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    uint8_t data[DIAG_PROFILE_HDR_LEN + PROF_REGION_COUNT * DIAG_PROFILE_REGION_LEN];
+    uint32_t mhz = diag_prof_cycles_per_us();
+    
+    data[0] = PROF_REGION_COUNT;
+    data[1] = (uint8_t)diag_prof_enabled_mask();
+    data[2] = mhz & 0xFF;
+    data[3] = (mhz >> 8) & 0xFF;
+    for (int i = 0; i < PROF_REGION_COUNT; i++) {
+        diag_prof_stats_t stats;
+        uint8_t *p = &data[DIAG_PROFILE_HDR_LEN + i * DIAG_PROFILE_REGION_LEN];
+        diag_prof_get_stats((diag_prof_id_t)i, &stats);
+        put_le32(&p[0], stats.count);
+        put_le32(&p[4], stats.min_cycles);
+        put_le32(&p[8], stats.count > 0 ? (uint32_t)(stats.total_cycles / stats.count) : 0);
+        put_le32(&p[12], stats.max_cycles);
+    }
+    
+    return os_mbuf_append(om, data, sizeof(data));
+}
+
+static int diag_profile_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    switch (payload->data[0]) {
+        case DIAG_PROFILE_RESET:
+            diag_prof_reset();
+            return 0;
+        case DIAG_PROFILE_DUMP:
+            diag_prof_dump();
+            return 0;
+        default:
+            return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+}
+
+_Static_assert(DIAG_SYSTEM_HDR_LEN == 28 + 4 * ATT_CNT_COUNT, "system header out of sync with att_counter_t");
+_Static_assert(DIAG_SYSTEM_TASK_LEN == DIAG_SYS_NAME_LEN + 8, "system task entry out of sync with diag_sys.h");
+_Static_assert(DIAG_SYSTEM_HDR_LEN + DIAG_SYS_MAX_TASKS * DIAG_SYSTEM_TASK_LEN <= BLE_ATT_ATTR_MAX_LEN,
+               "system snapshot does not fit an attribute");
+
+// System snapshot: served from the diag_sys cache, so long reads see the same task table
+static int diag_system_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    // Static for the same reason as the latency read (host task only)
+    static diag_sys_snapshot_t snap;
+    static uint8_t data[DIAG_SYSTEM_HDR_LEN + DIAG_SYS_MAX_TASKS * DIAG_SYSTEM_TASK_LEN];
+    uint32_t depth, peak;
+    
+    diag_sys_get_snapshot(&snap);
+    stepper_motor_get_queue_depth(&depth, &peak);
+    
+    put_le32(&data[0], ((uint32_t)esp_timer_get_time() - snap.timestamp_us) / 1000);
+    put_le32(&data[4], snap.period_us / 1000);
+    put_le32(&data[8], snap.heap_free);
+    put_le32(&data[12], snap.heap_min_free);
+    put_le32(&data[16], snap.heap_largest);
+    data[20] = depth & 0xFF;
+    data[21] = (depth >> 8) & 0xFF;
+    data[22] = peak & 0xFF;
+    data[23] = (peak >> 8) & 0xFF;
+    data[24] = MOTOR_CMD_QUEUE_LENGTH & 0xFF;
+    data[25] = (MOTOR_CMD_QUEUE_LENGTH >> 8) & 0xFF;
+    data[26] = snap.task_count;
+    data[27] = snap.tasks_total;
+    for (int i = 0; i < ATT_CNT_COUNT; i++) {
+        put_le32(&data[28 + 4 * i], __atomic_load_n(&att_counters[i], __ATOMIC_RELAXED));
+    }
+    
+    for (int i = 0; i < snap.task_count; i++) {
+        const diag_sys_task_t *t = &snap.tasks[i];
+        uint8_t *p = &data[DIAG_SYSTEM_HDR_LEN + i * DIAG_SYSTEM_TASK_LEN];
+        memcpy(p, t->name, DIAG_SYS_NAME_LEN);
+        p[16] = t->cpu_permille & 0xFF;
+        p[17] = (t->cpu_permille >> 8) & 0xFF;
+        p[18] = t->priority;
+        p[19] = t->core;
+        put_le32(&p[20], t->stack_hwm);
+    }
+    
+    return os_mbuf_append(om, data, DIAG_SYSTEM_HDR_LEN + snap.task_count * DIAG_SYSTEM_TASK_LEN);
+}
+
+// Boot timeline: time of each stage since power-on (or app start)
+static int diag_boot_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    uint8_t data[DIAG_BOOT_HDR_LEN + BOOT_STAGE_COUNT * 4];
+    uint32_t times[BOOT_STAGE_COUNT];
+    uint32_t flags;
+    
+    diag_boot_get(times, &flags);
+    data[0] = BOOT_STAGE_COUNT;
+    data[1] = (uint8_t)flags;
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+        put_le32(&data[DIAG_BOOT_HDR_LEN + 4 * i], times[i]);
     }
     
-    return BLE_ATT_ERR_UNLIKELY;
+    return os_mbuf_append(om, data, sizeof(data));
+}
+
+// Power: sleep and stepping residency and the current estimate built on them
+static int diag_power_read(uint16_t conn_handle, const gatt_chr_op_t *op, struct os_mbuf *om) {
+    diag_power_stats_t stats;
+    uint8_t data[DIAG_POWER_LEN];
+    
+    diag_power_get_stats(&stats);
+    data[0] = stats.flags;
+    data[1] = 0;
+    data[2] = stats.saving_permille & 0xFF;
+    data[3] = (stats.saving_permille >> 8) & 0xFF;
+    put_le32(&data[4], (uint32_t)(stats.window_us / 1000));
+    put_le32(&data[8], (uint32_t)(stats.sleep_us / 1000));
+    put_le32(&data[12], (uint32_t)(stats.perf_us / 1000));
+    put_le32(&data[16], stats.sleep_count);
+    put_le32(&data[20], stats.avg_ua);
+    put_le32(&data[24], stats.baseline_ua);
+    
+    return os_mbuf_append(om, data, sizeof(data));
+}
+
+static int diag_power_write(uint16_t conn_handle, const gatt_chr_op_t *op, const gatt_chr_payload_t *payload) {
+    if (payload->data[0] != DIAG_POWER_RESET) {
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+    diag_power_reset();
+    return 0;
 }
 
+// Characteristic ops, indexed by gatt_chr_id_t
+#define LED_OP(n)   { .name = "LED" #n, .read = led_read, .write = led_write, \
+                      .min_len = 1, .max_len = 1, .index = (n) - 1 }
+
+static const gatt_chr_op_t chr_ops[CHR_COUNT] = {
+    [CHR_LED1] = LED_OP(1),
+    [CHR_LED2] = LED_OP(2),
+    [CHR_LED3] = LED_OP(3),
+    [CHR_LED4] = LED_OP(4),
+    [CHR_MOTOR_POSITION] = {
+        .name = "Motor position", .read = motor_position_read, .write = motor_cmds_write,
+        .decode = cmd_codec_decode_position, .min_len = 2, .max_len = 2,
+        .flags = CHR_OP_NEEDS_MOTOR | CHR_OP_ACTIVITY_LED,
+    },
+    [CHR_MOTOR_COMMAND] = {
+        .name = "Motor command", .write = motor_cmds_write,
+        .decode = cmd_codec_decode_command, .min_len = CMD_CODEC_SINGLE_LEN, .max_len = CMD_CODEC_BATCH_MAX_LEN,
+        .flags = CHR_OP_NEEDS_MOTOR | CHR_OP_ACTIVITY_LED,
+    },
+    [CHR_MOTOR_STATUS] = {
+        .name = "Motor status", .read = motor_status_read,
+        .flags = CHR_OP_NEEDS_MOTOR | CHR_OP_ACTIVITY_LED,
+    },
+    [CHR_MOTOR_SPEED] = {
+        .name = "Motor speed", .read = motor_speed_read, .write = motor_cmds_write,
+        .decode = cmd_codec_decode_speed, .min_len = 2, .max_len = 2,
+        .flags = CHR_OP_NEEDS_MOTOR | CHR_OP_ACTIVITY_LED,
+    },
+    [CHR_MOTOR_STREAM] = {
+        .name = "Motor stream", .write = motor_stream_write,
+        .min_len = MOTOR_STREAM_FRAME_LEN, .max_len = MOTOR_STREAM_MAX_WRITE_LEN,
+        .flags = CHR_OP_QUIET,
+    },
+    [CHR_MOTOR_ACK] = {
+        .name = "Motor ack", .read = motor_ack_read,
+        .flags = CHR_OP_QUIET,
+    },
+    [CHR_MOTOR_EVENT] = {
+        .name = "Motor event", .read = motor_event_read,
+        .flags = CHR_OP_QUIET,
+    },
+    [CHR_MOTOR_DB_SIG] = {
+        .name = "DB signature", .read = motor_db_sig_read,
+        .flags = CHR_OP_QUIET,
+    },
+    [CHR_MOTOR_ALERT] = {
+        .name = "Motor alert", .read = motor_alert_read,
+        .flags = CHR_OP_QUIET,
+    },
+    [CHR_OTA_CONTROL] = {
+        .name = "OTA control", .read = ota_control_read, .write = ota_control_write,
+        .min_len = 1, .max_len = OTA_BEGIN_LEN,
+    },
+    [CHR_OTA_DATA] = {
+        .name = "OTA data", .write = ota_data_write,
+        .min_len = OTA_DATA_HDR_LEN + 1, .max_len = GATT_CHR_MAX_WRITE_LEN,
+        .flags = CHR_OP_QUIET,
+    },
+    [CHR_DIAG_STEP_TIMING] = {
+        .name = "Step timing", .read = diag_step_timing_read, .write = diag_step_timing_write,
+        .min_len = 1, .max_len = 1,
+    },
+    [CHR_DIAG_LATENCY] = {
+        .name = "Command latency", .read = diag_latency_read, .write = diag_latency_write,
+        .min_len = 1, .max_len = 1,
+    },
+    [CHR_DIAG_CAPTURE] = {
+        .name = "Signal capture", .read = diag_capture_read, .write = diag_capture_write,
+        .min_len = 1, .max_len = DIAG_CAPTURE_ARM_LEN,
+    },
+    [CHR_DIAG_PROFILE] = {
+        .name = "Profile", .read = diag_profile_read, .write = diag_profile_write,
+        .min_len = 1, .max_len = 1,
+    },
+    [CHR_DIAG_SYSTEM] = {
+        .name = "System snapshot", .read = diag_system_read,
+    },
+    [CHR_DIAG_BOOT] = {
+        .name = "Boot timeline", .read = diag_boot_read,
+    },
+    [CHR_DIAG_POWER] = {
+        .name = "Power", .read = diag_power_read, .write = diag_power_write,
+        .min_len = 1, .max_len = 1,
+    },
+};
+
+// Characteristic definition bound to its op and handle slot
+#define CHR_DEF(id, uuid_var, chr_flags)    \
+    { .uuid = &(uuid_var).u, .access_cb = gatt_chr_access, .arg = (void *)&chr_ops[id], \
+      .flags = (chr_flags), .val_handle = &chr_handles[id] }
+
 // GATT service definitions
 static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
     {
@@ -290,27 +1268,11 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
         .type = BLE_GATT_SVC_TYPE_PRIMARY,
         .uuid = &led_svc_uuid.u,
         .characteristics = (struct ble_gatt_chr_def[]) {
+            CHR_DEF(CHR_LED1, led_chr_uuids[0], BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
+            CHR_DEF(CHR_LED2, led_chr_uuids[1], BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
+            CHR_DEF(CHR_LED3, led_chr_uuids[2], BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
+            CHR_DEF(CHR_LED4, led_chr_uuids[3], BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
             {
-                .uuid = &led_chr_uuids[0].u,
-                .access_cb = led_svc_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .val_handle = &led_handles[0],
-            }, {
-                .uuid = &led_chr_uuids[1].u,
-                .access_cb = led_svc_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .val_handle = &led_handles[1],
-            }, {
-                .uuid = &led_chr_uuids[2].u,
-                .access_cb = led_svc_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .val_handle = &led_handles[2],
-            }, {
-                .uuid = &led_chr_uuids[3].u,
-                .access_cb = led_svc_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .val_handle = &led_handles[3],
-            }, {
                 0, // End of characteristics
             }
         },
@@ -320,27 +1282,48 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
         .type = BLE_GATT_SVC_TYPE_PRIMARY,
         .uuid = &motor_svc_uuid.u,
         .characteristics = (struct ble_gatt_chr_def[]) {
+            CHR_DEF(CHR_MOTOR_POSITION, motor_position_chr_uuid,
+                    BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY),
+            CHR_DEF(CHR_MOTOR_COMMAND, motor_command_chr_uuid, BLE_GATT_CHR_F_WRITE),
+            CHR_DEF(CHR_MOTOR_STATUS, motor_status_chr_uuid, BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY),
+            CHR_DEF(CHR_MOTOR_SPEED, motor_speed_chr_uuid, BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
+            CHR_DEF(CHR_MOTOR_STREAM, motor_stream_chr_uuid, BLE_GATT_CHR_F_WRITE_NO_RSP),
+            CHR_DEF(CHR_MOTOR_ACK, motor_ack_chr_uuid, BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY),
+            CHR_DEF(CHR_MOTOR_EVENT, motor_event_chr_uuid, BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY),
+            CHR_DEF(CHR_MOTOR_DB_SIG, motor_db_sig_chr_uuid, BLE_GATT_CHR_F_READ),
+            CHR_DEF(CHR_MOTOR_ALERT, motor_alert_chr_uuid,
+                    BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE),
+            {
+                0, // End of characteristics
+            }
+        },
+    },
+    {
+        // Firmware Update Service
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &ota_svc_uuid.u,
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            CHR_DEF(CHR_OTA_CONTROL, ota_control_chr_uuid,
+                    BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY),
+            CHR_DEF(CHR_OTA_DATA, ota_data_chr_uuid, BLE_GATT_CHR_F_WRITE_NO_RSP),
+            {
+                0, // End of characteristics
+            }
+        },
+    },
+    {
+        // Diagnostics Service
+        .type = BLE_GATT_SVC_TYPE_PRIMARY,
+        .uuid = &diag_svc_uuid.u,
+        .characteristics = (struct ble_gatt_chr_def[]) {
+            CHR_DEF(CHR_DIAG_STEP_TIMING, diag_step_timing_chr_uuid, BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
+            CHR_DEF(CHR_DIAG_LATENCY, diag_latency_chr_uuid, BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
+            CHR_DEF(CHR_DIAG_CAPTURE, diag_capture_chr_uuid, BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
+            CHR_DEF(CHR_DIAG_PROFILE, diag_profile_chr_uuid, BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
+            CHR_DEF(CHR_DIAG_SYSTEM, diag_system_chr_uuid, BLE_GATT_CHR_F_READ),
+            CHR_DEF(CHR_DIAG_BOOT, diag_boot_chr_uuid, BLE_GATT_CHR_F_READ),
+            CHR_DEF(CHR_DIAG_POWER, diag_power_chr_uuid, BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE),
             {
-                .uuid = &motor_position_chr_uuid.u,
-                .access_cb = motor_svc_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
-                .val_handle = &motor_position_handle,
-            }, {
-                .uuid = &motor_command_chr_uuid.u,
-                .access_cb = motor_svc_access,
-                .flags = BLE_GATT_CHR_F_WRITE,
-                .val_handle = &motor_command_handle,
-            }, {
-                .uuid = &motor_status_chr_uuid.u,
-                .access_cb = motor_svc_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
-                .val_handle = &motor_status_handle,
-            }, {
-                .uuid = &motor_speed_chr_uuid.u,
-                .access_cb = motor_svc_access,
-                .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
-                .val_handle = &motor_speed_handle,
-            }, {
                 0, // End of characteristics
             }
         },
@@ -350,14 +1333,26 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
     },
 };
 
+static void gatt_db_sig_add(const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        gatt_db_sig = (gatt_db_sig ^ p[i]) * GATT_DB_SIG_PRIME;
+    }
+}
+
 void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
     char buf[BLE_UUID_STR_LEN];
     
+    // Every attribute's type, UUID, handles and properties feed the database signature
+    gatt_db_sig_add(&ctxt->op, sizeof(ctxt->op));
+    
     switch (ctxt->op) {
         case BLE_GATT_REGISTER_OP_SVC:
             ESP_LOGI(TAG, "Registered service %s with handle=%d",
                     ble_uuid_to_str(ctxt->svc.svc_def->uuid, buf),
                     ctxt->svc.handle);
+            gatt_db_sig_add(buf, strlen(buf));
+            gatt_db_sig_add(&ctxt->svc.handle, sizeof(ctxt->svc.handle));
             break;
             
         case BLE_GATT_REGISTER_OP_CHR:
@@ -365,12 +1360,18 @@ void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
                     ble_uuid_to_str(ctxt->chr.chr_def->uuid, buf),
                     ctxt->chr.def_handle,
                     ctxt->chr.val_handle);
+            gatt_db_sig_add(buf, strlen(buf));
+            gatt_db_sig_add(&ctxt->chr.def_handle, sizeof(ctxt->chr.def_handle));
+            gatt_db_sig_add(&ctxt->chr.val_handle, sizeof(ctxt->chr.val_handle));
+            gatt_db_sig_add(&ctxt->chr.chr_def->flags, sizeof(ctxt->chr.chr_def->flags));
             break;
             
         case BLE_GATT_REGISTER_OP_DSC:
             ESP_LOGI(TAG, "Registered descriptor %s with handle=%d",
                     ble_uuid_to_str(ctxt->dsc.dsc_def->uuid, buf),
                     ctxt->dsc.handle);
+            gatt_db_sig_add(buf, strlen(buf));
+            gatt_db_sig_add(&ctxt->dsc.handle, sizeof(ctxt->dsc.handle));
             break;
             
         default:
@@ -378,14 +1379,132 @@ void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
     }
 }
 
+#ifdef CONFIG_BLE_PERIPHERAL_ADV_STATUS
+static timer_wheel_timer_t adv_status_timer;
+static bool adv_status_timer_ready = false;
+
+// Sample motor state for the advertising status record; only changes reach the controller
+static void adv_status_timer_cb(void *arg) {
+    ble_adv_status_t status = {
+        .status = (uint8_t)stepper_motor_get_status(g_motor),
+        .position = stepper_motor_get_position(g_motor),
+        .fault = stepper_motor_is_fault(g_motor),
+    };
+    ble_peripheral_set_adv_status(&status);
+}
+
+static void adv_status_start(void) {
+    if (!adv_status_timer_ready) {
+        timer_wheel_timer_init(&adv_status_timer, "adv_status", adv_status_timer_cb, NULL);
+        adv_status_timer_ready = true;
+    }
+    
+    if (timer_wheel_start(&adv_status_timer, CONFIG_BLE_PERIPHERAL_ADV_STATUS_INTERVAL_MS,
+                          CONFIG_BLE_PERIPHERAL_ADV_STATUS_INTERVAL_MS) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start advertising status timer");
+    }
+}
+#endif
+
 void gatt_svr_set_motor(void *motor) {
     g_motor = (stepper_motor_t *)motor;
+    stepper_motor_set_queue_callback(stream_queue_space_cb, NULL);
+    stepper_motor_register_event_cb(motor_event_cb, NULL);
+    stepper_motor_register_alert_cb(motor_alert_cb, NULL);
+#ifdef CONFIG_BLE_PERIPHERAL_ADV_STATUS
+    adv_status_start();
+#endif
     ESP_LOGI(TAG, "Motor instance set for GATT server");
 }
 
+void gatt_svr_subscribe_cb(struct ble_gap_event *event) {
+    uint16_t conn_handle = event->subscribe.conn_handle;
+    int id;
+    
+    for (id = 0; id < CHR_COUNT; id++) {
+        if (chr_handles[id] == event->subscribe.attr_handle) {
+            break;
+        }
+    }
+    if (id == CHR_COUNT) {
+        return;
+    }
+    
+    bool subscribed = event->subscribe.cur_notify || event->subscribe.cur_indicate;
+    gatt_conn_t *conn = gatt_conn_get(conn_handle, subscribed);
+    if (conn == NULL) {
+        return;
+    }
+    
+    taskENTER_CRITICAL(&gatt_conns_lock);
+    if (subscribed) {
+        conn->notify_mask |= 1UL << id;
+    } else {
+        conn->notify_mask &= ~(1UL << id);
+    }
+    if (event->subscribe.cur_indicate) {
+        conn->indicate_mask |= 1UL << id;
+    } else {
+        conn->indicate_mask &= ~(1UL << id);
+    }
+    taskEXIT_CRITICAL(&gatt_conns_lock);
+    
+    if (id == CHR_MOTOR_ACK && subscribed) {
+        // Initial grant so the client knows how many frames it may pipeline
+        uint8_t grant[2] = { conn->stream_last_seq, stream_credits_grant() };
+        gatt_notify(conn_handle, CHR_MOTOR_ACK, grant, sizeof(grant));
+    }
+}
+
+esp_err_t gatt_svr_db_check(void) {
+    nvs_handle_t nvs;
+    uint32_t stored = 0;
+    
+    esp_err_t err = nvs_open(GATT_DB_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS for GATT signature: %s", esp_err_to_name(err));
+        return err;
+    }
+    
+    err = nvs_get_u32(nvs, GATT_DB_NVS_KEY, &stored);
+    if (err == ESP_OK && stored == gatt_db_sig) {
+        nvs_close(nvs);
+        ESP_LOGI(TAG, "GATT database unchanged (0x%08lx); cached handles stay valid", (unsigned long)gatt_db_sig);
+        return ESP_OK;
+    }
+    
+    // Bonded clients get the indication now or when they next reconnect
+    ESP_LOGW(TAG, "GATT database changed (0x%08lx -> 0x%08lx); indicating Service Changed",
+            (unsigned long)stored, (unsigned long)gatt_db_sig);
+    ble_svc_gatt_changed(0x0001, 0xFFFF);
+    
+    err = nvs_set_u32(nvs, GATT_DB_NVS_KEY, gatt_db_sig);
+    if (err == ESP_OK) {
+        err = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return err;
+}
+
+void gatt_svr_disconnect_cb(uint16_t conn_handle) {
+    gatt_conn_t *conn = gatt_conn_get(conn_handle, false);
+    if (conn == NULL) {
+        return;
+    }
+    
+    taskENTER_CRITICAL(&gatt_conns_lock);
+    conn->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    conn->notify_mask = 0;
+    taskEXIT_CRITICAL(&gatt_conns_lock);
+}
+
 esp_err_t gatt_svr_init(void) {
     esp_err_t ret;
     
+    for (int i = 0; i < BLE_PERIPHERAL_MAX_CONNS; i++) {
+        gatt_conns[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    
     // Initialize LED GPIOs
     ret = led_gpio_init();
     if (ret != ESP_OK) {
@@ -398,6 +1517,8 @@ esp_err_t gatt_svr_init(void) {
     ble_svc_gatt_init();
     ble_svc_ans_init();
     
+    ota_update_set_progress_cb(ota_progress_cb, NULL);
+    
     // Register GATT services
     int rc = ble_gatts_count_cfg(gatt_svr_svcs);
     if (rc != 0) {
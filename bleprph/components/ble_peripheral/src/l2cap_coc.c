@@ -0,0 +1,526 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "l2cap_coc.h"
+#include "app_alloc.h"
+#include "ble_peripheral.h"
+#include "gatt_svr.h"
+#include "cmd_codec.h"
+#include "stepper_motor.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "host/ble_hs.h"
+#include "host/ble_l2cap.h"
+#include "nimble/nimble_port.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "L2CAP_COC";
+
+#if CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM > 0
+
+#define L2CAP_COC_BUF_SIZE          (L2CAP_COC_MTU + 32)    // Room for the mbuf and packet headers
+#define L2CAP_COC_TASK_STACK        4096
+#define L2CAP_COC_TASK_PRIO         4                       // Below the NimBLE host task
+#define L2CAP_COC_POLL_MS           50                      // Log flush / buffer retry period
+#define L2CAP_COC_RETRY_MS          10                      // Wait for motor queue room or TX credits
+#define L2CAP_COC_LOG_RING_SIZE     2048                    // Power of two
+#define L2CAP_COC_LOG_LINE_MAX      128
+
+static stepper_motor_t *g_motor = NULL;
+
+// Open channel. Only the host task touches it: NimBLE frees it on that task right after
+// DISCONNECTED, so the worker refers to the channel by session number and hands every
+// send and buffer post to the host task as an event.
+static struct ble_l2cap_chan *coc_chan = NULL;
+static volatile uint32_t coc_session = 0;       // Nonzero while a channel is open, new value per channel
+static uint32_t coc_session_seq = 0;
+static volatile bool coc_rx_starved = false;    // Stack has no SDU buffer, worker must post one
+static volatile bool coc_tx_stalled = false;    // Last SDU waits for peer credits
+static volatile bool log_streaming = false;
+
+// Received SDUs, owned by the worker until it frees them
+static os_membuf_t coc_sdu_mem[OS_MEMPOOL_SIZE(L2CAP_COC_RX_BUF_COUNT, L2CAP_COC_BUF_SIZE)];
+static struct os_mempool coc_sdu_mempool;
+static struct os_mbuf_pool coc_sdu_pool;
+static QueueHandle_t coc_rx_queue = NULL;
+
+static TaskHandle_t coc_task_handle = NULL;
+
+APP_TASK_MEM(coc_task_mem, L2CAP_COC_TASK_STACK);
+APP_QUEUE_MEM(coc_rx_queue_mem, L2CAP_COC_RX_BUF_COUNT, sizeof(struct os_mbuf *));
+APP_MUTEX_MEM(log_line_mutex_mem);
+
+// Flat copies for decoding and framing. The worker fills coc_tx_buf and blocks until
+// the host task has sent it, so the two never access it at the same time.
+static uint8_t coc_rx_buf[L2CAP_COC_MTU];
+static uint8_t coc_tx_buf[L2CAP_COC_MTU];
+static uint16_t coc_tx_len = 0;
+static uint32_t coc_tx_session = 0;
+static int coc_tx_rc = 0;
+
+// Host task events posted by the worker
+static struct ble_npl_event coc_tx_ev;
+static struct ble_npl_event coc_rx_ready_ev;
+
+static l2cap_coc_stats_t coc_stats = { .conn_handle = BLE_HS_CONN_HANDLE_NONE };
+static int64_t coc_rx_first_us = 0;
+static int64_t coc_rx_last_us = 0;
+static portMUX_TYPE coc_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Log ring fed by the esp_log hook; head and tail run freely and are masked on access
+static uint8_t log_ring[L2CAP_COC_LOG_RING_SIZE];
+static uint32_t log_head = 0;
+static uint32_t log_tail = 0;
+static uint32_t log_dropped = 0;
+static portMUX_TYPE log_lock = portMUX_INITIALIZER_UNLOCKED;
+static vprintf_like_t coc_prev_vprintf = NULL;
+
+// Formatting buffer for the esp_log hook, shared by all logging tasks instead of taking
+// a line off each of their stacks
+static char log_line[L2CAP_COC_LOG_LINE_MAX];
+static SemaphoreHandle_t log_line_mutex = NULL;
+
+// Hand the stack an empty SDU buffer; receiving pauses (and the peer runs out of credits) until it has one
+static int coc_post_rx_buf(struct ble_l2cap_chan *chan) {
+    struct os_mbuf *sdu = os_mbuf_get_pkthdr(&coc_sdu_pool, 0);
+    if (sdu == NULL) {
+        coc_rx_starved = true;
+        return BLE_HS_ENOMEM;
+    }
+    
+    int rc = ble_l2cap_recv_ready(chan, sdu);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "recv_ready failed: %d", rc);
+        os_mbuf_free_chain(sdu);
+    }
+    return rc;
+}
+
+// Host task: send the SDU staged in coc_tx_buf if its channel is still open.
+// BLE_HS_ESTALLED means the SDU is queued and goes out as credits arrive.
+static void coc_tx_event(struct ble_npl_event *ev) {
+    int rc = BLE_HS_ENOTCONN;
+    
+    if (coc_chan != NULL && coc_session == coc_tx_session) {
+        struct os_mbuf *sdu = os_msys_get_pkthdr(coc_tx_len, 0);
+        rc = BLE_HS_ENOMEM;
+        if (sdu != NULL) {
+            rc = os_mbuf_append(sdu, coc_tx_buf, coc_tx_len);
+            if (rc == 0) {
+                rc = ble_l2cap_send(coc_chan, sdu);
+            }
+            if (rc == BLE_HS_ESTALLED) {
+                coc_tx_stalled = true;
+                rc = 0;
+            } else if (rc != 0) {
+                os_mbuf_free_chain(sdu);
+            }
+        }
+    }
+    
+    coc_tx_rc = rc;
+    xTaskNotifyGive(coc_task_handle);
+}
+
+// Host task: repost the SDU buffer the worker could not get earlier
+static void coc_rx_ready_event(struct ble_npl_event *ev) {
+    if (coc_chan != NULL) {
+        coc_post_rx_buf(coc_chan);
+    }
+}
+
+// Worker: send len bytes already staged in coc_tx_buf and wait for the host task's result
+static int coc_send(uint32_t session, uint16_t len) {
+    coc_tx_len = len;
+    coc_tx_session = session;
+    ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &coc_tx_ev);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return coc_tx_rc;
+}
+
+// Only one SDU can be in flight; wait for TX_UNSTALLED before the next one
+static bool coc_wait_tx(uint32_t session) {
+    while (coc_tx_stalled) {
+        if (coc_session != session) {
+            return false;
+        }
+        vTaskDelay(pdMS_TO_TICKS(L2CAP_COC_RETRY_MS));
+    }
+    return coc_session == session;
+}
+
+static void coc_log_push(const char *data, size_t len) {
+    portENTER_CRITICAL(&log_lock);
+    if (len > L2CAP_COC_LOG_RING_SIZE - (log_head - log_tail)) {
+        log_dropped += len;
+    } else {
+        for (size_t i = 0; i < len; i++) {
+            log_ring[log_head++ & (L2CAP_COC_LOG_RING_SIZE - 1)] = (uint8_t)data[i];
+        }
+    }
+    portEXIT_CRITICAL(&log_lock);
+}
+
+static size_t coc_log_pop(uint8_t *out, size_t max) {
+    size_t n = 0;
+    portENTER_CRITICAL(&log_lock);
+    while (n < max && log_tail != log_head) {
+        out[n++] = log_ring[log_tail++ & (L2CAP_COC_LOG_RING_SIZE - 1)];
+    }
+    portEXIT_CRITICAL(&log_lock);
+    return n;
+}
+
+// esp_log hook: copy each line into the ring while streaming, then print as usual.
+// A line logged while another task holds the buffer is not streamed rather than
+// blocking the caller; its format length is counted in log_dropped.
+static int coc_log_vprintf(const char *fmt, va_list args) {
+    if (log_streaming) {
+        if (xSemaphoreTake(log_line_mutex, 0) == pdTRUE) {
+            va_list copy;
+            va_copy(copy, args);
+            int len = vsnprintf(log_line, sizeof(log_line), fmt, copy);
+            va_end(copy);
+    
+            if (len > (int)sizeof(log_line) - 1) {
+                len = sizeof(log_line) - 1;
+            }
+            if (len > 0) {
+                coc_log_push(log_line, len);
+            }
+            xSemaphoreGive(log_line_mutex);
+        } else {
+            portENTER_CRITICAL(&log_lock);
+            log_dropped += strlen(fmt);
+            portEXIT_CRITICAL(&log_lock);
+        }
+    }
+    return coc_prev_vprintf(fmt, args);
+}
+
+// Drain the log ring into LOG_DATA SDUs until it is empty or the peer is out of credits
+static void coc_log_flush(uint32_t session) {
+    portENTER_CRITICAL(&coc_stats_lock);
+    uint16_t max = coc_stats.peer_mtu < sizeof(coc_tx_buf) ? coc_stats.peer_mtu : sizeof(coc_tx_buf);
+    portEXIT_CRITICAL(&coc_stats_lock);
+    if (max < 2) {
+        return;
+    }
+    
+    while (!coc_tx_stalled) {
+        size_t n = coc_log_pop(&coc_tx_buf[1], max - 1);
+        if (n == 0) {
+            break;
+        }
+    
+        coc_tx_buf[0] = L2CAP_FRAME_LOG_DATA;
+        if (coc_send(session, n + 1) != 0) {
+            break;
+        }
+        portENTER_CRITICAL(&coc_stats_lock);
+        coc_stats.tx_bytes += n;
+        portEXIT_CRITICAL(&coc_stats_lock);
+    }
+}
+
+// Block while the motor queue is full. The SDU is not released meanwhile, so the
+// peer runs out of credits instead of the device dropping trajectory data.
+static esp_err_t coc_submit(uint32_t session, const stepper_motor_cmd_t *cmds, size_t count) {
+    esp_err_t err;
+    while ((err = stepper_motor_submit_batch(g_motor, cmds, count)) == ESP_ERR_NO_MEM) {
+        if (coc_session != session) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        portENTER_CRITICAL(&coc_stats_lock);
+        coc_stats.queue_waits++;
+        portEXIT_CRITICAL(&coc_stats_lock);
+        vTaskDelay(pdMS_TO_TICKS(L2CAP_COC_RETRY_MS));
+    }
+    return err;
+}
+
+// Trajectory SDU: [seq:1] followed by command batches, decoded straight into the motor queue
+static void coc_trajectory_rx(uint32_t session, const uint8_t *buf, size_t len) {
+    uint16_t conn_handle = coc_stats.conn_handle;
+    uint8_t seq = buf[0];
+    uint8_t status = MOTOR_ACK_ACCEPTED;
+    uint16_t accepted = 0;
+    size_t off = 1;
+    
+    if (g_motor == NULL) {
+        status = MOTOR_ACK_NOT_READY;
+    } else if (!ble_peripheral_motion_allowed(conn_handle)) {
+        status = MOTOR_ACK_NOT_PERMITTED;
+    }
+    
+    while (status == MOTOR_ACK_ACCEPTED && off < len) {
+        stepper_motor_cmd_t cmds[CMD_CODEC_BATCH_MAX_CMDS];
+        size_t count = 0;
+        size_t consumed = 0;
+    
+        esp_err_t err = cmd_codec_decode_batch(&buf[off], len - off, cmds, CMD_CODEC_BATCH_MAX_CMDS,
+                                               &count, &consumed);
+        if (err == ESP_OK) {
+            err = coc_submit(session, cmds, count);
+        }
+        if (err == ESP_ERR_INVALID_STATE) {
+            return;     // Channel closed while waiting, nobody to ack
+        }
+        if (err != ESP_OK) {
+            status = (err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_SIZE) ?
+                     MOTOR_ACK_INVALID_COMMAND : MOTOR_ACK_NOT_READY;
+            break;
+        }
+    
+        accepted += count;
+        off += consumed;
+    }
+    
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&coc_stats_lock);
+    if (coc_stats.rx_sdus++ == 0) {
+        coc_rx_first_us = now;
+    }
+    coc_rx_last_us = now;
+    coc_stats.rx_bytes += len;
+    coc_stats.rx_cmds += accepted;
+    portEXIT_CRITICAL(&coc_stats_lock);
+    
+    if (accepted > 0) {
+        ble_peripheral_command_accepted(conn_handle);
+    }
+    if (status != MOTOR_ACK_ACCEPTED) {
+        ESP_LOGW(TAG, "Trajectory seq=%d stopped after %d commands, status %d", seq, accepted, status);
+    }
+    
+    if (coc_wait_tx(session)) {
+        coc_tx_buf[0] = L2CAP_FRAME_TRAJ_ACK;
+        coc_tx_buf[1] = seq;
+        coc_tx_buf[2] = status;
+        coc_tx_buf[3] = (uint8_t)(accepted & 0xFF);
+        coc_tx_buf[4] = (uint8_t)(accepted >> 8);
+        coc_send(session, L2CAP_TRAJ_ACK_LEN);
+    }
+}
+
+static void coc_sdu_rx(uint32_t session, struct os_mbuf *sdu) {
+    uint16_t len = OS_MBUF_PKTLEN(sdu);
+    if (len == 0 || len > sizeof(coc_rx_buf)) {
+        ESP_LOGW(TAG, "Dropping SDU of %d bytes", len);
+        return;
+    }
+    os_mbuf_copydata(sdu, 0, len, coc_rx_buf);
+    
+    switch (coc_rx_buf[0]) {
+        case L2CAP_FRAME_TRAJECTORY:
+            if (len < 2) {
+                ESP_LOGW(TAG, "Trajectory SDU without sequence number");
+                break;
+            }
+            coc_trajectory_rx(session, &coc_rx_buf[1], len - 1);
+            break;
+        case L2CAP_FRAME_LOG_START:
+            log_streaming = true;
+            ESP_LOGI(TAG, "Log streaming started");
+            break;
+        case L2CAP_FRAME_LOG_STOP:
+            ESP_LOGI(TAG, "Log streaming stopped");
+            log_streaming = false;
+            break;
+        default:
+            ESP_LOGW(TAG, "Unknown frame type 0x%02x", coc_rx_buf[0]);
+            break;
+    }
+}
+
+// Worker: applies received SDUs outside the host task and streams logs out
+static void coc_task(void *arg) {
+    struct os_mbuf *sdu;
+    
+    for (;;) {
+        TickType_t wait = (log_streaming || coc_rx_starved) ? pdMS_TO_TICKS(L2CAP_COC_POLL_MS) : portMAX_DELAY;
+        uint32_t session;
+    
+        if (xQueueReceive(coc_rx_queue, &sdu, wait) == pdTRUE) {
+            session = coc_session;
+            if (session != 0) {
+                coc_sdu_rx(session, sdu);
+            }
+            os_mbuf_free_chain(sdu);
+        }
+    
+        session = coc_session;
+        if (session == 0) {
+            continue;
+        }
+        if (coc_rx_starved) {
+            coc_rx_starved = false;
+            ble_npl_eventq_put(nimble_port_get_dflt_eventq(), &coc_rx_ready_ev);
+        }
+        if (log_streaming) {
+            coc_log_flush(session);
+        }
+    }
+}
+
+static void coc_log_session(void) {
+    l2cap_coc_stats_t stats;
+    l2cap_coc_get_stats(&stats);
+    
+    uint32_t rate = stats.rx_active_ms > 0 ? (uint32_t)((uint64_t)stats.rx_bytes * 1000 / stats.rx_active_ms) : 0;
+    ESP_LOGI(TAG, "Channel closed: %lu SDUs, %lu bytes, %lu commands in %lu ms (%lu B/s), %lu queue waits",
+             (unsigned long)stats.rx_sdus, (unsigned long)stats.rx_bytes, (unsigned long)stats.rx_cmds,
+             (unsigned long)stats.rx_active_ms, (unsigned long)rate, (unsigned long)stats.queue_waits);
+}
+
+static int coc_event_cb(struct ble_l2cap_event *event, void *arg) {
+    struct ble_l2cap_chan_info info;
+    
+    switch (event->type) {
+        case BLE_L2CAP_EVENT_COC_ACCEPT:
+            // One channel at a time; the SDU pool and the worker are sized for it
+            if (coc_chan != NULL) {
+                ESP_LOGW(TAG, "Rejecting second channel from conn_handle=%d", event->accept.conn_handle);
+                return BLE_HS_ENOMEM;
+            }
+            return coc_post_rx_buf(event->accept.chan);
+    
+        case BLE_L2CAP_EVENT_COC_CONNECTED:
+            if (event->connect.status != 0) {
+                ESP_LOGW(TAG, "Channel setup failed: %d", event->connect.status);
+                return 0;
+            }
+            ble_l2cap_get_chan_info(event->connect.chan, &info);
+    
+            portENTER_CRITICAL(&coc_stats_lock);
+            coc_stats = (l2cap_coc_stats_t){
+                .conn_handle = event->connect.conn_handle,
+                .peer_mtu = info.peer_coc_mtu
+            };
+            coc_rx_first_us = 0;
+            coc_rx_last_us = 0;
+            portEXIT_CRITICAL(&coc_stats_lock);
+            coc_tx_stalled = false;
+            coc_chan = event->connect.chan;
+            if (++coc_session_seq == 0) {
+                coc_session_seq = 1;
+            }
+            coc_session = coc_session_seq;
+    
+            ESP_LOGI(TAG, "Channel open: conn_handle=%d psm=0x%04x mtu=%d/%d", event->connect.conn_handle,
+                     info.psm, info.our_coc_mtu, info.peer_coc_mtu);
+            return 0;
+    
+        case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+            coc_chan = NULL;
+            coc_session = 0;
+            log_streaming = false;
+            coc_tx_stalled = false;
+            coc_log_session();
+            return 0;
+    
+        case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+            if (xQueueSend(coc_rx_queue, &event->receive.sdu_rx, 0) != pdTRUE) {
+                ESP_LOGE(TAG, "RX queue full, dropping SDU");
+                os_mbuf_free_chain(event->receive.sdu_rx);
+            }
+            // Post the next buffer now if one is free, so reception overlaps processing
+            coc_post_rx_buf(event->receive.chan);
+            return 0;
+    
+        case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+            coc_tx_stalled = false;
+            return 0;
+    
+        default:
+            return 0;
+    }
+}
+
+esp_err_t l2cap_coc_init(void) {
+    int rc = os_mempool_init(&coc_sdu_mempool, L2CAP_COC_RX_BUF_COUNT, L2CAP_COC_BUF_SIZE,
+                             coc_sdu_mem, "coc_sdu_pool");
+    if (rc == 0) {
+        rc = os_mbuf_pool_init(&coc_sdu_pool, &coc_sdu_mempool, L2CAP_COC_BUF_SIZE, L2CAP_COC_RX_BUF_COUNT);
+    }
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Failed to init SDU pool: %d", rc);
+        return ESP_FAIL;
+    }
+    
+    coc_rx_queue = app_queue_create(&coc_rx_queue_mem, L2CAP_COC_RX_BUF_COUNT, sizeof(struct os_mbuf *));
+    if (coc_rx_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create RX queue");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    log_line_mutex = app_mutex_create(&log_line_mutex_mem);
+    if (log_line_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create log mutex");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    ble_npl_event_init(&coc_tx_ev, coc_tx_event, NULL);
+    ble_npl_event_init(&coc_rx_ready_ev, coc_rx_ready_event, NULL);
+    
+    if (app_task_create(&coc_task_mem, coc_task, "l2cap_coc", L2CAP_COC_TASK_STACK, NULL,
+                        L2CAP_COC_TASK_PRIO, &coc_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create worker task");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    rc = ble_l2cap_create_server(L2CAP_COC_PSM, L2CAP_COC_MTU, coc_event_cb, NULL);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Failed to create L2CAP server: %d", rc);
+        return ESP_FAIL;
+    }
+    
+    coc_prev_vprintf = esp_log_set_vprintf(coc_log_vprintf);
+    
+    ESP_LOGI(TAG, "L2CAP CoC server on PSM 0x%04x, MTU %d", L2CAP_COC_PSM, L2CAP_COC_MTU);
+    return ESP_OK;
+}
+
+void l2cap_coc_set_motor(void *motor) {
+    g_motor = (stepper_motor_t *)motor;
+}
+
+esp_err_t l2cap_coc_get_stats(l2cap_coc_stats_t *stats) {
+    if (stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    portENTER_CRITICAL(&coc_stats_lock);
+    *stats = coc_stats;
+    stats->rx_active_ms = (uint32_t)((coc_rx_last_us - coc_rx_first_us) / 1000);
+    portEXIT_CRITICAL(&coc_stats_lock);
+    
+    portENTER_CRITICAL(&log_lock);
+    stats->log_dropped = log_dropped;
+    portEXIT_CRITICAL(&log_lock);
+    
+    if (coc_session == 0) {
+        stats->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t l2cap_coc_init(void) {
+    ESP_LOGW(TAG, "L2CAP CoC disabled (CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM=0)");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void l2cap_coc_set_motor(void *motor) {
+    (void)motor;
+}
+
+esp_err_t l2cap_coc_get_stats(l2cap_coc_stats_t *stats) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif // CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM > 0
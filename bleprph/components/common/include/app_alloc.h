@@ -0,0 +1,159 @@
+#ifndef APP_ALLOC_H
+#define APP_ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Task, queue, mutex and event group creation that follows
+ * CONFIG_APP_STATIC_ALLOC.
+ *
+ * Each object is declared once at file scope with APP_TASK_MEM(),
+ * APP_QUEUE_MEM(), APP_MUTEX_MEM() or APP_EVENT_GROUP_MEM(). With the option
+ * set, that reserves its stack, control block and storage in .bss, where the
+ * size report counts them per component and heap fragmentation cannot fail
+ * them at boot. Without it the declaration is empty and the object comes from
+ * the heap as before.
+ */
+typedef struct {
+    StackType_t *stack;
+    StaticTask_t *tcb;
+} app_task_mem_t;
+
+typedef struct {
+    uint8_t *storage;
+    StaticQueue_t *queue;
+} app_queue_mem_t;
+
+typedef struct {
+    StaticSemaphore_t *mutex;
+} app_mutex_mem_t;
+
+typedef struct {
+    StaticEventGroup_t *group;
+} app_event_group_mem_t;
+
+#ifdef CONFIG_APP_STATIC_ALLOC
+
+#define APP_TASK_MEM(name, stack_size)                                              \
+    static StackType_t name##_stack[(stack_size) / sizeof(StackType_t)];            \
+    static StaticTask_t name##_tcb;                                                 \
+    static const app_task_mem_t name = { name##_stack, &name##_tcb }
+
+#define APP_QUEUE_MEM(name, length, item_size)                                      \
+    static uint8_t name##_storage[(length) * (item_size)];                          \
+    static StaticQueue_t name##_queue;                                              \
+    static const app_queue_mem_t name = { name##_storage, &name##_queue }
+
+#define APP_MUTEX_MEM(name)                                                         \
+    static StaticSemaphore_t name##_mutex;                                          \
+    static const app_mutex_mem_t name = { &name##_mutex }
+
+#define APP_EVENT_GROUP_MEM(name)                                                   \
+    static StaticEventGroup_t name##_group;                                         \
+    static const app_event_group_mem_t name = { &name##_group }
+
+#else
+
+#define APP_TASK_MEM(name, stack_size)          static const app_task_mem_t name = { NULL, NULL }
+#define APP_QUEUE_MEM(name, length, item_size)  static const app_queue_mem_t name = { NULL, NULL }
+#define APP_MUTEX_MEM(name)                     static const app_mutex_mem_t name = { NULL }
+#define APP_EVENT_GROUP_MEM(name)               static const app_event_group_mem_t name = { NULL }
+
+#endif
+
+/**
+ * @brief Create a task pinned to a core, in its APP_TASK_MEM() storage or on the heap
+ * @param mem Storage declared with the same stack_size
+ * @param fn Task function
+ * @param label Task name
+ * @param stack_size Stack size in bytes
+ * @param arg Task argument
+ * @param prio Priority
+ * @param handle Output handle, may be NULL
+ * @param core Core to run on, or tskNO_AFFINITY
+ * @return pdPASS on success
+ */
+static inline BaseType_t app_task_create_pinned(const app_task_mem_t *mem, TaskFunction_t fn, const char *label,
+                                                uint32_t stack_size, void *arg, UBaseType_t prio,
+                                                TaskHandle_t *handle, BaseType_t core) {
+    if (mem->stack == NULL) {
+        return xTaskCreatePinnedToCore(fn, label, stack_size, arg, prio, handle, core);
+    }
+    
+    TaskHandle_t h = xTaskCreateStaticPinnedToCore(fn, label, stack_size, arg, prio, mem->stack, mem->tcb, core);
+    if (handle != NULL) {
+        *handle = h;
+    }
+    return h != NULL ? pdPASS : pdFAIL;
+}
+
+/**
+ * @brief Create a task in its APP_TASK_MEM() storage, or on the heap; it may run on either core
+ * @param mem Storage declared with the same stack_size
+ * @param fn Task function
+ * @param label Task name
+ * @param stack_size Stack size in bytes
+ * @param arg Task argument
+ * @param prio Priority
+ * @param handle Output handle, may be NULL
+ * @return pdPASS on success
+ */
+static inline BaseType_t app_task_create(const app_task_mem_t *mem, TaskFunction_t fn, const char *label,
+                                         uint32_t stack_size, void *arg, UBaseType_t prio, TaskHandle_t *handle) {
+    return app_task_create_pinned(mem, fn, label, stack_size, arg, prio, handle, tskNO_AFFINITY);
+}
+
+/**
+ * @brief Create a queue in its APP_QUEUE_MEM() storage, or on the heap
+ * @param mem Storage declared with the same length and item_size
+ * @param length Queue length
+ * @param item_size Item size in bytes
+ * @return Queue handle, NULL on failure
+ */
+static inline QueueHandle_t app_queue_create(const app_queue_mem_t *mem, UBaseType_t length, UBaseType_t item_size) {
+    if (mem->queue == NULL) {
+        return xQueueCreate(length, item_size);
+    }
+    return xQueueCreateStatic(length, item_size, mem->storage, mem->queue);
+}
+
+/**
+ * @brief Create a mutex in its APP_MUTEX_MEM() storage, or on the heap
+ * @param mem Storage
+ * @return Mutex handle, NULL on failure
+ */
+static inline SemaphoreHandle_t app_mutex_create(const app_mutex_mem_t *mem) {
+    if (mem->mutex == NULL) {
+        return xSemaphoreCreateMutex();
+    }
+    return xSemaphoreCreateMutexStatic(mem->mutex);
+}
+
+/**
+ * @brief Create an event group in its APP_EVENT_GROUP_MEM() storage, or on the heap
+ * @param mem Storage
+ * @return Event group handle, NULL on failure
+ */
+static inline EventGroupHandle_t app_event_group_create(const app_event_group_mem_t *mem) {
+    if (mem->group == NULL) {
+        return xEventGroupCreate();
+    }
+    return xEventGroupCreateStatic(mem->group);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // APP_ALLOC_H
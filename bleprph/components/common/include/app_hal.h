@@ -0,0 +1,171 @@
+#ifndef APP_HAL_H
+#define APP_HAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#ifndef CONFIG_IDF_TARGET_LINUX
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Board access for the motion engine: GPIO, the microsecond clock and wait
+ * lengths. On a chip every call is an inline wrapper around the GPIO driver,
+ * esp_timer and pdMS_TO_TICKS(). On the linux target they drive the simulated
+ * board in app_hal_sim.c instead. Its clock runs CONFIG_APP_HAL_SIM_SPEEDUP
+ * times faster than real time, and waits shrink to match.
+ */
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+// No GPIO driver on the host; pins are plain numbers on the simulated board
+typedef int gpio_num_t;
+
+#define GPIO_NUM_2              2
+#define GPIO_NUM_4              4
+#define GPIO_NUM_5              5
+#define GPIO_NUM_12             12
+#define GPIO_NUM_13             13
+#define GPIO_NUM_14             14
+#define GPIO_NUM_18             18
+#define GPIO_NUM_25             25
+#define GPIO_NUM_26             26
+#define GPIO_NUM_27             27
+#define APP_HAL_SIM_PIN_COUNT   40
+#endif
+
+/** Pin interrupt handler; on a chip it runs in ISR context */
+typedef void (*app_hal_isr_t)(void *arg);
+
+#ifndef CONFIG_IDF_TARGET_LINUX
+
+/**
+ * @brief Configure pins as push-pull outputs
+ * @param pin_mask Bit n set for GPIO n
+ * @return ESP_OK on success
+ */
+static inline esp_err_t app_hal_gpio_output(uint64_t pin_mask) {
+    gpio_config_t io_conf = {
+        .pin_bit_mask = pin_mask,
+        .mode = GPIO_MODE_OUTPUT,
+        .intr_type = GPIO_INTR_DISABLE,
+    };
+    return gpio_config(&io_conf);
+}
+
+/**
+ * @brief Configure a pin as an input that can interrupt on both edges
+ * @param pin Pin
+ * @param pull_up Enable the internal pull-up
+ * @return ESP_OK on success
+ */
+static inline esp_err_t app_hal_gpio_input(gpio_num_t pin, bool pull_up) {
+    gpio_config_t io_conf = {
+        .pin_bit_mask = 1ULL << pin,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = pull_up ? GPIO_PULLUP_ENABLE : GPIO_PULLUP_DISABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+    return gpio_config(&io_conf);
+}
+
+/**
+ * @brief Drive an output pin
+ * @param pin Pin
+ * @param level 0 or 1
+ */
+static inline void app_hal_gpio_set(gpio_num_t pin, uint32_t level) {
+    gpio_set_level(pin, level);
+}
+
+/**
+ * @brief Drive several output pins. On a chip they change one after another;
+ *        the simulated board changes them at once.
+ * @param pin_mask Bit n set for GPIO n
+ * @param levels Bit n is the level for GPIO n
+ */
+static inline void app_hal_gpio_set_mask(uint64_t pin_mask, uint64_t levels) {
+    while (pin_mask != 0) {
+        int pin = __builtin_ctzll(pin_mask);
+        gpio_set_level((gpio_num_t)pin, (levels >> pin) & 1);
+        pin_mask &= pin_mask - 1;
+    }
+}
+
+/**
+ * @brief Read a pin; safe from an ISR
+ * @param pin Pin
+ * @return 0 or 1
+ */
+static inline int app_hal_gpio_get(gpio_num_t pin) {
+    return gpio_get_level(pin);
+}
+
+/**
+ * @brief Attach an interrupt handler to an input pin. The interrupt is
+ *        allocated on the calling core unless another component installed
+ *        the GPIO ISR service first.
+ * @param pin Pin configured with app_hal_gpio_input()
+ * @param isr Handler, must be in IRAM
+ * @param arg Passed to the handler
+ * @return ESP_OK on success
+ */
+static inline esp_err_t app_hal_gpio_isr_add(gpio_num_t pin, app_hal_isr_t isr, void *arg) {
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        return err;
+    }
+    return gpio_isr_handler_add(pin, isr, arg);
+}
+
+/**
+ * @brief Time since boot
+ * @return Microseconds
+ */
+static inline int64_t app_hal_time_us(void) {
+    return esp_timer_get_time();
+}
+
+/**
+ * @brief Convert a motion delay to the ticks to wait for it
+ * @param ms Delay in milliseconds
+ * @return Ticks
+ */
+static inline TickType_t app_hal_ms_to_ticks(uint32_t ms) {
+    return pdMS_TO_TICKS(ms);
+}
+
+/**
+ * @brief Length of a wait, on the app_hal_time_us() clock
+ * @param ticks Ticks, e.g. from app_hal_ms_to_ticks()
+ * @return Microseconds
+ */
+static inline int64_t app_hal_ticks_to_us(TickType_t ticks) {
+    return (int64_t)ticks * 1000000 / configTICK_RATE_HZ;
+}
+
+#else
+
+esp_err_t app_hal_gpio_output(uint64_t pin_mask);
+esp_err_t app_hal_gpio_input(gpio_num_t pin, bool pull_up);
+void app_hal_gpio_set(gpio_num_t pin, uint32_t level);
+void app_hal_gpio_set_mask(uint64_t pin_mask, uint64_t levels);
+int app_hal_gpio_get(gpio_num_t pin);
+esp_err_t app_hal_gpio_isr_add(gpio_num_t pin, app_hal_isr_t isr, void *arg);
+int64_t app_hal_time_us(void);
+TickType_t app_hal_ms_to_ticks(uint32_t ms);
+int64_t app_hal_ticks_to_us(TickType_t ticks);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // APP_HAL_H
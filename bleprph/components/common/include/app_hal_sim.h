@@ -0,0 +1,93 @@
+#ifndef APP_HAL_SIM_H
+#define APP_HAL_SIM_H
+
+#include <stddef.h>
+#include "app_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Simulated board behind app_hal.h on the linux target. Every pin is an input
+ * or output bit. A DRV8833 model watches the pins it is attached to and
+ * records the coil drive each time it changes, stamped with the simulated
+ * clock.
+ */
+
+/** Drive of one DRV8833 bridge */
+#define APP_HAL_SIM_COIL_OFF        0       // Both inputs equal: coast or brake
+#define APP_HAL_SIM_COIL_FWD        1       // xIN1 high, xIN2 low
+#define APP_HAL_SIM_COIL_REV        (-1)    // xIN1 low, xIN2 high
+
+typedef struct {
+    gpio_num_t ain1;
+    gpio_num_t ain2;
+    gpio_num_t bin1;
+    gpio_num_t bin2;
+    gpio_num_t sleep;       // nSLEEP; both bridges are off while it is low
+    gpio_num_t fault;       // nFAULT, driven by the model, active low
+} app_hal_sim_drv8833_pins_t;
+
+typedef struct {
+    int64_t time_us;        // Simulated time of the change
+    int8_t coil_a;          // APP_HAL_SIM_COIL_*
+    int8_t coil_b;
+} app_hal_sim_coils_t;
+
+/** Called on every coil change, from the task that drove the pins */
+typedef void (*app_hal_sim_coil_cb_t)(const app_hal_sim_coils_t *coils, void *arg);
+
+/**
+ * @brief Wire the DRV8833 model to its pins. Call before the motor driver
+ *        configures them. nFAULT starts released.
+ * @param pins Pin assignment, usually the DEFAULT_MOTOR_* pins
+ */
+void app_hal_sim_drv8833_attach(const app_hal_sim_drv8833_pins_t *pins);
+
+/**
+ * @brief Get the current coil drive
+ * @param coils Output
+ */
+void app_hal_sim_get_coils(app_hal_sim_coils_t *coils);
+
+/**
+ * @brief Copy the most recent coil changes, oldest first
+ * @param out Output array
+ * @param max Capacity of out
+ * @return Entries copied, at most CONFIG_APP_HAL_SIM_HISTORY
+ */
+size_t app_hal_sim_get_history(app_hal_sim_coils_t *out, size_t max);
+
+/**
+ * @brief Number of coil changes since the model was attached
+ * @return Changes
+ */
+uint32_t app_hal_sim_get_coil_changes(void);
+
+/**
+ * @brief Follow coil changes as they happen, e.g. with a plant model
+ * @param cb Callback, NULL to stop
+ * @param arg Passed to the callback
+ */
+void app_hal_sim_set_coil_cb(app_hal_sim_coil_cb_t cb, void *arg);
+
+/**
+ * @brief Assert or release nFAULT; the pin's interrupt handler runs in the
+ *        calling task
+ * @param asserted true to pull nFAULT low
+ */
+void app_hal_sim_set_fault(bool asserted);
+
+/**
+ * @brief Stop nFAULT edges from reaching their interrupt handlers, as on a
+ *        board where the driver could not install the interrupt and polls
+ * @param masked true to drop the edges, false to deliver them again
+ */
+void app_hal_sim_mask_fault_irq(bool masked);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // APP_HAL_SIM_H
@@ -1,7 +1,7 @@
 #ifndef COMMON_TYPES_H
 #define COMMON_TYPES_H
 
-#include "driver/gpio.h"
+#include "app_hal.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -0,0 +1,102 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Hierarchical timer wheel: one task runs every periodic and one-shot job of
+ * the firmware. Resolution is one RTOS tick. Four levels of 64 slots cover
+ * 2^24 ticks; later expiries are parked in the last level and moved down when
+ * it comes round. Start and stop are O(1), and the task sleeps until the next
+ * slot that holds a timer.
+ */
+
+/** Called from the timer wheel task; must not block for long */
+typedef void (*timer_wheel_cb_t)(void *arg);
+
+/** Caller-owned timer; set up with timer_wheel_timer_init(), treat as opaque */
+typedef struct timer_wheel_timer {
+    struct timer_wheel_timer *next;     // Slot list
+    struct timer_wheel_timer **pprev;   // Link pointing at this timer, NULL when not scheduled
+    struct timer_wheel_timer *all_next; // Every initialised timer, for timer_wheel_dump()
+    TickType_t expires;                 // Tick of the next callback
+    TickType_t period;                  // Ticks between callbacks, 0 for a one-shot timer
+    timer_wheel_cb_t cb;
+    void *arg;
+    const char *name;
+    uint32_t fired;                     // Callbacks so far
+    uint32_t max_run_us;                // Longest callback
+    int8_t level;                       // Wheel level, -1 when on the expired list
+    uint8_t slot;
+} timer_wheel_timer_t;
+
+typedef struct {
+    uint32_t timers;        // Initialised timers
+    uint32_t active;        // Scheduled timers
+    uint32_t wakeups;       // Times the wheel task woke up
+    uint32_t fired;         // Callbacks run
+    uint32_t overruns;      // Periods skipped because a periodic timer ran late
+} timer_wheel_stats_t;
+
+/**
+ * @brief Start the timer wheel task. Call once, before any timer is started.
+ * @return ESP_OK on success
+ */
+esp_err_t timer_wheel_init(void);
+
+/**
+ * @brief Set up a timer. Call once per timer; it stays listed in the dump.
+ * @param timer Timer, usually static
+ * @param name Name for the dump, must outlive the timer
+ * @param cb Callback
+ * @param arg Passed to the callback
+ */
+void timer_wheel_timer_init(timer_wheel_timer_t *timer, const char *name, timer_wheel_cb_t cb, void *arg);
+
+/**
+ * @brief Schedule a timer, replacing any earlier schedule. Safe from any task
+ *        and from the timer's own callback.
+ * @param timer Timer set up with timer_wheel_timer_init()
+ * @param delay_ms Time to the first callback, rounded up to a tick
+ * @param period_ms Time between later callbacks, 0 for a one-shot timer
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE before timer_wheel_init()
+ */
+esp_err_t timer_wheel_start(timer_wheel_timer_t *timer, uint32_t delay_ms, uint32_t period_ms);
+
+/**
+ * @brief Cancel a timer. A callback already running on the wheel task finishes.
+ * @param timer Timer
+ */
+void timer_wheel_stop(timer_wheel_timer_t *timer);
+
+/**
+ * @brief Check whether a timer is scheduled
+ * @param timer Timer
+ * @return true if a callback is pending
+ */
+bool timer_wheel_is_active(const timer_wheel_timer_t *timer);
+
+/**
+ * @brief Get the wheel's counters
+ * @param stats Output
+ */
+void timer_wheel_get_stats(timer_wheel_stats_t *stats);
+
+/**
+ * @brief Print every timer with its period, next expiry and callback cost
+ *        through ESP_LOG
+ */
+void timer_wheel_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,243 @@
+#include <string.h>
+#include <time.h>
+#include "app_hal_sim.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "APP_HAL_SIM";
+
+#define SIM_SPEEDUP             CONFIG_APP_HAL_SIM_SPEEDUP
+#define SIM_HISTORY             CONFIG_APP_HAL_SIM_HISTORY
+#define SIM_MAX_ISRS            4
+
+typedef struct {
+    gpio_num_t pin;
+    app_hal_isr_t isr;
+    void *arg;
+} sim_isr_t;
+
+// Board state, guarded by sim_lock
+static uint64_t sim_levels = 0;
+static uint64_t sim_drv_mask = 0;           // Pins the DRV8833 model listens to
+static sim_isr_t sim_isrs[SIM_MAX_ISRS];
+static size_t sim_isr_count = 0;
+static app_hal_sim_drv8833_pins_t sim_drv;
+static bool sim_drv_attached = false;
+static app_hal_sim_coils_t sim_coils;
+static app_hal_sim_coils_t sim_history[SIM_HISTORY];
+static uint32_t sim_coil_changes = 0;
+static app_hal_sim_coil_cb_t sim_coil_cb = NULL;
+static void *sim_coil_cb_arg = NULL;
+static bool sim_fault_irq_masked = false;
+static portMUX_TYPE sim_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static int64_t sim_epoch_us = 0;
+
+static int64_t sim_real_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// The simulated clock starts at 0 when the program starts, like esp_timer at boot
+__attribute__((constructor)) static void sim_clock_start(void) {
+    sim_epoch_us = sim_real_us();
+}
+
+static bool sim_pin_valid(gpio_num_t pin) {
+    return pin >= 0 && pin < APP_HAL_SIM_PIN_COUNT;
+}
+
+static int8_t sim_bridge(uint64_t levels, gpio_num_t in1, gpio_num_t in2) {
+    int a = (levels >> in1) & 1;
+    int b = (levels >> in2) & 1;
+    if (a == b) {
+        return APP_HAL_SIM_COIL_OFF;
+    }
+    return a ? APP_HAL_SIM_COIL_FWD : APP_HAL_SIM_COIL_REV;
+}
+
+// Apply output writes and let the DRV8833 model react; pins change together
+static void sim_write(uint64_t pin_mask, uint64_t levels) {
+    app_hal_sim_coils_t coils;
+    app_hal_sim_coil_cb_t cb = NULL;
+    void *cb_arg = NULL;
+    int64_t now = app_hal_time_us();
+    
+    portENTER_CRITICAL(&sim_lock);
+    sim_levels = (sim_levels & ~pin_mask) | (levels & pin_mask);
+    bool changed = false;
+    if (sim_drv_attached && (pin_mask & sim_drv_mask) != 0) {
+        bool awake = (sim_levels >> sim_drv.sleep) & 1;
+        coils.time_us = now;
+        coils.coil_a = awake ? sim_bridge(sim_levels, sim_drv.ain1, sim_drv.ain2) : APP_HAL_SIM_COIL_OFF;
+        coils.coil_b = awake ? sim_bridge(sim_levels, sim_drv.bin1, sim_drv.bin2) : APP_HAL_SIM_COIL_OFF;
+        if (coils.coil_a != sim_coils.coil_a || coils.coil_b != sim_coils.coil_b) {
+            sim_coils = coils;
+            sim_history[sim_coil_changes % SIM_HISTORY] = coils;
+            sim_coil_changes++;
+            cb = sim_coil_cb;
+            cb_arg = sim_coil_cb_arg;
+            changed = true;
+        }
+    }
+    portEXIT_CRITICAL(&sim_lock);
+    
+    if (changed && cb != NULL) {
+        cb(&coils, cb_arg);
+    }
+}
+
+esp_err_t app_hal_gpio_output(uint64_t pin_mask) {
+    if (pin_mask >> APP_HAL_SIM_PIN_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+esp_err_t app_hal_gpio_input(gpio_num_t pin, bool pull_up) {
+    if (!sim_pin_valid(pin)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    // An input nobody drives floats to its pull
+    portENTER_CRITICAL(&sim_lock);
+    bool driven = sim_drv_attached && pin == sim_drv.fault;
+    if (!driven && pull_up) {
+        sim_levels |= 1ULL << pin;
+    }
+    portEXIT_CRITICAL(&sim_lock);
+    return ESP_OK;
+}
+
+void app_hal_gpio_set(gpio_num_t pin, uint32_t level) {
+    if (sim_pin_valid(pin)) {
+        sim_write(1ULL << pin, (uint64_t)(level != 0) << pin);
+    }
+}
+
+void app_hal_gpio_set_mask(uint64_t pin_mask, uint64_t levels) {
+    sim_write(pin_mask, levels);
+}
+
+int app_hal_gpio_get(gpio_num_t pin) {
+    if (!sim_pin_valid(pin)) {
+        return 0;
+    }
+    
+    portENTER_CRITICAL(&sim_lock);
+    int level = (sim_levels >> pin) & 1;
+    portEXIT_CRITICAL(&sim_lock);
+    return level;
+}
+
+esp_err_t app_hal_gpio_isr_add(gpio_num_t pin, app_hal_isr_t isr, void *arg) {
+    if (!sim_pin_valid(pin) || isr == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    esp_err_t ret = ESP_OK;
+    portENTER_CRITICAL(&sim_lock);
+    if (sim_isr_count < SIM_MAX_ISRS) {
+        sim_isrs[sim_isr_count++] = (sim_isr_t){ .pin = pin, .isr = isr, .arg = arg };
+    } else {
+        ret = ESP_ERR_NO_MEM;
+    }
+    portEXIT_CRITICAL(&sim_lock);
+    return ret;
+}
+
+int64_t app_hal_time_us(void) {
+    return (sim_real_us() - sim_epoch_us) * SIM_SPEEDUP;
+}
+
+TickType_t app_hal_ms_to_ticks(uint32_t ms) {
+    TickType_t ticks = pdMS_TO_TICKS(ms);
+    
+    // Rounded up so a short delay still yields; delays under SIM_SPEEDUP ticks run slower than scaled
+    return ticks == 0 ? 0 : (ticks + SIM_SPEEDUP - 1) / SIM_SPEEDUP;
+}
+
+int64_t app_hal_ticks_to_us(TickType_t ticks) {
+    return (int64_t)ticks * 1000000 / configTICK_RATE_HZ * SIM_SPEEDUP;
+}
+
+void app_hal_sim_drv8833_attach(const app_hal_sim_drv8833_pins_t *pins) {
+    portENTER_CRITICAL(&sim_lock);
+    sim_drv = *pins;
+    sim_drv_mask = (1ULL << pins->ain1) | (1ULL << pins->ain2) | (1ULL << pins->bin1) |
+                   (1ULL << pins->bin2) | (1ULL << pins->sleep);
+    sim_levels |= 1ULL << pins->fault;
+    memset(&sim_coils, 0, sizeof(sim_coils));
+    sim_coil_changes = 0;
+    sim_drv_attached = true;
+    portEXIT_CRITICAL(&sim_lock);
+    
+    ESP_LOGI(TAG, "DRV8833 model attached, clock at %dx real time", SIM_SPEEDUP);
+}
+
+void app_hal_sim_get_coils(app_hal_sim_coils_t *coils) {
+    portENTER_CRITICAL(&sim_lock);
+    *coils = sim_coils;
+    portEXIT_CRITICAL(&sim_lock);
+}
+
+size_t app_hal_sim_get_history(app_hal_sim_coils_t *out, size_t max) {
+    portENTER_CRITICAL(&sim_lock);
+    size_t n = sim_coil_changes < SIM_HISTORY ? sim_coil_changes : SIM_HISTORY;
+    if (n > max) {
+        n = max;
+    }
+    for (size_t i = 0; i < n; i++) {
+        out[i] = sim_history[(sim_coil_changes - n + i) % SIM_HISTORY];
+    }
+    portEXIT_CRITICAL(&sim_lock);
+    return n;
+}
+
+uint32_t app_hal_sim_get_coil_changes(void) {
+    portENTER_CRITICAL(&sim_lock);
+    uint32_t changes = sim_coil_changes;
+    portEXIT_CRITICAL(&sim_lock);
+    return changes;
+}
+
+void app_hal_sim_set_coil_cb(app_hal_sim_coil_cb_t cb, void *arg) {
+    portENTER_CRITICAL(&sim_lock);
+    sim_coil_cb = cb;
+    sim_coil_cb_arg = arg;
+    portEXIT_CRITICAL(&sim_lock);
+}
+
+void app_hal_sim_set_fault(bool asserted) {
+    sim_isr_t fire[SIM_MAX_ISRS];
+    size_t count = 0;
+    
+    portENTER_CRITICAL(&sim_lock);
+    if (!sim_drv_attached) {
+        portEXIT_CRITICAL(&sim_lock);
+        return;
+    }
+    uint64_t bit = 1ULL << sim_drv.fault;
+    bool was_low = (sim_levels & bit) == 0;
+    if (asserted != was_low) {
+        sim_levels = asserted ? (sim_levels & ~bit) : (sim_levels | bit);
+        for (size_t i = 0; i < sim_isr_count && !sim_fault_irq_masked; i++) {
+            if (sim_isrs[i].pin == sim_drv.fault) {
+                fire[count++] = sim_isrs[i];
+            }
+        }
+    }
+    portEXIT_CRITICAL(&sim_lock);
+    
+    // Both edges interrupt, as on the chip
+    for (size_t i = 0; i < count; i++) {
+        fire[i].isr(fire[i].arg);
+    }
+}
+
+void app_hal_sim_mask_fault_irq(bool masked) {
+    portENTER_CRITICAL(&sim_lock);
+    sim_fault_irq_masked = masked;
+    portEXIT_CRITICAL(&sim_lock);
+}
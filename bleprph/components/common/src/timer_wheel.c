@@ -0,0 +1,334 @@
+#include <string.h>
+#include "timer_wheel.h"
+#include "app_alloc.h"
+#include "app_hal.h"
+#include "esp_log.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "TIMER_WHEEL";
+
+#define WHEEL_BITS              6
+#define WHEEL_SLOTS             (1 << WHEEL_BITS)
+#define WHEEL_MASK              (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS            4
+#define WHEEL_RANGE             (1UL << (WHEEL_BITS * WHEEL_LEVELS))   // Ticks the levels can tell apart
+
+#define WHEEL_TASK_STACK        CONFIG_APP_TIMER_WHEEL_TASK_STACK
+#define WHEEL_TASK_PRIO         CONFIG_APP_TIMER_WHEEL_TASK_PRIO
+
+// Rounded up, so a timer never fires early
+#define WHEEL_MS_TO_TICKS(ms)   ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ + 999) / 1000))
+
+APP_TASK_MEM(wheel_task_mem, WHEEL_TASK_STACK);
+
+// Everything below is guarded by wheel_lock
+static timer_wheel_timer_t *wheel_slots[WHEEL_LEVELS][WHEEL_SLOTS];
+static uint64_t wheel_bitmap[WHEEL_LEVELS];     // Bit per non-empty slot
+static timer_wheel_timer_t *wheel_expired = NULL;   // Due, callbacks not run yet
+static TickType_t wheel_now = 0;                // Next tick to process
+static TickType_t wheel_wake_at = 0;            // When the task wakes up by itself
+static bool wheel_wake_set = false;             // false: the task sleeps until notified
+static timer_wheel_timer_t *wheel_all = NULL;
+static timer_wheel_stats_t wheel_stats;
+static TaskHandle_t wheel_task_handle = NULL;
+static portMUX_TYPE wheel_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void wheel_list_add(timer_wheel_timer_t **head, timer_wheel_timer_t *t) {
+    t->next = *head;
+    if (*head != NULL) {
+        (*head)->pprev = &t->next;
+    }
+    *head = t;
+    t->pprev = head;
+}
+
+static void wheel_unlink(timer_wheel_timer_t *t) {
+    *t->pprev = t->next;
+    if (t->next != NULL) {
+        t->next->pprev = t->pprev;
+    }
+    if (t->level >= 0 && wheel_slots[t->level][t->slot] == NULL) {
+        wheel_bitmap[t->level] &= ~(1ULL << t->slot);
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+    wheel_stats.active--;
+}
+
+// Level and slot follow from the distance to wheel_now and the expiry's bits
+static void wheel_insert(timer_wheel_timer_t *t) {
+    int32_t delta = (int32_t)(t->expires - wheel_now);
+    TickType_t at = t->expires;
+    
+    if (delta < 0) {
+        delta = 0;
+        at = wheel_now;
+    } else if ((uint32_t)delta >= WHEEL_RANGE) {
+        // Parked; moved down with its real expiry when the slot comes round
+        delta = WHEEL_RANGE - 1;
+        at = wheel_now + WHEEL_RANGE - 1;
+    }
+    
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && (uint32_t)delta >= (1UL << (WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    
+    t->level = (int8_t)level;
+    t->slot = (uint8_t)((at >> (WHEEL_BITS * level)) & WHEEL_MASK);
+    wheel_list_add(&wheel_slots[level][t->slot], t);
+    wheel_bitmap[level] |= 1ULL << t->slot;
+    wheel_stats.active++;
+}
+
+// Slots from idx onwards, wrapping, to the next non-empty one
+static uint32_t wheel_distance(uint64_t bitmap, uint32_t idx) {
+    uint64_t rotated = idx == 0 ? bitmap : (bitmap >> idx) | (bitmap << (WHEEL_SLOTS - idx));
+    return (uint32_t)__builtin_ctzll(rotated);
+}
+
+// First tick at or after wheel_now that has work: a level 0 slot to run, or a
+// higher slot to move down. O(levels) thanks to the bitmaps.
+static bool wheel_next(TickType_t *next) {
+    bool found = false;
+    
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (wheel_bitmap[level] == 0) {
+            continue;
+        }
+        
+        // A level's slot is moved down on a tick that is a multiple of its unit
+        uint32_t shift = WHEEL_BITS * level;
+        TickType_t unit = (TickType_t)1 << shift;
+        TickType_t base = (wheel_now + unit - 1) & ~(unit - 1);
+        uint32_t idx = (base >> shift) & WHEEL_MASK;
+        TickType_t t = base + (TickType_t)wheel_distance(wheel_bitmap[level], idx) * unit;
+        
+        if (!found || (int32_t)(t - *next) < 0) {
+            *next = t;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static void wheel_cascade(int level, uint32_t idx) {
+    timer_wheel_timer_t *t = wheel_slots[level][idx];
+    
+    wheel_slots[level][idx] = NULL;
+    wheel_bitmap[level] &= ~(1ULL << idx);
+    while (t != NULL) {
+        timer_wheel_timer_t *next = t->next;
+        wheel_stats.active--;
+        wheel_insert(t);
+        t = next;
+    }
+}
+
+// Process tick wheel_now: move down the higher slots due now, then make the
+// level 0 slot the expired list
+static void wheel_tick(void) {
+    TickType_t now = wheel_now;
+    
+    if ((now & WHEEL_MASK) == 0) {
+        for (int level = 1; level < WHEEL_LEVELS; level++) {
+            uint32_t idx = (now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+            wheel_cascade(level, idx);
+            if (idx != 0) {
+                break;
+            }
+        }
+    }
+    
+    uint32_t idx = now & WHEEL_MASK;
+    wheel_expired = wheel_slots[0][idx];
+    if (wheel_expired != NULL) {
+        wheel_expired->pprev = &wheel_expired;
+        for (timer_wheel_timer_t *t = wheel_expired; t != NULL; t = t->next) {
+            t->level = -1;
+        }
+    }
+    wheel_slots[0][idx] = NULL;
+    wheel_bitmap[0] &= ~(1ULL << idx);
+    wheel_now = now + 1;
+}
+
+// Next timer due by now, already rescheduled if periodic; NULL when none
+static timer_wheel_timer_t *wheel_pop(TickType_t now) {
+    while (wheel_expired == NULL) {
+        TickType_t next;
+        if (!wheel_next(&next) || (int32_t)(next - now) > 0) {
+            // Nothing due; ticks up to now need no processing
+            if ((int32_t)(now + 1 - wheel_now) > 0) {
+                wheel_now = now + 1;
+            }
+            return NULL;
+        }
+        wheel_now = next;
+        wheel_tick();
+    }
+    
+    timer_wheel_timer_t *t = wheel_expired;
+    wheel_unlink(t);
+    if (t->period != 0) {
+        // Keep the phase; a timer that fell a whole period behind skips ahead
+        t->expires += t->period;
+        if ((int32_t)(t->expires - now) <= 0) {
+            wheel_stats.overruns++;
+            t->expires = now + t->period;
+        }
+        wheel_insert(t);
+    }
+    t->fired++;
+    wheel_stats.fired++;
+    return t;
+}
+
+static void wheel_task(void *arg) {
+    for (;;) {
+        TickType_t now = xTaskGetTickCount();
+        
+        // One timer per critical section; a callback may start or stop any timer
+        for (;;) {
+            portENTER_CRITICAL(&wheel_lock);
+            timer_wheel_timer_t *t = wheel_pop(now);
+            timer_wheel_cb_t cb = t != NULL ? t->cb : NULL;
+            void *cb_arg = t != NULL ? t->arg : NULL;
+            portEXIT_CRITICAL(&wheel_lock);
+            if (t == NULL) {
+                break;
+            }
+            
+            int64_t start = app_hal_time_us();
+            cb(cb_arg);
+            uint32_t run_us = (uint32_t)(app_hal_time_us() - start);
+            if (run_us > t->max_run_us) {
+                t->max_run_us = run_us;
+            }
+        }
+        
+        TickType_t next = 0;
+        portENTER_CRITICAL(&wheel_lock);
+        wheel_wake_set = wheel_next(&next);
+        wheel_wake_at = next;
+        portEXIT_CRITICAL(&wheel_lock);
+        
+        TickType_t wait = portMAX_DELAY;
+        if (wheel_wake_set) {
+            int32_t left = (int32_t)(next - xTaskGetTickCount());
+            wait = left > 0 ? (TickType_t)left : 0;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+        
+        portENTER_CRITICAL(&wheel_lock);
+        wheel_stats.wakeups++;
+        portEXIT_CRITICAL(&wheel_lock);
+    }
+}
+
+esp_err_t timer_wheel_init(void) {
+    if (wheel_task_handle != NULL) {
+        return ESP_OK;
+    }
+    
+    wheel_now = xTaskGetTickCount();
+    if (app_task_create(&wheel_task_mem, wheel_task, "timer_wheel", WHEEL_TASK_STACK, NULL,
+                        WHEEL_TASK_PRIO, &wheel_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create timer wheel task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void timer_wheel_timer_init(timer_wheel_timer_t *timer, const char *name, timer_wheel_cb_t cb, void *arg) {
+    memset(timer, 0, sizeof(*timer));
+    timer->name = name;
+    timer->cb = cb;
+    timer->arg = arg;
+    
+    portENTER_CRITICAL(&wheel_lock);
+    timer->all_next = wheel_all;
+    wheel_all = timer;
+    wheel_stats.timers++;
+    portEXIT_CRITICAL(&wheel_lock);
+}
+
+esp_err_t timer_wheel_start(timer_wheel_timer_t *timer, uint32_t delay_ms, uint32_t period_ms) {
+    if (wheel_task_handle == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    TickType_t period = WHEEL_MS_TO_TICKS(period_ms);
+    TickType_t expires = xTaskGetTickCount() + WHEEL_MS_TO_TICKS(delay_ms);
+    
+    bool wake = false;
+    portENTER_CRITICAL(&wheel_lock);
+    if (timer->pprev != NULL) {
+        wheel_unlink(timer);
+    }
+    timer->expires = expires;
+    timer->period = period;
+    wheel_insert(timer);
+    
+    // The task sleeps until wheel_wake_at; an earlier timer has to wake it
+    if (!wheel_wake_set || (int32_t)(expires - wheel_wake_at) < 0) {
+        wheel_wake_set = true;
+        wheel_wake_at = expires;
+        wake = true;
+    }
+    portEXIT_CRITICAL(&wheel_lock);
+    
+    if (wake) {
+        xTaskNotifyGive(wheel_task_handle);
+    }
+    return ESP_OK;
+}
+
+void timer_wheel_stop(timer_wheel_timer_t *timer) {
+    portENTER_CRITICAL(&wheel_lock);
+    if (timer->pprev != NULL) {
+        wheel_unlink(timer);
+    }
+    timer->period = 0;
+    portEXIT_CRITICAL(&wheel_lock);
+}
+
+bool timer_wheel_is_active(const timer_wheel_timer_t *timer) {
+    return timer->pprev != NULL;
+}
+
+void timer_wheel_get_stats(timer_wheel_stats_t *stats) {
+    portENTER_CRITICAL(&wheel_lock);
+    *stats = wheel_stats;
+    portEXIT_CRITICAL(&wheel_lock);
+}
+
+void timer_wheel_dump(void) {
+    timer_wheel_stats_t stats;
+    TickType_t now = xTaskGetTickCount();
+    
+    timer_wheel_get_stats(&stats);
+    ESP_LOGI(TAG, "%lu timers, %lu active, %lu wakeups, %lu callbacks, %lu overruns",
+             (unsigned long)stats.timers, (unsigned long)stats.active, (unsigned long)stats.wakeups,
+             (unsigned long)stats.fired, (unsigned long)stats.overruns);
+    ESP_LOGI(TAG, "  %-14s %9s %9s %8s %8s", "name", "period_ms", "next_ms", "fired", "max_us");
+    
+    // The list only grows at its head, so walking it needs no lock
+    for (timer_wheel_timer_t *t = wheel_all; t != NULL; t = t->all_next) {
+        portENTER_CRITICAL(&wheel_lock);
+        timer_wheel_timer_t copy = *t;
+        portEXIT_CRITICAL(&wheel_lock);
+        
+        if (copy.pprev != NULL) {
+            int32_t left = (int32_t)(copy.expires - now);
+            ESP_LOGI(TAG, "  %-14s %9lu %9ld %8lu %8lu", copy.name,
+                     (unsigned long)(copy.period * portTICK_PERIOD_MS),
+                     (long)((left > 0 ? left : 0) * portTICK_PERIOD_MS),
+                     (unsigned long)copy.fired, (unsigned long)copy.max_run_us);
+        } else {
+            ESP_LOGI(TAG, "  %-14s %9s %9s %8lu %8lu", copy.name, "-", "-",
+                     (unsigned long)copy.fired, (unsigned long)copy.max_run_us);
+        }
+    }
+}
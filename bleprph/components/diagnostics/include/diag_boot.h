@@ -0,0 +1,74 @@
+#ifndef DIAG_BOOT_H
+#define DIAG_BOOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Boot stage table: X(id, name). Each stage keeps the time it was first
+ * reached. Append new stages at the end so the BLE table layout stays stable.
+ */
+#define DIAG_BOOT_STAGES(X) \
+    X(BOOT_APP_MAIN,        "app_main") \
+    X(BOOT_NVS_READY,       "nvs_ready") \
+    X(BOOT_BLE_STARTED,     "ble_started") \
+    X(BOOT_MOTOR_READY,     "motor_ready") \
+    X(BOOT_INIT_DONE,       "init_done") \
+    X(BOOT_BLE_SYNC,        "ble_sync") \
+    X(BOOT_FIRST_ADV,       "first_adv") \
+    X(BOOT_FIRST_CONNECT,   "first_connect") \
+    X(BOOT_FIRST_MOTION,    "first_motion")
+
+#define DIAG_BOOT_ID_ENUM(id, name)     id,
+
+typedef enum {
+    DIAG_BOOT_STAGES(DIAG_BOOT_ID_ENUM)
+    BOOT_STAGE_COUNT
+} diag_boot_stage_t;
+
+/** Timeline flags */
+#define DIAG_BOOT_FLAG_FROM_RESET   0x01    // Times count from power-on, not from the app's timer start
+#define DIAG_BOOT_FLAG_NVS_ERASED   0x02    // NVS was erased and reinitialised during this boot
+
+/**
+ * @brief Record that a stage was reached. Only the first call per stage counts;
+ *        later calls cost one comparison. Safe from any task.
+ * @param stage Stage ID
+ * @return true if this call recorded the stage
+ */
+bool diag_boot_mark(diag_boot_stage_t stage);
+
+/**
+ * @brief Set timeline flags
+ * @param flags DIAG_BOOT_FLAG_* bits
+ */
+void diag_boot_set_flags(uint32_t flags);
+
+/**
+ * @brief Get the timeline
+ * @param times_us Output, BOOT_STAGE_COUNT entries; 0 for a stage not reached yet
+ * @param flags Output DIAG_BOOT_FLAG_* bits, may be NULL
+ */
+void diag_boot_get(uint32_t times_us[BOOT_STAGE_COUNT], uint32_t *flags);
+
+/**
+ * @brief Get a stage's name
+ * @param stage Stage ID
+ * @return Name, "?" for an unknown ID
+ */
+const char *diag_boot_name(diag_boot_stage_t stage);
+
+/**
+ * @brief Print the timeline through ESP_LOG
+ */
+void diag_boot_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIAG_BOOT_H
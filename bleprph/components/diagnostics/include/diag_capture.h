@@ -0,0 +1,153 @@
+#ifndef DIAG_CAPTURE_H
+#define DIAG_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Capture dump format (little endian), shared by the firmware, the host
+ * simulation and tools/capture_to_vcd.py:
+ *
+ *   header  [magic:4 "SCAP"][version:2][record_size:2][count:4][trigger_index:4]
+ *           [names: DIAG_CAPTURE_MAX_SIGNALS x DIAG_CAPTURE_NAME_LEN, NUL padded]
+ *   records count x [timestamp_us:4][state:1][written:1][reserved:2]
+ *
+ * state holds the level of every signal after the write, written the bits the
+ * write touched. trigger_index is DIAG_CAPTURE_NO_TRIGGER if the capture was
+ * stopped before it triggered.
+ */
+#define DIAG_CAPTURE_MAGIC          0x50414353UL    // "SCAP"
+#define DIAG_CAPTURE_VERSION        1
+#define DIAG_CAPTURE_MAX_SIGNALS    8
+#define DIAG_CAPTURE_NAME_LEN       8
+#define DIAG_CAPTURE_NO_TRIGGER     0xFFFFFFFFUL
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t count;
+    uint32_t trigger_index;
+    char names[DIAG_CAPTURE_MAX_SIGNALS][DIAG_CAPTURE_NAME_LEN];
+} diag_capture_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp_us;
+    uint8_t state;
+    uint8_t written;
+    uint16_t reserved;
+} diag_capture_record_t;
+
+typedef enum {
+    DIAG_CAPTURE_IDLE = 0,      // Not recording
+    DIAG_CAPTURE_ARMED,         // Recording pre-trigger history, waiting for the trigger
+    DIAG_CAPTURE_TRIGGERED,     // Recording until the buffer is full
+    DIAG_CAPTURE_DONE           // Buffer frozen, ready to dump
+} diag_capture_state_t;
+
+/** Trigger when (state & mask) == value becomes true; mask 0 triggers at once */
+typedef struct {
+    uint8_t mask;
+    uint8_t value;
+    uint16_t pre_samples;       // Records kept from before the trigger (< CONFIG_DIAG_CAPTURE_DEPTH)
+} diag_capture_trigger_t;
+
+typedef struct {
+    diag_capture_state_t state;
+    uint32_t count;             // Records currently held
+    uint32_t trigger_index;     // Index of the triggering record, DIAG_CAPTURE_NO_TRIGGER if none
+} diag_capture_status_t;
+
+#ifdef CONFIG_DIAG_CAPTURE
+
+/** Report a signal write; compiles to nothing without CONFIG_DIAG_CAPTURE */
+#define DIAG_CAPTURE_SIGNAL(bit, level)     diag_capture_signal((bit), (level))
+#define DIAG_CAPTURE_SIGNALS(mask, levels)  diag_capture_signals((mask), (levels))
+
+#else
+
+#define DIAG_CAPTURE_SIGNAL(bit, level)     do { } while (0)
+#define DIAG_CAPTURE_SIGNALS(mask, levels)  do { } while (0)
+
+#endif
+
+/**
+ * @brief Name the signals (names longer than DIAG_CAPTURE_NAME_LEN - 1 are cut)
+ * @param names One name per signal bit, starting at bit 0
+ * @param count Number of names, at most DIAG_CAPTURE_MAX_SIGNALS
+ */
+void diag_capture_set_signal_names(const char *const *names, int count);
+
+/**
+ * @brief Record a write to one signal; safe from tasks and ISRs
+ *
+ * The current level of every signal is tracked even when no capture is
+ * armed, so the first record of a capture has the full state.
+ *
+ * @param bit Signal mask (one bit)
+ * @param level New level
+ */
+void diag_capture_signal(uint8_t bit, bool level);
+
+/**
+ * @brief Record one write to several signals as a single record
+ * @param mask Signals the write touched
+ * @param levels New levels of the signals in mask
+ */
+void diag_capture_signals(uint8_t mask, uint8_t levels);
+
+/**
+ * @brief Start a capture, discarding the previous one
+ * @param trigger Trigger condition and pre-trigger depth
+ * @return ESP_OK, ESP_ERR_INVALID_ARG if pre_samples does not fit,
+ *         ESP_ERR_NOT_SUPPORTED without CONFIG_DIAG_CAPTURE
+ */
+esp_err_t diag_capture_arm(const diag_capture_trigger_t *trigger);
+
+/**
+ * @brief Freeze the buffer (armed or triggered capture ends early)
+ */
+void diag_capture_stop(void);
+
+/**
+ * @brief Get the capture status
+ * @param status Output
+ */
+void diag_capture_get_status(diag_capture_status_t *status);
+
+/**
+ * @brief Print the frozen capture as hex lines through ESP_LOG
+ *
+ * Runs in a short-lived priority 1 task so the caller is not held up by the
+ * UART. Lines are "CAP BEGIN", "CAP <hex>" (header, then records) and
+ * "CAP END"; tools/capture_to_vcd.py reads them from a monitor log. A
+ * running capture is stopped first.
+ *
+ * @return ESP_OK if the dump was started, ESP_ERR_INVALID_STATE if one is in progress
+ */
+esp_err_t diag_capture_dump(void);
+
+/**
+ * @brief Copy the capture in the dump format, as one binary block
+ *
+ * For the host simulation, which writes it to a file for
+ * tools/capture_to_vcd.py. A running capture is stopped first.
+ *
+ * @param out Buffer, or NULL to get the size only
+ * @param len Size of out
+ * @return Size of the dump in bytes; nothing is copied if len is smaller
+ */
+size_t diag_capture_copy(uint8_t *out, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIAG_CAPTURE_H
@@ -0,0 +1,57 @@
+#ifndef DIAG_HIST_H
+#define DIAG_HIST_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Log2 buckets: bucket 0 counts the value 0, bucket k (k >= 1) counts
+ * [2^(k-1), 2^k - 1]. The last bucket also takes everything larger.
+ * With microsecond values, 24 buckets reach about 8 s.
+ */
+#define DIAG_HIST_BUCKETS   24
+
+typedef struct {
+    uint32_t buckets[DIAG_HIST_BUCKETS];
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} diag_hist_t;
+
+/**
+ * @brief Clear a histogram. Histograms are not locked; the owner serializes access.
+ * @param hist Histogram
+ */
+void diag_hist_reset(diag_hist_t *hist);
+
+/**
+ * @brief Count one value
+ * @param hist Histogram
+ * @param value Value to add
+ */
+void diag_hist_add(diag_hist_t *hist, uint32_t value);
+
+/**
+ * @brief Estimate a percentile
+ * @param hist Histogram
+ * @param permille Percentile in tenths of a percent (500 = median, 990 = p99)
+ * @return Upper bound of the bucket holding the percentile, capped at max; 0 if empty
+ */
+uint32_t diag_hist_percentile(const diag_hist_t *hist, uint32_t permille);
+
+/**
+ * @brief Mean of all values
+ * @param hist Histogram
+ * @return Mean, 0 if empty
+ */
+uint32_t diag_hist_mean(const diag_hist_t *hist);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIAG_HIST_H
@@ -0,0 +1,58 @@
+#ifndef DIAG_POWER_H
+#define DIAG_POWER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Power statistics flags */
+#define DIAG_POWER_FLAG_PM          0x01    // CONFIG_PM_ENABLE: frequency scaling is active
+#define DIAG_POWER_FLAG_SLEEP_CNT   0x02    // Light sleep time is counted (CONFIG_PM_LIGHT_SLEEP_CALLBACKS)
+
+typedef struct {
+    uint64_t window_us;                     // Since diag_power_init() or the last reset
+    uint64_t sleep_us;                      // In automatic light sleep
+    uint64_t perf_us;                       // With a performance lock held (motor stepping)
+    uint32_t sleep_count;                   // Light sleep periods
+    uint32_t avg_ua;                        // Estimated average chip current
+    uint32_t baseline_ua;                   // Same chip always at the maximum frequency, never sleeping
+    uint16_t saving_permille;               // 1000 - 1000 * avg_ua / baseline_ua
+    uint8_t flags;                          // DIAG_POWER_FLAG_*
+} diag_power_stats_t;
+
+/**
+ * @brief Start the residency window and count light sleep periods
+ * @return ESP_OK on success
+ */
+esp_err_t diag_power_init(void);
+
+/**
+ * @brief Note that a performance lock was taken (max APB frequency, no light
+ *        sleep). Calls nest; the time counts until the matching end.
+ */
+void diag_power_perf_begin(void);
+
+/**
+ * @brief Note that a performance lock was released
+ */
+void diag_power_perf_end(void);
+
+/**
+ * @brief Get the residency counters and the current estimate
+ * @param stats Output
+ */
+void diag_power_get_stats(diag_power_stats_t *stats);
+
+/**
+ * @brief Start a new residency window
+ */
+void diag_power_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIAG_POWER_H
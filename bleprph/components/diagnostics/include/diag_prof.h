@@ -0,0 +1,147 @@
+#ifndef DIAG_PROF_H
+#define DIAG_PROF_H
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#ifdef CONFIG_DIAG_PROF
+#include "esp_cpu.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Region switches, from menuconfig → Diagnostics → Profiling
+#ifdef CONFIG_DIAG_PROF_STEP_OUTPUT
+#define DIAG_PROF_STEP_OUTPUT_ON    1
+#else
+#define DIAG_PROF_STEP_OUTPUT_ON    0
+#endif
+
+#ifdef CONFIG_DIAG_PROF_CMD_DISPATCH
+#define DIAG_PROF_CMD_DISPATCH_ON   1
+#else
+#define DIAG_PROF_CMD_DISPATCH_ON   0
+#endif
+
+#ifdef CONFIG_DIAG_PROF_GATT_ACCESS
+#define DIAG_PROF_GATT_ACCESS_ON    1
+#else
+#define DIAG_PROF_GATT_ACCESS_ON    0
+#endif
+
+#ifdef CONFIG_DIAG_PROF_STATUS_READ
+#define DIAG_PROF_STATUS_READ_ON    1
+#else
+#define DIAG_PROF_STATUS_READ_ON    0
+#endif
+
+/**
+ * Region table: X(id, enabled, name). Each region must be entered by one task
+ * at a time. Append new regions at the end so the BLE table layout stays stable.
+ */
+#define DIAG_PROF_REGIONS(X) \
+    X(PROF_STEP_OUTPUT,     DIAG_PROF_STEP_OUTPUT_ON,   "step_output") \
+    X(PROF_CMD_DISPATCH,    DIAG_PROF_CMD_DISPATCH_ON,  "cmd_dispatch") \
+    X(PROF_GATT_ACCESS,     DIAG_PROF_GATT_ACCESS_ON,   "gatt_access") \
+    X(PROF_STATUS_READ,     DIAG_PROF_STATUS_READ_ON,   "status_read")
+
+#define DIAG_PROF_ID_ENUM(id, enabled, name)        id,
+#define DIAG_PROF_ENABLED_ENUM(id, enabled, name)   id##_ENABLED = (enabled),
+
+typedef enum {
+    DIAG_PROF_REGIONS(DIAG_PROF_ID_ENUM)
+    PROF_REGION_COUNT
+} diag_prof_id_t;
+
+enum {
+    DIAG_PROF_REGIONS(DIAG_PROF_ENABLED_ENUM)
+};
+
+typedef struct {
+    uint32_t count;             // Completed passes since the last reset
+    uint32_t min_cycles;        // 0 when count is 0
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+} diag_prof_stats_t;
+
+#ifdef CONFIG_DIAG_PROF
+
+/**
+ * @brief Start timing a region. Declares locals, so use it at most once per
+ *        region and scope. A disabled region compiles to nothing.
+ */
+#define DIAG_PROF_BEGIN(region)                                                         \
+    int diag_prof_core_##region = (region##_ENABLED) ? esp_cpu_get_core_id() : 0;       \
+    uint32_t diag_prof_t0_##region = (region##_ENABLED) ? esp_cpu_get_cycle_count() : 0
+
+/**
+ * @brief Stop timing a region and add the elapsed cycles to its statistics.
+ *        A pass that moved to the other core is dropped: the cycle counters
+ *        of the two cores are not in step.
+ */
+#define DIAG_PROF_END(region) do {                                                      \
+        if (region##_ENABLED) {                                                         \
+            uint32_t diag_prof_t1 = esp_cpu_get_cycle_count();                          \
+            if (esp_cpu_get_core_id() == diag_prof_core_##region) {                     \
+                diag_prof_record((region), diag_prof_t1 - diag_prof_t0_##region);       \
+            }                                                                           \
+        }                                                                               \
+    } while (0)
+
+#else
+
+// Without profiling nothing is timed, and no cycle counter is needed (the linux target has none)
+#define DIAG_PROF_BEGIN(region)     do { } while (0)
+#define DIAG_PROF_END(region)       do { } while (0)
+
+#endif
+
+/**
+ * @brief Add one pass to a region; called by DIAG_PROF_END
+ * @param region Region ID
+ * @param cycles CPU cycles spent in the region
+ */
+void diag_prof_record(diag_prof_id_t region, uint32_t cycles);
+
+/**
+ * @brief Get a region's statistics
+ * @param region Region ID
+ * @param stats Output
+ */
+void diag_prof_get_stats(diag_prof_id_t region, diag_prof_stats_t *stats);
+
+/**
+ * @brief Clear the statistics of every region
+ */
+void diag_prof_reset(void);
+
+/**
+ * @brief Get a region's name
+ * @param region Region ID
+ * @return Name, "?" for an unknown ID
+ */
+const char *diag_prof_name(diag_prof_id_t region);
+
+/**
+ * @brief Get the regions compiled in
+ * @return Bit per diag_prof_id_t
+ */
+uint32_t diag_prof_enabled_mask(void);
+
+/**
+ * @brief Current CPU clock, to turn cycles into time
+ * @return CPU cycles per microsecond
+ */
+uint32_t diag_prof_cycles_per_us(void);
+
+/**
+ * @brief Print the region table (count, min/avg/max cycles and us) through ESP_LOG
+ */
+void diag_prof_dump(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIAG_PROF_H
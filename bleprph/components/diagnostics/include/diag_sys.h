@@ -0,0 +1,58 @@
+#ifndef DIAG_SYS_H
+#define DIAG_SYS_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DIAG_SYS_MAX_TASKS          16      // Tasks kept in a snapshot
+#define DIAG_SYS_NAME_LEN           16      // CONFIG_FREERTOS_MAX_TASK_NAME_LEN
+#define DIAG_SYS_CPU_UNKNOWN        0xFFFF  // cpu_permille without CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+#define DIAG_SYS_CORE_ANY           0xFF    // Task not pinned to a core
+
+typedef struct {
+    char name[DIAG_SYS_NAME_LEN];           // NUL padded, not terminated at full length
+    uint16_t cpu_permille;                  // Share of all cores over the last period
+    uint8_t priority;                       // Current priority
+    uint8_t core;                           // Affinity, DIAG_SYS_CORE_ANY if none
+    uint32_t stack_hwm;                     // Least free stack since the task started (bytes)
+} diag_sys_task_t;
+
+typedef struct {
+    uint32_t timestamp_us;                  // esp_timer time of the snapshot, 0 before the first one
+    uint32_t period_us;                     // Window the CPU shares cover
+    uint32_t heap_free;                     // Free bytes in the default heap
+    uint32_t heap_min_free;                 // Lowest heap_free since boot
+    uint32_t heap_largest;                  // Largest block that can be allocated
+    uint8_t task_count;                     // Entries in tasks
+    uint8_t tasks_total;                    // Tasks in the system; more than task_count if the table was full
+    diag_sys_task_t tasks[DIAG_SYS_MAX_TASKS];
+} diag_sys_snapshot_t;
+
+/**
+ * @brief Take the first snapshot and start refreshing it every
+ *        CONFIG_DIAG_SYS_PERIOD_MS from the timer wheel
+ *
+ * The refresh runs in the timer wheel task (CONFIG_APP_TIMER_WHEEL_TASK_PRIO,
+ * 4 by default), inline with every other wheel callback. While it walks the
+ * task table, callbacks due at the same time (e.g. the motor fault re-check)
+ * wait for it. Call timer_wheel_init() first.
+ *
+ * @return ESP_OK on success
+ */
+esp_err_t diag_sys_init(void);
+
+/**
+ * @brief Copy the latest snapshot; cheap, nothing is measured here
+ * @param snap Output
+ */
+void diag_sys_get_snapshot(diag_sys_snapshot_t *snap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIAG_SYS_H
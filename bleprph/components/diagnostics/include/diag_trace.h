@@ -0,0 +1,142 @@
+#ifndef DIAG_TRACE_H
+#define DIAG_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Trace levels; an event is compiled in when its level is <= CONFIG_DIAG_TRACE_LEVEL */
+#define DIAG_TRACE_LEVEL_NONE       0
+#define DIAG_TRACE_LEVEL_ERROR      1
+#define DIAG_TRACE_LEVEL_WARN       2
+#define DIAG_TRACE_LEVEL_INFO       3
+#define DIAG_TRACE_LEVEL_DEBUG      4
+
+#ifndef CONFIG_DIAG_TRACE_LEVEL
+#define CONFIG_DIAG_TRACE_LEVEL     DIAG_TRACE_LEVEL_NONE
+#endif
+
+#define DIAG_TRACE_MAX_ARGS         3
+
+/**
+ * Event table: X(id, level, format). The format is applied by the drain task
+ * to the three arguments as unsigned long, so use %lu, %ld or %lx only.
+ * Append new events at the end so recorded IDs stay stable.
+ */
+#define DIAG_TRACE_EVENTS(X) \
+    X(TRACE_EVT_BENCHMARK,      DIAG_TRACE_LEVEL_DEBUG, "benchmark i=%lu") \
+    X(TRACE_EVT_GATT_READ,      DIAG_TRACE_LEVEL_INFO,  "GATT read attr=%lu conn=%lu") \
+    X(TRACE_EVT_GATT_WRITE,     DIAG_TRACE_LEVEL_INFO,  "GATT write attr=%lu conn=%lu len=%lu") \
+    X(TRACE_EVT_MOTOR_BATCH,    DIAG_TRACE_LEVEL_INFO,  "Motor batch queued count=%lu conn=%lu") \
+    X(TRACE_EVT_MOTOR_STOP,     DIAG_TRACE_LEVEL_INFO,  "Motor stopped pos=%ld") \
+    X(TRACE_EVT_MOTOR_MOVE,     DIAG_TRACE_LEVEL_INFO,  "Move cmd=%lu target=%ld id=%lu") \
+    X(TRACE_EVT_MOTOR_SPEED,    DIAG_TRACE_LEVEL_INFO,  "Speed set delay_ms=%lu") \
+    X(TRACE_EVT_MOTOR_REACHED,  DIAG_TRACE_LEVEL_INFO,  "Reached target pos=%ld id=%lu") \
+    X(TRACE_EVT_MOTOR_LATENCY,  DIAG_TRACE_LEVEL_WARN,  "Command latency over budget total_us=%lu dequeue_to_step_us=%lu id=%lu")
+
+#define DIAG_TRACE_ID_ENUM(id, level, fmt)      id,
+#define DIAG_TRACE_LEVEL_ENUM(id, level, fmt)   id##_LEVEL = (level),
+
+typedef enum {
+    DIAG_TRACE_EVENTS(DIAG_TRACE_ID_ENUM)
+    TRACE_EVT_COUNT
+} diag_trace_id_t;
+
+enum {
+    DIAG_TRACE_EVENTS(DIAG_TRACE_LEVEL_ENUM)
+};
+
+/** One ring slot (24 bytes) */
+typedef struct {
+    uint32_t seq;                           // Write index + 1 once complete, 0 while being written
+    uint32_t timestamp_us;                  // esp_timer time, wraps after ~71 minutes
+    uint16_t id;                            // diag_trace_id_t
+    uint8_t core;                           // CPU that recorded the event
+    uint8_t reserved;
+    uint32_t args[DIAG_TRACE_MAX_ARGS];
+} diag_trace_record_t;
+
+typedef struct {
+    uint32_t recorded;                      // Events written since boot
+    uint32_t dropped;                       // Events overwritten before they were read
+    uint32_t pending;                       // Events waiting to be read
+} diag_trace_stats_t;
+
+#if CONFIG_DIAG_TRACE_LEVEL > DIAG_TRACE_LEVEL_NONE
+
+/**
+ * @brief Record an event; disabled levels compile to nothing and their
+ *        arguments are not evaluated. Safe from any task or ISR.
+ */
+#define DIAG_TRACE(id, a0, a1, a2) do {                                             \
+        if ((id##_LEVEL) <= CONFIG_DIAG_TRACE_LEVEL) {                              \
+            diag_trace_record((id), (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2)); \
+        }                                                                           \
+    } while (0)
+
+#else
+
+#define DIAG_TRACE(id, a0, a1, a2) do { } while (0)
+
+#endif
+
+/**
+ * @brief Start the trace ring (and the drain task if enabled)
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED if tracing is compiled out
+ */
+esp_err_t diag_trace_init(void);
+
+/**
+ * @brief Append an event to the ring; lock-free, never blocks
+ * @param id Event ID
+ * @param a0 First argument
+ * @param a1 Second argument
+ * @param a2 Third argument
+ */
+void diag_trace_record(diag_trace_id_t id, uint32_t a0, uint32_t a1, uint32_t a2);
+
+/**
+ * @brief Take the oldest unread events out of the ring
+ *
+ * The ring has a single read position shared by all readers, so with the
+ * drain task enabled it consumes everything and this returns little.
+ *
+ * @param out Output records
+ * @param max Capacity of out
+ * @return Number of records copied
+ */
+size_t diag_trace_read(diag_trace_record_t *out, size_t max);
+
+/**
+ * @brief Format a record as text (without timestamp)
+ * @param rec Record
+ * @param buf Output buffer
+ * @param len Size of buf
+ * @return Number of characters written, as snprintf
+ */
+int diag_trace_format(const diag_trace_record_t *rec, char *buf, size_t len);
+
+/**
+ * @brief Get ring counters
+ * @param stats Output
+ */
+void diag_trace_get_stats(diag_trace_stats_t *stats);
+
+/**
+ * @brief Measure the cost of diag_trace_record() against formatting the
+ *        equivalent log line, and log both
+ * @param iterations Number of events to record
+ * @return Average CPU cycles per recorded event
+ */
+uint32_t diag_trace_benchmark(uint32_t iterations);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIAG_TRACE_H
@@ -0,0 +1,92 @@
+#include <string.h>
+#include "diag_boot.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_private/esp_clk.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "DIAG_BOOT";
+
+#define BOOT_NAME_ENTRY(id, name)       [id] = name,
+
+static const char *const boot_names[BOOT_STAGE_COUNT] = {
+    DIAG_BOOT_STAGES(BOOT_NAME_ENTRY)
+};
+
+// Marked from app_main, the host task and the motor path
+static uint32_t boot_times[BOOT_STAGE_COUNT];
+static uint32_t boot_flags = 0;
+static int64_t boot_offset_us = 0;     // Power-on to esp_timer zero, 0 if not known
+static portMUX_TYPE boot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// esp_timer starts with the app, after the ROM and second stage bootloader.
+// The RTC timer runs from power-on, so on a cold boot their difference is the
+// time spent before the app. After any other reset the RTC timer kept running.
+static void boot_measure_offset(void) {
+    if (esp_reset_reason() != ESP_RST_POWERON) {
+        return;
+    }
+    
+    int64_t offset = (int64_t)esp_clk_rtc_time() - esp_timer_get_time();
+    if (offset > 0) {
+        boot_offset_us = offset;
+        boot_flags |= DIAG_BOOT_FLAG_FROM_RESET;
+    }
+}
+
+bool diag_boot_mark(diag_boot_stage_t stage) {
+    if (stage >= BOOT_STAGE_COUNT || boot_times[stage] != 0) {
+        return false;
+    }
+    
+    if (stage == BOOT_APP_MAIN) {
+        boot_measure_offset();
+    }
+    uint32_t now = (uint32_t)(esp_timer_get_time() + boot_offset_us);
+    
+    bool first = false;
+    portENTER_CRITICAL(&boot_lock);
+    if (boot_times[stage] == 0) {
+        boot_times[stage] = now > 0 ? now : 1;
+        first = true;
+    }
+    portEXIT_CRITICAL(&boot_lock);
+    return first;
+}
+
+void diag_boot_set_flags(uint32_t flags) {
+    portENTER_CRITICAL(&boot_lock);
+    boot_flags |= flags;
+    portEXIT_CRITICAL(&boot_lock);
+}
+
+void diag_boot_get(uint32_t times_us[BOOT_STAGE_COUNT], uint32_t *flags) {
+    portENTER_CRITICAL(&boot_lock);
+    memcpy(times_us, boot_times, sizeof(boot_times));
+    if (flags != NULL) {
+        *flags = boot_flags;
+    }
+    portEXIT_CRITICAL(&boot_lock);
+}
+
+const char *diag_boot_name(diag_boot_stage_t stage) {
+    return stage < BOOT_STAGE_COUNT ? boot_names[stage] : "?";
+}
+
+void diag_boot_dump(void) {
+    uint32_t times[BOOT_STAGE_COUNT];
+    uint32_t flags;
+    
+    diag_boot_get(times, &flags);
+    ESP_LOGI(TAG, "Boot timeline (ms from %s%s):", (flags & DIAG_BOOT_FLAG_FROM_RESET) ? "power-on" : "app start",
+             (flags & DIAG_BOOT_FLAG_NVS_ERASED) ? ", NVS erased" : "");
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+        if (times[i] == 0) {
+            ESP_LOGI(TAG, "  %-14s        -", boot_names[i]);
+        } else {
+            ESP_LOGI(TAG, "  %-14s %4lu.%03lu", boot_names[i],
+                     (unsigned long)(times[i] / 1000), (unsigned long)(times[i] % 1000));
+        }
+    }
+}
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <string.h>
+#include "diag_capture.h"
+#include "app_hal.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "DIAG_CAPTURE";
+
+#ifdef CONFIG_DIAG_CAPTURE
+
+#define CAPTURE_DEPTH           CONFIG_DIAG_CAPTURE_DEPTH
+#define CAPTURE_DUMP_STACK      3072
+#define CAPTURE_DUMP_PRIO       1
+#define CAPTURE_LINE_BYTES      32      // Dump bytes per log line
+
+_Static_assert(sizeof(diag_capture_header_t) == 16 + DIAG_CAPTURE_MAX_SIGNALS * DIAG_CAPTURE_NAME_LEN,
+               "capture header layout");
+_Static_assert(sizeof(diag_capture_record_t) == 8, "capture record layout");
+
+static diag_capture_record_t capture_buf[CAPTURE_DEPTH];
+static char capture_names[DIAG_CAPTURE_MAX_SIGNALS][DIAG_CAPTURE_NAME_LEN];
+
+// Guarded by capture_lock, which is taken from tasks and the FAULT ISR.
+// Positions count records since the capture was armed.
+static portMUX_TYPE capture_lock = portMUX_INITIALIZER_UNLOCKED;
+static diag_capture_state_t capture_state = DIAG_CAPTURE_IDLE;
+static uint8_t signal_state = 0;
+static diag_capture_trigger_t capture_trigger;
+static bool trigger_matched = false;        // Trigger condition held after the previous record
+static uint32_t capture_wr = 0;
+static uint32_t capture_trig_pos = 0;
+static bool capture_dumping = false;
+
+void diag_capture_set_signal_names(const char *const *names, int count) {
+    memset(capture_names, 0, sizeof(capture_names));
+    for (int i = 0; i < count && i < DIAG_CAPTURE_MAX_SIGNALS; i++) {
+        strncpy(capture_names[i], names[i], DIAG_CAPTURE_NAME_LEN - 1);
+    }
+}
+
+void diag_capture_signal(uint8_t bit, bool level) {
+    diag_capture_signals(bit, level ? bit : 0);
+}
+
+// Timestamps come from app_hal, so the host simulation records its simulated clock
+void diag_capture_signals(uint8_t mask, uint8_t levels) {
+    uint32_t now = (uint32_t)app_hal_time_us();
+    
+    portENTER_CRITICAL_SAFE(&capture_lock);
+    signal_state = (signal_state & ~mask) | (levels & mask);
+    if (capture_state == DIAG_CAPTURE_ARMED || capture_state == DIAG_CAPTURE_TRIGGERED) {
+        diag_capture_record_t *rec = &capture_buf[capture_wr % CAPTURE_DEPTH];
+        rec->timestamp_us = now;
+        rec->state = signal_state;
+        rec->written = mask;
+        rec->reserved = 0;
+        capture_wr++;
+    
+        bool match = (signal_state & capture_trigger.mask) == capture_trigger.value;
+        if (capture_state == DIAG_CAPTURE_ARMED && match && !trigger_matched) {
+            capture_state = DIAG_CAPTURE_TRIGGERED;
+            capture_trig_pos = capture_wr - 1;
+        }
+        trigger_matched = match;
+    
+        // Post-trigger part is whatever the pre-trigger history leaves of the buffer
+        if (capture_state == DIAG_CAPTURE_TRIGGERED &&
+            capture_wr - capture_trig_pos >= (uint32_t)(CAPTURE_DEPTH - capture_trigger.pre_samples)) {
+            capture_state = DIAG_CAPTURE_DONE;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&capture_lock);
+}
+
+// First position still in the buffer; caller holds capture_lock
+static uint32_t capture_start(void) {
+    uint32_t start = capture_wr > CAPTURE_DEPTH ? capture_wr - CAPTURE_DEPTH : 0;
+    bool triggered = capture_state == DIAG_CAPTURE_TRIGGERED ||
+                     (capture_state == DIAG_CAPTURE_DONE && capture_trig_pos != DIAG_CAPTURE_NO_TRIGGER);
+    
+    if (triggered && capture_trig_pos > capture_trigger.pre_samples &&
+        capture_trig_pos - capture_trigger.pre_samples > start) {
+        start = capture_trig_pos - capture_trigger.pre_samples;
+    }
+    return start;
+}
+
+esp_err_t diag_capture_arm(const diag_capture_trigger_t *trigger) {
+    if (trigger == NULL || trigger->pre_samples >= CAPTURE_DEPTH) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    portENTER_CRITICAL(&capture_lock);
+    if (capture_dumping) {
+        portEXIT_CRITICAL(&capture_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    capture_trigger = *trigger;
+    capture_wr = 0;
+    capture_trig_pos = DIAG_CAPTURE_NO_TRIGGER;
+    trigger_matched = (signal_state & trigger->mask) == trigger->value;
+    if (trigger_matched) {
+        // Condition already true (or mask 0): the next record is the trigger
+        capture_state = DIAG_CAPTURE_TRIGGERED;
+        capture_trig_pos = 0;
+    } else {
+        capture_state = DIAG_CAPTURE_ARMED;
+    }
+    portEXIT_CRITICAL(&capture_lock);
+    
+    ESP_LOGI(TAG, "Capture armed: mask=0x%02x value=0x%02x pre=%u",
+             trigger->mask, trigger->value, trigger->pre_samples);
+    return ESP_OK;
+}
+
+void diag_capture_stop(void) {
+    portENTER_CRITICAL(&capture_lock);
+    if (capture_state != DIAG_CAPTURE_IDLE) {
+        capture_state = DIAG_CAPTURE_DONE;
+    }
+    portEXIT_CRITICAL(&capture_lock);
+}
+
+void diag_capture_get_status(diag_capture_status_t *status) {
+    portENTER_CRITICAL(&capture_lock);
+    uint32_t start = capture_start();
+    status->state = capture_state;
+    status->count = capture_wr - start;
+    status->trigger_index = (capture_trig_pos != DIAG_CAPTURE_NO_TRIGGER && capture_trig_pos < capture_wr) ?
+                            capture_trig_pos - start : DIAG_CAPTURE_NO_TRIGGER;
+    portEXIT_CRITICAL(&capture_lock);
+}
+
+// Header of the frozen capture and the buffer position of its first record
+static void capture_header(diag_capture_header_t *hdr, uint32_t *start) {
+    diag_capture_status_t status;
+    
+    diag_capture_get_status(&status);
+    portENTER_CRITICAL(&capture_lock);
+    *start = capture_start();
+    portEXIT_CRITICAL(&capture_lock);
+    
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = DIAG_CAPTURE_MAGIC;
+    hdr->version = DIAG_CAPTURE_VERSION;
+    hdr->record_size = sizeof(diag_capture_record_t);
+    hdr->count = status.count;
+    hdr->trigger_index = status.trigger_index;
+    memcpy(hdr->names, capture_names, sizeof(hdr->names));
+}
+
+// Hex line accumulator for the dump
+typedef struct {
+    char hex[CAPTURE_LINE_BYTES * 2 + 1];
+    size_t len;
+} capture_line_t;
+
+static void capture_emit(capture_line_t *line, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        snprintf(&line->hex[line->len * 2], 3, "%02x", p[i]);
+        if (++line->len == CAPTURE_LINE_BYTES) {
+            ESP_LOGI(TAG, "CAP %s", line->hex);
+            line->len = 0;
+        }
+    }
+}
+
+static void capture_dump_task(void *arg) {
+    diag_capture_header_t hdr;
+    uint32_t start;
+    capture_line_t line = { .len = 0 };
+    
+    // Frozen while capture_dumping is set: nothing records and arm is refused
+    capture_header(&hdr, &start);
+    
+    ESP_LOGI(TAG, "CAP BEGIN %lu records", (unsigned long)hdr.count);
+    capture_emit(&line, &hdr, sizeof(hdr));
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        capture_emit(&line, &capture_buf[(start + i) % CAPTURE_DEPTH], sizeof(diag_capture_record_t));
+    }
+    if (line.len > 0) {
+        ESP_LOGI(TAG, "CAP %s", line.hex);
+    }
+    ESP_LOGI(TAG, "CAP END");
+    
+    portENTER_CRITICAL(&capture_lock);
+    capture_dumping = false;
+    portEXIT_CRITICAL(&capture_lock);
+    vTaskDelete(NULL);
+}
+
+esp_err_t diag_capture_dump(void) {
+    portENTER_CRITICAL(&capture_lock);
+    if (capture_dumping) {
+        portEXIT_CRITICAL(&capture_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    capture_dumping = true;
+    portEXIT_CRITICAL(&capture_lock);
+    
+    diag_capture_stop();
+    if (xTaskCreate(capture_dump_task, "capture_dump", CAPTURE_DUMP_STACK, NULL, CAPTURE_DUMP_PRIO, NULL) != pdPASS) {
+        portENTER_CRITICAL(&capture_lock);
+        capture_dumping = false;
+        portEXIT_CRITICAL(&capture_lock);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+size_t diag_capture_copy(uint8_t *out, size_t len) {
+    diag_capture_header_t hdr;
+    uint32_t start;
+    
+    diag_capture_stop();
+    capture_header(&hdr, &start);
+    size_t size = sizeof(hdr) + hdr.count * sizeof(diag_capture_record_t);
+    if (out == NULL || len < size) {
+        return size;
+    }
+    
+    memcpy(out, &hdr, sizeof(hdr));
+    diag_capture_record_t *rec = (diag_capture_record_t *)(out + sizeof(hdr));
+    for (uint32_t i = 0; i < hdr.count; i++) {
+        rec[i] = capture_buf[(start + i) % CAPTURE_DEPTH];
+    }
+    return size;
+}
+
+#else // Capture compiled out
+
+void diag_capture_set_signal_names(const char *const *names, int count) {
+}
+
+void diag_capture_signal(uint8_t bit, bool level) {
+}
+
+void diag_capture_signals(uint8_t mask, uint8_t levels) {
+}
+
+esp_err_t diag_capture_arm(const diag_capture_trigger_t *trigger) {
+    ESP_LOGW(TAG, "Capture disabled (CONFIG_DIAG_CAPTURE)");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void diag_capture_stop(void) {
+}
+
+void diag_capture_get_status(diag_capture_status_t *status) {
+    memset(status, 0, sizeof(*status));
+    status->trigger_index = DIAG_CAPTURE_NO_TRIGGER;
+}
+
+esp_err_t diag_capture_dump(void) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+size_t diag_capture_copy(uint8_t *out, size_t len) {
+    return 0;
+}
+
+#endif
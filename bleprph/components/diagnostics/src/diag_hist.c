@@ -0,0 +1,53 @@
+#include <string.h>
+#include "diag_hist.h"
+
+static inline uint32_t hist_bucket(uint32_t value) {
+    uint32_t bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    return bucket < DIAG_HIST_BUCKETS ? bucket : DIAG_HIST_BUCKETS - 1;
+}
+
+void diag_hist_reset(diag_hist_t *hist) {
+    memset(hist, 0, sizeof(*hist));
+    hist->min = UINT32_MAX;
+}
+
+void diag_hist_add(diag_hist_t *hist, uint32_t value) {
+    hist->buckets[hist_bucket(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if (value < hist->min) {
+        hist->min = value;
+    }
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+uint32_t diag_hist_percentile(const diag_hist_t *hist, uint32_t permille) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    
+    // Rank of the wanted value, rounded up so p100 is the last value
+    uint32_t rank = (uint32_t)(((uint64_t)hist->count * permille + 999) / 1000);
+    if (rank == 0) {
+        rank = 1;
+    }
+    
+    uint32_t seen = 0;
+    for (uint32_t k = 0; k < DIAG_HIST_BUCKETS; k++) {
+        seen += hist->buckets[k];
+        if (seen >= rank) {
+            if (k == DIAG_HIST_BUCKETS - 1) {
+                break;      // Open-ended bucket
+            }
+            uint32_t upper = k == 0 ? 0 : (1UL << k) - 1;
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+uint32_t diag_hist_mean(const diag_hist_t *hist) {
+    return hist->count > 0 ? (uint32_t)(hist->sum / hist->count) : 0;
+}
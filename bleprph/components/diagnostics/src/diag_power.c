@@ -0,0 +1,124 @@
+#include <string.h>
+#include "diag_power.h"
+#include "app_hal.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+static const char *TAG = "DIAG_POWER";
+
+// Current model; without frequency scaling the chip never leaves the maximum frequency
+#define POWER_MAX_FREQ_UA       CONFIG_DIAG_POWER_MAX_FREQ_UA
+#ifdef CONFIG_PM_ENABLE
+#define POWER_MIN_FREQ_UA       CONFIG_DIAG_POWER_MIN_FREQ_UA
+#else
+#define POWER_MIN_FREQ_UA       CONFIG_DIAG_POWER_MAX_FREQ_UA
+#endif
+#define POWER_SLEEP_UA          CONFIG_DIAG_POWER_LIGHT_SLEEP_UA
+
+// Updated from the idle task on sleep exit and from lock holders, guarded by power_lock
+static int64_t power_start_us = 0;
+static uint64_t power_sleep_us = 0;
+static uint32_t power_sleep_count = 0;
+static uint64_t power_perf_us = 0;          // Closed perf periods
+static int64_t power_perf_since_us = 0;     // Start of the open perf period
+static int power_perf_depth = 0;
+static uint8_t power_flags = 0;
+static portMUX_TYPE power_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#ifdef CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+// Runs in the idle task right after waking, inside the PM critical section
+static esp_err_t IRAM_ATTR power_sleep_exit_cb(int64_t sleep_time_us, void *arg) {
+    portENTER_CRITICAL_SAFE(&power_lock);
+    power_sleep_us += sleep_time_us;
+    power_sleep_count++;
+    portEXIT_CRITICAL_SAFE(&power_lock);
+    return ESP_OK;
+}
+#endif
+
+esp_err_t diag_power_init(void) {
+#ifdef CONFIG_PM_ENABLE
+    power_flags |= DIAG_POWER_FLAG_PM;
+#endif
+#ifdef CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+    esp_pm_sleep_cbs_register_config_t cbs = {
+        .exit_cb = power_sleep_exit_cb,
+    };
+    esp_err_t err = esp_pm_light_sleep_register_cbs(&cbs);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register light sleep callback: %s", esp_err_to_name(err));
+        return err;
+    }
+    power_flags |= DIAG_POWER_FLAG_SLEEP_CNT;
+#endif
+    
+    diag_power_reset();
+    return ESP_OK;
+}
+
+void diag_power_perf_begin(void) {
+    int64_t now = app_hal_time_us();
+    
+    portENTER_CRITICAL(&power_lock);
+    if (power_perf_depth++ == 0) {
+        power_perf_since_us = now;
+    }
+    portEXIT_CRITICAL(&power_lock);
+}
+
+void diag_power_perf_end(void) {
+    int64_t now = app_hal_time_us();
+    
+    portENTER_CRITICAL(&power_lock);
+    if (power_perf_depth > 0 && --power_perf_depth == 0) {
+        power_perf_us += now - power_perf_since_us;
+    }
+    portEXIT_CRITICAL(&power_lock);
+}
+
+void diag_power_get_stats(diag_power_stats_t *stats) {
+    int64_t now = app_hal_time_us();
+    
+    memset(stats, 0, sizeof(*stats));
+    portENTER_CRITICAL(&power_lock);
+    stats->window_us = now - power_start_us;
+    stats->sleep_us = power_sleep_us;
+    stats->sleep_count = power_sleep_count;
+    stats->perf_us = power_perf_us + (power_perf_depth > 0 ? now - power_perf_since_us : 0);
+    stats->flags = power_flags;
+    portEXIT_CRITICAL(&power_lock);
+    
+    // A window straddling the reset can count a little more than its length
+    uint64_t window = stats->window_us;
+    uint64_t sleep = stats->sleep_us < window ? stats->sleep_us : window;
+    uint64_t perf = stats->perf_us < window - sleep ? stats->perf_us : window - sleep;
+    uint64_t low = window - sleep - perf;
+    
+    stats->baseline_ua = POWER_MAX_FREQ_UA;
+    if (window == 0) {
+        stats->avg_ua = POWER_MAX_FREQ_UA;
+        return;
+    }
+    stats->avg_ua = (uint32_t)((perf * POWER_MAX_FREQ_UA + low * POWER_MIN_FREQ_UA + sleep * POWER_SLEEP_UA) / window);
+    stats->saving_permille = stats->avg_ua < stats->baseline_ua ?
+                             (uint16_t)(1000 - (uint64_t)stats->avg_ua * 1000 / stats->baseline_ua) : 0;
+}
+
+void diag_power_reset(void) {
+    int64_t now = app_hal_time_us();
+    
+    portENTER_CRITICAL(&power_lock);
+    power_start_us = now;
+    power_sleep_us = 0;
+    power_sleep_count = 0;
+    power_perf_us = 0;
+    if (power_perf_depth > 0) {
+        power_perf_since_us = now;
+    }
+    portEXIT_CRITICAL(&power_lock);
+}
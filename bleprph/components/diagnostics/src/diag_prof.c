@@ -0,0 +1,88 @@
+#include <string.h>
+#include "diag_prof.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "DIAG_PROF";
+
+#define PROF_NAME_ENTRY(id, enabled, name)      [id] = name,
+#define PROF_MASK_ENTRY(id, enabled, name)      | ((uint32_t)(enabled) << (id))
+
+static const char *const prof_names[PROF_REGION_COUNT] = {
+    DIAG_PROF_REGIONS(PROF_NAME_ENTRY)
+};
+
+static const uint32_t prof_enabled_mask = 0 DIAG_PROF_REGIONS(PROF_MASK_ENTRY);
+
+// Recorded from the motor and host tasks, read by whoever dumps the table
+static diag_prof_stats_t prof_stats[PROF_REGION_COUNT];
+static portMUX_TYPE prof_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void diag_prof_record(diag_prof_id_t region, uint32_t cycles) {
+    diag_prof_stats_t *s = &prof_stats[region];
+    
+    portENTER_CRITICAL_SAFE(&prof_lock);
+    if (s->count == 0 || cycles < s->min_cycles) {
+        s->min_cycles = cycles;
+    }
+    if (cycles > s->max_cycles) {
+        s->max_cycles = cycles;
+    }
+    s->total_cycles += cycles;
+    s->count++;
+    portEXIT_CRITICAL_SAFE(&prof_lock);
+}
+
+void diag_prof_get_stats(diag_prof_id_t region, diag_prof_stats_t *stats) {
+    if (region >= PROF_REGION_COUNT) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    
+    portENTER_CRITICAL(&prof_lock);
+    *stats = prof_stats[region];
+    portEXIT_CRITICAL(&prof_lock);
+}
+
+void diag_prof_reset(void) {
+    portENTER_CRITICAL(&prof_lock);
+    memset(prof_stats, 0, sizeof(prof_stats));
+    portEXIT_CRITICAL(&prof_lock);
+}
+
+const char *diag_prof_name(diag_prof_id_t region) {
+    return region < PROF_REGION_COUNT ? prof_names[region] : "?";
+}
+
+uint32_t diag_prof_enabled_mask(void) {
+    return prof_enabled_mask;
+}
+
+uint32_t diag_prof_cycles_per_us(void) {
+    return esp_rom_get_cpu_ticks_per_us();
+}
+
+void diag_prof_dump(void) {
+    uint32_t mhz = diag_prof_cycles_per_us();
+    
+    if (prof_enabled_mask == 0) {
+        ESP_LOGI(TAG, "No profiling regions compiled in (CONFIG_DIAG_PROF)");
+        return;
+    }
+    
+    ESP_LOGI(TAG, "%-14s %10s %10s %10s %10s %10s (cycles, CPU %lu MHz)",
+             "region", "count", "min", "avg", "max", "max_us", (unsigned long)mhz);
+    for (int i = 0; i < PROF_REGION_COUNT; i++) {
+        diag_prof_stats_t s;
+    
+        if (!(prof_enabled_mask & (1UL << i))) {
+            continue;
+        }
+        diag_prof_get_stats((diag_prof_id_t)i, &s);
+        uint32_t avg = s.count > 0 ? (uint32_t)(s.total_cycles / s.count) : 0;
+        ESP_LOGI(TAG, "%-14s %10lu %10lu %10lu %10lu %10lu", prof_names[i],
+                 (unsigned long)s.count, (unsigned long)s.min_cycles, (unsigned long)avg,
+                 (unsigned long)s.max_cycles, (unsigned long)(mhz > 0 ? s.max_cycles / mhz : 0));
+    }
+}
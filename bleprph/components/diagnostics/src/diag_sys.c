@@ -0,0 +1,140 @@
+#include <string.h>
+#include "diag_sys.h"
+#include "app_alloc.h"
+#include "timer_wheel.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "DIAG_SYS";
+
+#define SYS_STATUS_MAX          32      // uxTaskGetSystemState needs room for every task
+
+// Published snapshot, guarded by sys_mutex
+static diag_sys_snapshot_t sys_snapshot;
+static SemaphoreHandle_t sys_mutex = NULL;
+
+APP_MUTEX_MEM(sys_mutex_mem);
+static timer_wheel_timer_t sys_timer;
+
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
+// Only the refresh timer touches these
+static TaskStatus_t sys_status[SYS_STATUS_MAX];
+static struct {
+    UBaseType_t number;
+    uint32_t run_time;
+} sys_prev[SYS_STATUS_MAX];
+static UBaseType_t sys_prev_count = 0;
+static uint32_t sys_prev_total = 0;
+
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+// Run time of a task at the previous snapshot, 0 if it is new
+static uint32_t sys_prev_run_time(UBaseType_t number) {
+    for (UBaseType_t i = 0; i < sys_prev_count; i++) {
+        if (sys_prev[i].number == number) {
+            return sys_prev[i].run_time;
+        }
+    }
+    return 0;
+}
+#endif
+
+static void sys_collect_tasks(diag_sys_snapshot_t *snap) {
+    uint32_t total = 0;
+    UBaseType_t n = uxTaskGetSystemState(sys_status, SYS_STATUS_MAX, &total);
+    
+    snap->tasks_total = (uint8_t)uxTaskGetNumberOfTasks();
+    if (n == 0) {
+        ESP_LOGW(TAG, "More than %d tasks, task table skipped", SYS_STATUS_MAX);
+        return;
+    }
+    
+    // Counters are 32-bit esp_timer microseconds; deltas survive the wrap
+    uint32_t window = total - sys_prev_total;
+    for (UBaseType_t i = 0; i < n && snap->task_count < DIAG_SYS_MAX_TASKS; i++) {
+        const TaskStatus_t *ts = &sys_status[i];
+        diag_sys_task_t *t = &snap->tasks[snap->task_count++];
+    
+        strncpy(t->name, ts->pcTaskName, DIAG_SYS_NAME_LEN);
+        t->priority = (uint8_t)ts->uxCurrentPriority;
+        t->core = ts->xCoreID == tskNO_AFFINITY ? DIAG_SYS_CORE_ANY : (uint8_t)ts->xCoreID;
+        t->stack_hwm = ts->usStackHighWaterMark;
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        uint32_t busy = ts->ulRunTimeCounter - sys_prev_run_time(ts->xTaskNumber);
+        t->cpu_permille = window > 0 ? (uint16_t)((uint64_t)busy * 1000 / ((uint64_t)window * portNUM_PROCESSORS)) : 0;
+#else
+        t->cpu_permille = DIAG_SYS_CPU_UNKNOWN;
+#endif
+    }
+    snap->period_us = window;
+    
+    for (UBaseType_t i = 0; i < n; i++) {
+        sys_prev[i].number = sys_status[i].xTaskNumber;
+        sys_prev[i].run_time = sys_status[i].ulRunTimeCounter;
+    }
+    sys_prev_count = n;
+    sys_prev_total = total;
+}
+#endif
+
+static void sys_refresh(void) {
+    static diag_sys_snapshot_t snap;    // Built off to the side, published under the mutex
+    
+    memset(&snap, 0, sizeof(snap));
+    snap.timestamp_us = (uint32_t)esp_timer_get_time();
+    snap.heap_free = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+    snap.heap_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    snap.heap_largest = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
+    sys_collect_tasks(&snap);
+#endif
+    
+    xSemaphoreTake(sys_mutex, portMAX_DELAY);
+    sys_snapshot = snap;
+    xSemaphoreGive(sys_mutex);
+}
+
+// Runs in the timer wheel task, which is sized for the task table walk
+static void sys_timer_cb(void *arg) {
+    sys_refresh();
+}
+
+esp_err_t diag_sys_init(void) {
+    if (sys_mutex != NULL) {
+        return ESP_OK;
+    }
+    
+    sys_mutex = app_mutex_create(&sys_mutex_mem);
+    if (sys_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create snapshot mutex");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    sys_refresh();
+    timer_wheel_timer_init(&sys_timer, "diag_sys", sys_timer_cb, NULL);
+    esp_err_t ret = timer_wheel_start(&sys_timer, CONFIG_DIAG_SYS_PERIOD_MS, CONFIG_DIAG_SYS_PERIOD_MS);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start snapshot timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    
+#ifndef CONFIG_FREERTOS_USE_TRACE_FACILITY
+    ESP_LOGW(TAG, "CONFIG_FREERTOS_USE_TRACE_FACILITY is off, snapshots have no task table");
+#endif
+    ESP_LOGI(TAG, "System snapshots every %d ms", CONFIG_DIAG_SYS_PERIOD_MS);
+    return ESP_OK;
+}
+
+void diag_sys_get_snapshot(diag_sys_snapshot_t *snap) {
+    if (sys_mutex == NULL) {
+        memset(snap, 0, sizeof(*snap));
+        return;
+    }
+    
+    xSemaphoreTake(sys_mutex, portMAX_DELAY);
+    *snap = sys_snapshot;
+    xSemaphoreGive(sys_mutex);
+}
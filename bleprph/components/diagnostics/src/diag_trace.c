@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <string.h>
+#include "diag_trace.h"
+#include "app_alloc.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "DIAG_TRACE";
+
+#if CONFIG_DIAG_TRACE_LEVEL > DIAG_TRACE_LEVEL_NONE
+
+#define TRACE_RING_SIZE         CONFIG_DIAG_TRACE_RING_SIZE
+#define TRACE_RING_MASK         (TRACE_RING_SIZE - 1)
+#define TRACE_DRAIN_BATCH       16
+#define TRACE_DRAIN_STACK       3072
+#define TRACE_DRAIN_PRIO        1       // Just above idle; formatting is what we moved off the hot path
+#define TRACE_LINE_LEN          96
+
+_Static_assert((TRACE_RING_SIZE & TRACE_RING_MASK) == 0, "CONFIG_DIAG_TRACE_RING_SIZE must be a power of two");
+
+#define TRACE_FMT_ENTRY(id, level, fmt)  [id] = fmt,
+
+static const char *const trace_formats[TRACE_EVT_COUNT] = {
+    DIAG_TRACE_EVENTS(TRACE_FMT_ENTRY)
+};
+
+// Writers claim a slot with one atomic add; readers follow with trace_tail
+static diag_trace_record_t trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_head = 0;
+static uint32_t trace_tail = 0;
+static uint32_t trace_dropped = 0;
+static SemaphoreHandle_t trace_read_mutex = NULL;
+
+APP_MUTEX_MEM(trace_read_mutex_mem);
+#ifdef CONFIG_DIAG_TRACE_DRAIN_TASK
+APP_TASK_MEM(trace_drain_task_mem, TRACE_DRAIN_STACK);
+#endif
+
+void diag_trace_record(diag_trace_id_t id, uint32_t a0, uint32_t a1, uint32_t a2) {
+    uint32_t idx = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    diag_trace_record_t *rec = &trace_ring[idx & TRACE_RING_MASK];
+    
+    // Readers skip the slot until seq says it holds this index
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->timestamp_us = (uint32_t)esp_timer_get_time();
+    rec->id = (uint16_t)id;
+    rec->core = (uint8_t)esp_cpu_get_core_id();
+    rec->args[0] = a0;
+    rec->args[1] = a1;
+    rec->args[2] = a2;
+    __atomic_store_n(&rec->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+size_t diag_trace_read(diag_trace_record_t *out, size_t max) {
+    size_t n = 0;
+    
+    if (trace_read_mutex == NULL || out == NULL) {
+        return 0;
+    }
+    
+    xSemaphoreTake(trace_read_mutex, portMAX_DELAY);
+    
+    uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    if (head - trace_tail > TRACE_RING_SIZE) {
+        trace_dropped += head - trace_tail - TRACE_RING_SIZE;
+        trace_tail = head - TRACE_RING_SIZE;
+    }
+    
+    while (n < max && trace_tail != head) {
+        const diag_trace_record_t *rec = &trace_ring[trace_tail & TRACE_RING_MASK];
+        uint32_t expect = trace_tail + 1;
+        uint32_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+    
+        if ((int32_t)(seq - expect) < 0) {
+            break;          // Writer still filling this slot; pick it up next time
+        }
+        if (seq == expect) {
+            out[n] = *rec;
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == expect) {
+                n++;
+                trace_tail++;
+                continue;
+            }
+        }
+    
+        // Overwritten by a writer a full lap ahead
+        trace_dropped++;
+        trace_tail++;
+    }
+    
+    xSemaphoreGive(trace_read_mutex);
+    return n;
+}
+
+int diag_trace_format(const diag_trace_record_t *rec, char *buf, size_t len) {
+    if (rec->id >= TRACE_EVT_COUNT) {
+        return snprintf(buf, len, "event %u (%lu, %lu, %lu)", rec->id, (unsigned long)rec->args[0],
+                        (unsigned long)rec->args[1], (unsigned long)rec->args[2]);
+    }
+    return snprintf(buf, len, trace_formats[rec->id], (unsigned long)rec->args[0],
+                    (unsigned long)rec->args[1], (unsigned long)rec->args[2]);
+}
+
+void diag_trace_get_stats(diag_trace_stats_t *stats) {
+    uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_RELAXED);
+    uint32_t pending = head - trace_tail;
+    
+    stats->recorded = head;
+    stats->pending = pending > TRACE_RING_SIZE ? TRACE_RING_SIZE : pending;
+    stats->dropped = trace_dropped + (pending - stats->pending);
+}
+
+uint32_t diag_trace_benchmark(uint32_t iterations) {
+    char line[TRACE_LINE_LEN];
+    
+    if (iterations == 0) {
+        return 0;
+    }
+    
+    uint32_t t0 = esp_cpu_get_cycle_count();
+    for (uint32_t i = 0; i < iterations; i++) {
+        diag_trace_record(TRACE_EVT_BENCHMARK, i, 0, 0);
+    }
+    uint32_t trace_cycles = (esp_cpu_get_cycle_count() - t0) / iterations;
+    
+    // What every access used to pay before the UART: formatting the line
+    t0 = esp_cpu_get_cycle_count();
+    for (uint32_t i = 0; i < iterations; i++) {
+        snprintf(line, sizeof(line), "%s read; conn_handle=%d", "Motor position", (int)i);
+    }
+    uint32_t format_cycles = (esp_cpu_get_cycle_count() - t0) / iterations;
+    
+    // Discard the benchmark events
+    if (trace_read_mutex != NULL) {
+        xSemaphoreTake(trace_read_mutex, portMAX_DELAY);
+        trace_tail = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+        xSemaphoreGive(trace_read_mutex);
+    }
+    
+    ESP_LOGI(TAG, "diag_trace_record: %lu cycles/event, snprintf of a log line: %lu cycles (%lu iterations)",
+             (unsigned long)trace_cycles, (unsigned long)format_cycles, (unsigned long)iterations);
+    return trace_cycles;
+}
+
+#ifdef CONFIG_DIAG_TRACE_DRAIN_TASK
+// Formats events long after they happened, at a priority that never delays stepping or BLE
+static void trace_drain_task(void *arg) {
+    diag_trace_record_t recs[TRACE_DRAIN_BATCH];
+    char line[TRACE_LINE_LEN];
+    uint32_t reported_drops = 0;
+    
+    for (;;) {
+        size_t n;
+        while ((n = diag_trace_read(recs, TRACE_DRAIN_BATCH)) > 0) {
+            for (size_t i = 0; i < n; i++) {
+                diag_trace_format(&recs[i], line, sizeof(line));
+                ESP_LOGI(TAG, "[%10lu us c%u] %s", (unsigned long)recs[i].timestamp_us, recs[i].core, line);
+            }
+        }
+    
+        if (trace_dropped != reported_drops) {
+            ESP_LOGW(TAG, "%lu events dropped (ring full)", (unsigned long)(trace_dropped - reported_drops));
+            reported_drops = trace_dropped;
+        }
+    
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_DIAG_TRACE_DRAIN_PERIOD_MS));
+    }
+}
+#endif
+
+esp_err_t diag_trace_init(void) {
+    if (trace_read_mutex != NULL) {
+        return ESP_OK;
+    }
+    
+    trace_read_mutex = app_mutex_create(&trace_read_mutex_mem);
+    if (trace_read_mutex == NULL) {
+        ESP_LOGE(TAG, "Failed to create trace mutex");
+        return ESP_ERR_NO_MEM;
+    }
+    
+#ifdef CONFIG_DIAG_TRACE_BENCHMARK
+    diag_trace_benchmark(1000);
+#endif
+    
+#ifdef CONFIG_DIAG_TRACE_DRAIN_TASK
+    if (app_task_create(&trace_drain_task_mem, trace_drain_task, "trace_drain", TRACE_DRAIN_STACK, NULL,
+                        TRACE_DRAIN_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create trace drain task");
+        return ESP_FAIL;
+    }
+#endif
+    
+    ESP_LOGI(TAG, "Trace ring initialized: %d events, level %d", TRACE_RING_SIZE, CONFIG_DIAG_TRACE_LEVEL);
+    return ESP_OK;
+}
+
+#else // Tracing compiled out
+
+esp_err_t diag_trace_init(void) {
+    ESP_LOGI(TAG, "Tracing disabled (CONFIG_DIAG_TRACE_LEVEL=0)");
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void diag_trace_record(diag_trace_id_t id, uint32_t a0, uint32_t a1, uint32_t a2) {
+}
+
+size_t diag_trace_read(diag_trace_record_t *out, size_t max) {
+    return 0;
+}
+
+int diag_trace_format(const diag_trace_record_t *rec, char *buf, size_t len) {
+    return snprintf(buf, len, "event %u", rec->id);
+}
+
+void diag_trace_get_stats(diag_trace_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+uint32_t diag_trace_benchmark(uint32_t iterations) {
+    return 0;
+}
+
+#endif
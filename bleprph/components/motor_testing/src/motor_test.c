@@ -1,10 +1,71 @@
+#include <stdlib.h>
 #include "motor_test.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 
 static const char *TAG = "MOTOR_TEST";
 
+// Upper bound for any single test move
+#define TEST_MOVE_TIMEOUT_MS    30000
+
+static QueueHandle_t test_event_queue = NULL;
+static uint16_t test_move_id = 0;
+
+// Forward motion events from the motor task to the waiting test
+static void test_event_cb(const motor_event_t *event, void *arg) {
+    xQueueSend((QueueHandle_t)arg, event, 0);
+}
+
+// Queue a tagged move and block until the motor reports how it ended
+static esp_err_t test_move_and_wait(stepper_motor_t *motor, motor_command_t command,
+                                    int16_t parameter, motor_event_t *result) {
+    if (test_event_queue == NULL) {
+        test_event_queue = xQueueCreate(4, sizeof(motor_event_t));
+        if (test_event_queue == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        
+        esp_err_t ret = stepper_motor_register_event_cb(test_event_cb, test_event_queue);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+    }
+    
+    stepper_motor_cmd_t cmd = {
+        .command = command,
+        .parameter = parameter,
+        .move_id = ++test_move_id
+    };
+    if (cmd.move_id == 0) {
+        cmd.move_id = ++test_move_id;   // 0 means untagged
+    }
+    
+    esp_err_t ret = stepper_motor_submit_batch(motor, &cmd, 1);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(TEST_MOVE_TIMEOUT_MS);
+    while (1) {
+        TickType_t now = xTaskGetTickCount();
+        if ((int32_t)(deadline - now) <= 0 ||
+            xQueueReceive(test_event_queue, result, deadline - now) != pdTRUE) {
+            ESP_LOGE(TAG, "Move %d did not finish in time", cmd.move_id);
+            return ESP_ERR_TIMEOUT;
+        }
+        
+        // Skip events of moves superseded earlier
+        if (result->move_id == cmd.move_id) {
+            ESP_LOGI(TAG, "Move %d finished: result=%d position=%d elapsed=%lu ms",
+                    result->move_id, result->type, result->position,
+                    (unsigned long)result->elapsed_ms);
+            return result->type == MOTOR_EVENT_MOVE_FAULT ? ESP_ERR_INVALID_STATE : ESP_OK;
+        }
+    }
+}
+
 esp_err_t motor_test_hardware(stepper_motor_t *motor) {
     ESP_LOGI(TAG, "Starting hardware test...");
     
@@ -68,17 +129,15 @@ esp_err_t motor_test_position_accuracy(stepper_motor_t *motor) {
         return ESP_ERR_INVALID_ARG;
     }
     
-    // Home motor first
+    // Home motor first and wait for it to complete
     ESP_LOGI(TAG, "Homing motor...");
-    esp_err_t ret = stepper_motor_home(motor);
+    motor_event_t result;
+    esp_err_t ret = test_move_and_wait(motor, MOTOR_CMD_HOME, 0, &result);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to home motor");
         return ret;
     }
     
-    // Wait for homing to complete
-    vTaskDelay(pdMS_TO_TICKS(5000));
-    
     // Test various positions
     int16_t test_positions[] = {100, 500, 1000, 250, 750, 0};
     size_t num_positions = sizeof(test_positions) / sizeof(test_positions[0]);
@@ -86,17 +145,14 @@ esp_err_t motor_test_position_accuracy(stepper_motor_t *motor) {
     for (size_t i = 0; i < num_positions; i++) {
         ESP_LOGI(TAG, "Moving to position: %d", test_positions[i]);
         
-        ret = stepper_motor_move_to_position(motor, test_positions[i]);
+        ret = test_move_and_wait(motor, MOTOR_CMD_MOVE_ABSOLUTE, test_positions[i], &result);
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "Failed to move to position %d", test_positions[i]);
             return ret;
         }
         
-        // Wait for movement to complete
-        vTaskDelay(pdMS_TO_TICKS(3000));
-        
-        // Check current position
-        int16_t current_pos = stepper_motor_get_position(motor);
+        // Check final position reported by the move event
+        int16_t current_pos = result.position;
         ESP_LOGI(TAG, "Target: %d, Actual: %d", test_positions[i], current_pos);
         
         if (abs(current_pos - test_positions[i]) > 5) {  // Allow 5 step tolerance
@@ -130,22 +186,19 @@ esp_err_t motor_test_speed_variations(stepper_motor_t *motor) {
             return ret;
         }
         
-        // Move relative 200 steps forward and back
-        ret = stepper_motor_move_relative(motor, 200);
+        // Move relative 200 steps forward and back, waiting for each to finish
+        motor_event_t result;
+        ret = test_move_and_wait(motor, MOTOR_CMD_MOVE_RELATIVE, 200, &result);
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "Failed to move relative");
             return ret;
         }
         
-        vTaskDelay(pdMS_TO_TICKS(3000)); // Wait for movement
-        
-        ret = stepper_motor_move_relative(motor, -200);
+        ret = test_move_and_wait(motor, MOTOR_CMD_MOVE_RELATIVE, -200, &result);
         if (ret != ESP_OK) {
             ESP_LOGE(TAG, "Failed to move relative back");
             return ret;
         }
-        
-        vTaskDelay(pdMS_TO_TICKS(3000)); // Wait for movement
     }
     
     // Reset to default speed
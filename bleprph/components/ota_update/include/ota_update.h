@@ -0,0 +1,136 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Image data is staged in RAM blocks of one flash sector, one filling while the other is written */
+#define OTA_UPDATE_BLOCK_SIZE       4096
+#define OTA_UPDATE_BUF_COUNT        2
+
+/** Bytes a sender may have outstanding beyond the written offset */
+#define OTA_UPDATE_WINDOW           (OTA_UPDATE_BLOCK_SIZE * OTA_UPDATE_BUF_COUNT)
+
+#define OTA_UPDATE_SHA256_LEN       32
+
+/** Delay between ota_update_apply() and the restart, so the caller can still respond */
+#define OTA_UPDATE_REBOOT_DELAY_MS  500
+
+typedef enum {
+    OTA_STATE_IDLE = 0,
+    OTA_STATE_RECEIVING,        // Session open, image data accepted
+    OTA_STATE_VERIFYING,        // All data received, hash and image check pending
+    OTA_STATE_READY,            // Verified and set as boot partition, waiting for ota_update_apply()
+    OTA_STATE_ERROR             // Session failed, see error; begin a new one
+} ota_state_t;
+
+typedef struct {
+    ota_state_t state;
+    esp_err_t error;            // Cause of OTA_STATE_ERROR, ESP_OK otherwise
+    uint32_t image_size;
+    uint32_t received;          // Next offset the sender must send (resume point)
+    uint32_t written;           // Bytes written to flash
+    uint32_t elapsed_ms;        // Since the session began (frozen once verified)
+    uint32_t flash_ms;          // Time spent in flash writes
+    uint32_t throughput_bps;    // written * 1000 / elapsed_ms
+} ota_update_status_t;
+
+/**
+ * @brief Progress callback, called from the OTA writer task after every
+ *        flash block and on every state change. Must not block.
+ */
+typedef void (*ota_update_progress_cb_t)(const ota_update_status_t *status, void *arg);
+
+/**
+ * @brief Start the OTA writer task (call before the transport starts)
+ * @return ESP_OK on success, error code otherwise
+ */
+esp_err_t ota_update_init(void);
+
+/**
+ * @brief Confirm the running image once the device is reachable again
+ *
+ * If the running image was just installed by an update and is pending
+ * verification, it is marked valid so the bootloader does not roll back.
+ * Call after the update transport (BLE) is up, so an image that cannot be
+ * updated again is rolled back on the next reset.
+ */
+void ota_update_mark_valid(void);
+
+/**
+ * @brief Open an update session for an image
+ *
+ * If a session for the same size and hash is already receiving, it is
+ * resumed and status.received tells the sender where to continue.
+ *
+ * @param image_size Image size in bytes
+ * @param sha256 Expected SHA-256 of the whole image
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE if the image does not fit the partition,
+ *         ESP_ERR_INVALID_STATE if a different session is in progress,
+ *         ESP_ERR_NO_MEM if the staging blocks cannot be allocated, error code otherwise
+ */
+esp_err_t ota_update_begin(uint32_t image_size, const uint8_t sha256[OTA_UPDATE_SHA256_LEN]);
+
+/**
+ * @brief Append image data; never blocks on flash
+ * @param offset Image offset of data, must equal status.received
+ * @param data Image data
+ * @param len Length of data, at most OTA_UPDATE_BLOCK_SIZE
+ * @return ESP_OK, ESP_ERR_INVALID_STATE for a wrong offset or no session,
+ *         ESP_ERR_NO_MEM if both blocks are still being written (resend from status.received),
+ *         ESP_ERR_INVALID_SIZE if data runs past the image size
+ */
+esp_err_t ota_update_write(uint32_t offset, const uint8_t *data, size_t len);
+
+/**
+ * @brief Verify the complete image and select it for the next boot
+ *
+ * Runs in the writer task; the outcome is reported through the progress
+ * callback (OTA_STATE_READY or OTA_STATE_ERROR).
+ *
+ * @return ESP_OK if verification was queued, ESP_ERR_INVALID_STATE if data is missing
+ */
+esp_err_t ota_update_finish(void);
+
+/**
+ * @brief Discard the current session
+ * @return ESP_OK on success
+ */
+esp_err_t ota_update_abort(void);
+
+/**
+ * @brief Restart into the verified image after OTA_UPDATE_REBOOT_DELAY_MS
+ * @return ESP_OK if the restart is scheduled, ESP_ERR_INVALID_STATE if no image is ready
+ */
+esp_err_t ota_update_apply(void);
+
+/**
+ * @brief Check whether an update session is open (motion must stay inhibited)
+ * @return true from ota_update_begin() until the session is aborted or fails
+ */
+bool ota_update_is_active(void);
+
+/**
+ * @brief Get the session status
+ * @param status Output
+ */
+void ota_update_get_status(ota_update_status_t *status);
+
+/**
+ * @brief Set the progress callback (single slot)
+ * @param cb Callback, NULL to clear
+ * @param arg User argument
+ */
+void ota_update_set_progress_cb(ota_update_progress_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTA_UPDATE_H
@@ -0,0 +1,467 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ota_update.h"
+#include "app_alloc.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+static const char *TAG = "OTA_UPDATE";
+
+#define OTA_TASK_STACK      4096
+#define OTA_TASK_PRIO       3       // Below BLE and the motor task; flash writes are background work
+#define OTA_QUEUE_LENGTH    (OTA_UPDATE_BUF_COUNT + 2)
+
+typedef enum {
+    OTA_MSG_BLOCK,
+    OTA_MSG_FINISH,
+    OTA_MSG_ABORT,
+    OTA_MSG_REBOOT
+} ota_msg_type_t;
+
+typedef struct {
+    ota_msg_type_t type;
+    uint8_t buf;
+    uint16_t len;
+} ota_msg_t;
+
+// Staging blocks; the producer fills ota_fill_buf, the writer task owns busy ones.
+// Without CONFIG_OTA_UPDATE_STATIC_BUFFERS they exist only while a session needs them.
+#ifdef CONFIG_OTA_UPDATE_STATIC_BUFFERS
+static uint8_t ota_buf_mem[OTA_UPDATE_BUF_COUNT][OTA_UPDATE_BLOCK_SIZE];
+static uint8_t (*ota_bufs)[OTA_UPDATE_BLOCK_SIZE] = ota_buf_mem;
+#else
+static uint8_t (*ota_bufs)[OTA_UPDATE_BLOCK_SIZE] = NULL;
+#endif
+static bool ota_buf_busy[OTA_UPDATE_BUF_COUNT];
+static uint8_t ota_fill_buf = 0;
+static uint16_t ota_fill_len = 0;
+
+// Session state, guarded by ota_lock
+static ota_update_status_t ota_status = { .state = OTA_STATE_IDLE };
+static uint8_t ota_sha256[OTA_UPDATE_SHA256_LEN];
+static int64_t ota_start_us = 0;
+static int64_t ota_flash_us = 0;
+static bool ota_abort_pending = false;
+static portMUX_TYPE ota_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Writer task only
+static const esp_partition_t *ota_partition = NULL;
+static esp_ota_handle_t ota_handle = 0;
+static mbedtls_sha256_context ota_sha_ctx;
+
+static QueueHandle_t ota_queue = NULL;
+
+APP_TASK_MEM(ota_task_mem, OTA_TASK_STACK);
+APP_QUEUE_MEM(ota_queue_mem, OTA_QUEUE_LENGTH, sizeof(ota_msg_t));
+static ota_update_progress_cb_t progress_cb = NULL;
+static void *progress_cb_arg = NULL;
+
+static void ota_snapshot(ota_update_status_t *status) {
+    taskENTER_CRITICAL(&ota_lock);
+    *status = ota_status;
+    if (status->state == OTA_STATE_RECEIVING) {
+        status->elapsed_ms = (uint32_t)((esp_timer_get_time() - ota_start_us) / 1000);
+    }
+    status->flash_ms = (uint32_t)(ota_flash_us / 1000);
+    taskEXIT_CRITICAL(&ota_lock);
+    
+    status->throughput_bps = status->elapsed_ms > 0 ?
+                             (uint32_t)((uint64_t)status->written * 1000 / status->elapsed_ms) : 0;
+}
+
+static void ota_report(void) {
+    ota_update_progress_cb_t cb = progress_cb;
+    if (cb != NULL) {
+        ota_update_status_t status;
+        ota_snapshot(&status);
+        cb(&status, progress_cb_arg);
+    }
+}
+
+static void ota_set_state(ota_state_t state, esp_err_t error) {
+    taskENTER_CRITICAL(&ota_lock);
+    if (ota_status.state == OTA_STATE_RECEIVING) {
+        ota_status.elapsed_ms = (uint32_t)((esp_timer_get_time() - ota_start_us) / 1000);
+    }
+    ota_status.state = state;
+    ota_status.error = error;
+    taskEXIT_CRITICAL(&ota_lock);
+}
+
+// Called by ota_update_begin() while no session or writer work is pending
+static esp_err_t ota_bufs_alloc(void) {
+#ifndef CONFIG_OTA_UPDATE_STATIC_BUFFERS
+    if (ota_bufs == NULL) {
+        ota_bufs = malloc(OTA_UPDATE_WINDOW);
+    }
+#endif
+    return ota_bufs != NULL ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// Once no block is queued: in the writer task before the state change that lets
+// begin run again, or in begin itself when the session could not be opened
+static void ota_bufs_free(void) {
+#ifndef CONFIG_OTA_UPDATE_STATIC_BUFFERS
+    free(ota_bufs);
+    ota_bufs = NULL;
+#endif
+}
+
+static void ota_release_session(void) {
+    if (ota_handle != 0) {
+        esp_ota_abort(ota_handle);
+        ota_handle = 0;
+    }
+    mbedtls_sha256_free(&ota_sha_ctx);
+}
+
+// Hash and write one block; the producer fills the other block meanwhile
+static void ota_write_block(const ota_msg_t *msg) {
+    taskENTER_CRITICAL(&ota_lock);
+    bool receiving = ota_status.state == OTA_STATE_RECEIVING || ota_status.state == OTA_STATE_VERIFYING;
+    taskEXIT_CRITICAL(&ota_lock);
+    
+    if (receiving) {
+        const uint8_t *data = ota_bufs[msg->buf];
+        mbedtls_sha256_update(&ota_sha_ctx, data, msg->len);
+    
+        int64_t t0 = esp_timer_get_time();
+        esp_err_t err = esp_ota_write(ota_handle, data, msg->len);
+        int64_t dt = esp_timer_get_time() - t0;
+    
+        taskENTER_CRITICAL(&ota_lock);
+        ota_flash_us += dt;
+        if (err == ESP_OK) {
+            ota_status.written += msg->len;
+        }
+        uint32_t written = ota_status.written;
+        taskEXIT_CRITICAL(&ota_lock);
+    
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Flash write failed at %lu: %s", (unsigned long)written, esp_err_to_name(err));
+            ota_release_session();
+            ota_set_state(OTA_STATE_ERROR, err);
+        }
+    }
+    
+    taskENTER_CRITICAL(&ota_lock);
+    ota_buf_busy[msg->buf] = false;
+    taskEXIT_CRITICAL(&ota_lock);
+    ota_report();
+}
+
+static void ota_verify(void) {
+    uint8_t digest[OTA_UPDATE_SHA256_LEN];
+    esp_err_t err;
+    
+    taskENTER_CRITICAL(&ota_lock);
+    bool verifying = ota_status.state == OTA_STATE_VERIFYING;
+    taskEXIT_CRITICAL(&ota_lock);
+    if (!verifying) {
+        return;     // A flash write failed while the finish request was queued
+    }
+    
+    mbedtls_sha256_finish(&ota_sha_ctx, digest);
+    ota_bufs_free();
+    if (memcmp(digest, ota_sha256, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "Image hash mismatch");
+        ota_release_session();
+        ota_set_state(OTA_STATE_ERROR, ESP_ERR_INVALID_CRC);
+        ota_report();
+        return;
+    }
+    
+    // esp_ota_end() checks the image header and segments before we switch to it
+    err = esp_ota_end(ota_handle);
+    ota_handle = 0;
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(ota_partition);
+    }
+    mbedtls_sha256_free(&ota_sha_ctx);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Image rejected: %s", esp_err_to_name(err));
+        ota_set_state(OTA_STATE_ERROR, err);
+        ota_report();
+        return;
+    }
+    
+    ota_set_state(OTA_STATE_READY, ESP_OK);
+    
+    ota_update_status_t status;
+    ota_snapshot(&status);
+    ESP_LOGI(TAG, "Update verified: %lu bytes in %lu ms (%lu B/s), flash busy %lu ms, boot partition %s",
+             (unsigned long)status.written, (unsigned long)status.elapsed_ms,
+             (unsigned long)status.throughput_bps, (unsigned long)status.flash_ms, ota_partition->label);
+    ota_report();
+}
+
+static void ota_discard(void) {
+    ota_release_session();
+    ota_bufs_free();
+    
+    taskENTER_CRITICAL(&ota_lock);
+    bool was_ready = ota_status.state == OTA_STATE_READY;
+    ota_abort_pending = false;
+    taskEXIT_CRITICAL(&ota_lock);
+    
+    if (was_ready) {
+        // The verified image was already selected; keep booting the running one
+        esp_ota_set_boot_partition(esp_ota_get_running_partition());
+    }
+    ota_set_state(OTA_STATE_IDLE, ESP_OK);
+    ESP_LOGI(TAG, "Update aborted");
+    ota_report();
+}
+
+// Flash writes, verification and restart all happen here so no caller waits on flash
+static void ota_task(void *arg) {
+    ota_msg_t msg;
+    
+    for (;;) {
+        if (xQueueReceive(ota_queue, &msg, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+    
+        switch (msg.type) {
+            case OTA_MSG_BLOCK:
+                ota_write_block(&msg);
+                break;
+            case OTA_MSG_FINISH:
+                ota_verify();
+                break;
+            case OTA_MSG_ABORT:
+                ota_discard();
+                break;
+            case OTA_MSG_REBOOT:
+                ESP_LOGI(TAG, "Restarting into the new image");
+                vTaskDelay(pdMS_TO_TICKS(OTA_UPDATE_REBOOT_DELAY_MS));
+                esp_restart();
+                break;
+        }
+    }
+}
+
+esp_err_t ota_update_init(void) {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    
+    ota_queue = app_queue_create(&ota_queue_mem, OTA_QUEUE_LENGTH, sizeof(ota_msg_t));
+    if (ota_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to create OTA queue");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    if (app_task_create(&ota_task_mem, ota_task, "ota_update", OTA_TASK_STACK, NULL, OTA_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create OTA task");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    ESP_LOGI(TAG, "OTA update ready, running from %s", running->label);
+    return ESP_OK;
+}
+
+void ota_update_mark_valid(void) {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    esp_ota_img_states_t state;
+    
+    if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+        ESP_LOGI(TAG, "Confirming updated image in %s", running->label);
+        esp_ota_mark_app_valid_cancel_rollback();
+    }
+}
+
+esp_err_t ota_update_begin(uint32_t image_size, const uint8_t sha256[OTA_UPDATE_SHA256_LEN]) {
+    if (image_size == 0 || sha256 == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    taskENTER_CRITICAL(&ota_lock);
+    ota_state_t state = ota_status.state;
+    bool same = ota_status.image_size == image_size && memcmp(ota_sha256, sha256, OTA_UPDATE_SHA256_LEN) == 0;
+    bool writer_idle = !ota_buf_busy[0] && !ota_buf_busy[1] && !ota_abort_pending;
+    uint32_t received = ota_status.received;
+    taskEXIT_CRITICAL(&ota_lock);
+    
+    if (state == OTA_STATE_RECEIVING && same) {
+        ESP_LOGI(TAG, "Resuming update at offset %lu", (unsigned long)received);
+        return ESP_OK;
+    }
+    // A verified image must be aborted first, it is already the boot partition
+    if (state == OTA_STATE_RECEIVING || state == OTA_STATE_VERIFYING || state == OTA_STATE_READY || !writer_idle) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No OTA partition available");
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (image_size > partition->size) {
+        ESP_LOGE(TAG, "Image of %lu bytes does not fit %s", (unsigned long)image_size, partition->label);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (ota_bufs_alloc() != ESP_OK) {
+        ESP_LOGE(TAG, "No heap for the %d byte staging blocks", OTA_UPDATE_WINDOW);
+        return ESP_ERR_NO_MEM;
+    }
+    
+    // Sequential writes erase sector by sector, so begin returns without a full partition erase
+    esp_ota_handle_t handle;
+    esp_err_t err = esp_ota_begin(partition, OTA_WITH_SEQUENTIAL_WRITES, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        ota_bufs_free();
+        return err;
+    }
+    
+    ota_partition = partition;
+    ota_handle = handle;
+    mbedtls_sha256_init(&ota_sha_ctx);
+    mbedtls_sha256_starts(&ota_sha_ctx, 0);
+    ota_fill_buf = 0;
+    ota_fill_len = 0;
+    
+    taskENTER_CRITICAL(&ota_lock);
+    memcpy(ota_sha256, sha256, OTA_UPDATE_SHA256_LEN);
+    ota_status = (ota_update_status_t){
+        .state = OTA_STATE_RECEIVING,
+        .image_size = image_size,
+    };
+    ota_start_us = esp_timer_get_time();
+    ota_flash_us = 0;
+    taskEXIT_CRITICAL(&ota_lock);
+    
+    ESP_LOGI(TAG, "Update started: %lu bytes into %s", (unsigned long)image_size, partition->label);
+    ota_report();
+    return ESP_OK;
+}
+
+esp_err_t ota_update_write(uint32_t offset, const uint8_t *data, size_t len) {
+    if (data == NULL || len == 0 || len > OTA_UPDATE_BLOCK_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    taskENTER_CRITICAL(&ota_lock);
+    bool receiving = ota_status.state == OTA_STATE_RECEIVING;
+    uint32_t received = ota_status.received;
+    uint32_t image_size = ota_status.image_size;
+    uint8_t other = ota_fill_buf ^ 1;
+    bool fill_free = !ota_buf_busy[ota_fill_buf];
+    bool other_free = !ota_buf_busy[other];
+    taskEXIT_CRITICAL(&ota_lock);
+    
+    if (!receiving || offset != received) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (len > image_size - received) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    
+    // Room left in the current block, plus the next one if the writer has released it
+    size_t room = fill_free ? OTA_UPDATE_BLOCK_SIZE - ota_fill_len : 0;
+    if (other_free) {
+        room += OTA_UPDATE_BLOCK_SIZE;
+    }
+    if (len > room) {
+        return ESP_ERR_NO_MEM;
+    }
+    
+    while (len > 0) {
+        size_t n = OTA_UPDATE_BLOCK_SIZE - ota_fill_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&ota_bufs[ota_fill_buf][ota_fill_len], data, n);
+        ota_fill_len += n;
+        received += n;
+        data += n;
+        len -= n;
+    
+        // Hand over full blocks, and the tail once the image is complete
+        if (ota_fill_len == OTA_UPDATE_BLOCK_SIZE || received == image_size) {
+            ota_msg_t msg = { .type = OTA_MSG_BLOCK, .buf = ota_fill_buf, .len = ota_fill_len };
+            taskENTER_CRITICAL(&ota_lock);
+            ota_buf_busy[ota_fill_buf] = true;
+            taskEXIT_CRITICAL(&ota_lock);
+            xQueueSend(ota_queue, &msg, portMAX_DELAY);     // Never waits: one slot per block
+            ota_fill_buf ^= 1;
+            ota_fill_len = 0;
+        }
+    }
+    
+    taskENTER_CRITICAL(&ota_lock);
+    ota_status.received = received;
+    taskEXIT_CRITICAL(&ota_lock);
+    return ESP_OK;
+}
+
+esp_err_t ota_update_finish(void) {
+    taskENTER_CRITICAL(&ota_lock);
+    bool complete = ota_status.state == OTA_STATE_RECEIVING && ota_status.received == ota_status.image_size;
+    if (complete) {
+        ota_status.state = OTA_STATE_VERIFYING;
+        ota_status.elapsed_ms = (uint32_t)((esp_timer_get_time() - ota_start_us) / 1000);
+    }
+    taskEXIT_CRITICAL(&ota_lock);
+    
+    if (!complete) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    // Queued behind the last block, so the hash covers the whole image
+    ota_msg_t msg = { .type = OTA_MSG_FINISH };
+    xQueueSend(ota_queue, &msg, portMAX_DELAY);
+    return ESP_OK;
+}
+
+esp_err_t ota_update_abort(void) {
+    ota_msg_t msg = { .type = OTA_MSG_ABORT };
+    
+    taskENTER_CRITICAL(&ota_lock);
+    if (ota_status.state == OTA_STATE_RECEIVING) {
+        ota_status.state = OTA_STATE_ERROR;     // Writer skips queued blocks until the abort is handled
+        ota_status.error = ESP_ERR_INVALID_STATE;
+    }
+    ota_abort_pending = true;
+    taskEXIT_CRITICAL(&ota_lock);
+    
+    xQueueSend(ota_queue, &msg, portMAX_DELAY);
+    return ESP_OK;
+}
+
+esp_err_t ota_update_apply(void) {
+    taskENTER_CRITICAL(&ota_lock);
+    bool ready = ota_status.state == OTA_STATE_READY;
+    taskEXIT_CRITICAL(&ota_lock);
+    
+    if (!ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    ota_msg_t msg = { .type = OTA_MSG_REBOOT };
+    xQueueSend(ota_queue, &msg, portMAX_DELAY);
+    return ESP_OK;
+}
+
+bool ota_update_is_active(void) {
+    taskENTER_CRITICAL(&ota_lock);
+    ota_state_t state = ota_status.state;
+    taskEXIT_CRITICAL(&ota_lock);
+    return state == OTA_STATE_RECEIVING || state == OTA_STATE_VERIFYING || state == OTA_STATE_READY;
+}
+
+void ota_update_get_status(ota_update_status_t *status) {
+    if (status != NULL) {
+        ota_snapshot(status);
+    }
+}
+
+void ota_update_set_progress_cb(ota_update_progress_cb_t cb, void *arg) {
+    progress_cb_arg = arg;
+    progress_cb = cb;
+}
@@ -2,9 +2,10 @@
 #define STEPPER_MOTOR_H
 
 #include "esp_err.h"
-#include "driver/gpio.h"
+#include "app_hal.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "diag_hist.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -23,6 +24,17 @@ extern "C" {
 // #define STEPS_PER_MM           50      // If 40 is too low
 // #define STEPS_PER_MM           25      // Conservative estimate
 
+// Depth of the motor command queue shared by all command producers
+#define MOTOR_CMD_QUEUE_LENGTH  32
+
+// Pin capture signal bits (diag_capture); MOTOR_SIG_NFAULT is the raw, active-low FAULT level
+#define MOTOR_SIG_AIN1          0x01
+#define MOTOR_SIG_AIN2          0x02
+#define MOTOR_SIG_BIN1          0x04
+#define MOTOR_SIG_BIN2          0x08
+#define MOTOR_SIG_SLEEP         0x10
+#define MOTOR_SIG_NFAULT        0x20
+
 // Motor command enumeration
 typedef enum {
     MOTOR_CMD_STOP = 0,
@@ -31,7 +43,8 @@ typedef enum {
     MOTOR_CMD_HOME,
     MOTOR_CMD_SET_SPEED,
     MOTOR_CMD_ENABLE,
-    MOTOR_CMD_DISABLE
+    MOTOR_CMD_DISABLE,
+    MOTOR_CMD_RESET_DRIVER      // Internal, queued by stepper_motor_reset_driver(); not accepted from clients
 } motor_command_t;
 
 // Motor status enumeration
@@ -63,6 +76,83 @@ typedef struct {
     bool direction;             // Current direction (true = forward, false = backward)
 } stepper_motor_t;
 
+// Command as submitted to the motor task
+typedef struct {
+    motor_command_t command;
+    int16_t parameter;
+    uint16_t move_id;       // Client-chosen ID reported in motion events, 0 if untagged
+    uint32_t rx_us;         // esp_timer time the transport received the command, 0 if not tracked
+} stepper_motor_cmd_t;
+
+// How a move ended
+typedef enum {
+    MOTOR_EVENT_MOVE_COMPLETE = 0,  // Target reached
+    MOTOR_EVENT_MOVE_ABORTED,       // Stopped, disabled or superseded by another move
+    MOTOR_EVENT_MOVE_LIMIT,         // Target was outside the soft limits; stopped at the limit
+    MOTOR_EVENT_MOVE_FAULT          // Driver fault interrupted the move
+} motor_event_type_t;
+
+// Motion event delivered to registered listeners
+typedef struct {
+    motor_event_type_t type;
+    uint16_t move_id;       // ID of the move that ended
+    int16_t position;       // Final position in steps
+    uint32_t elapsed_ms;    // Time from move start to the event
+} motor_event_t;
+
+// Called from the motor task; must not block
+typedef void (*stepper_motor_event_cb_t)(const motor_event_t *event, void *arg);
+
+#define MOTOR_EVENT_MAX_LISTENERS   4
+
+// Conditions reported as soon as the motor task sees them
+typedef enum {
+    MOTOR_ALERT_FAULT = 0,          // DRV8833 nFAULT asserted (overcurrent, thermal shutdown, undervoltage)
+    MOTOR_ALERT_FAULT_CLEARED,      // nFAULT released
+    MOTOR_ALERT_LIMIT,              // A move stopped at a soft limit
+    MOTOR_ALERT_STALL               // Reserved: open-loop drive has no stall sensing yet
+} motor_alert_type_t;
+
+typedef struct {
+    motor_alert_type_t type;
+    uint16_t move_id;       // Move in progress when the alert was raised, 0 if none
+    int16_t position;       // Position in steps when the alert was raised
+} motor_alert_t;
+
+// Called from the motor task right after the outputs were made safe; must not block
+typedef void (*stepper_motor_alert_cb_t)(const motor_alert_t *alert, void *arg);
+
+#define MOTOR_ALERT_MAX_LISTENERS   2
+
+// Step timing; a deviation is the actual minus the expected interval between two steps
+typedef struct {
+    uint32_t total_steps;   // Steps output since boot (kept across resets)
+    uint32_t step_rate_hz;  // Steps in the last full second of motion, 0 when idle
+    int32_t dev_min_us;     // Earliest step relative to the expected interval
+    int32_t dev_max_us;     // Latest step relative to the expected interval
+    diag_hist_t jitter_us;  // |deviation| of every interval measured since the last reset
+} stepper_motor_step_stats_t;
+
+// Command latency checkpoints: receive -> xQueueSend -> xQueueReceive -> first step of a move
+typedef enum {
+    MOTOR_LATENCY_RX_TO_QUEUE = 0,  // Transport receive to xQueueSend (only commands with rx_us set)
+    MOTOR_LATENCY_QUEUE_WAIT,       // xQueueSend to xQueueReceive in the motor task
+    MOTOR_LATENCY_DEQUEUE_TO_STEP,  // xQueueReceive to the first step output of the move
+    MOTOR_LATENCY_TOTAL,            // Transport receive to the first step output of the move
+    MOTOR_LATENCY_STAGE_COUNT
+} motor_latency_stage_t;
+
+typedef struct {
+    diag_hist_t stage_us[MOTOR_LATENCY_STAGE_COUNT];
+    uint32_t over_budget;   // Moves whose total exceeded CONFIG_STEPPER_MOTOR_LATENCY_BUDGET_US
+} stepper_motor_latency_stats_t;
+
+// Called from the motor task each time a queued command is consumed
+typedef void (*stepper_motor_queue_cb_t)(uint32_t free_slots, void *arg);
+
+// Called from the motor task before it applies ENABLE, a move or HOME; false refuses the command
+typedef bool (*stepper_motor_gate_t)(void);
+
 // Function declarations
 esp_err_t stepper_motor_init(stepper_motor_t *motor);
 esp_err_t stepper_motor_move_to_position(stepper_motor_t *motor, int16_t position);
@@ -73,10 +163,42 @@ esp_err_t stepper_motor_set_speed(stepper_motor_t *motor, uint16_t speed_delay_m
 esp_err_t stepper_motor_enable(stepper_motor_t *motor);
 esp_err_t stepper_motor_disable(stepper_motor_t *motor);
 
+// Pulse nSLEEP to clear a latched driver fault, keeping the enable state; never blocks on the queue
+esp_err_t stepper_motor_reset_driver(stepper_motor_t *motor);
+
 motor_status_t stepper_motor_get_status(stepper_motor_t *motor);
 int16_t stepper_motor_get_position(stepper_motor_t *motor);
 bool stepper_motor_is_fault(stepper_motor_t *motor);
 
+// Non-blocking command submission for pipelined producers (BLE command stream)
+esp_err_t stepper_motor_try_command(stepper_motor_t *motor, motor_command_t command, int16_t parameter);
+esp_err_t stepper_motor_submit_batch(stepper_motor_t *motor, const stepper_motor_cmd_t *cmds, size_t count);
+uint32_t stepper_motor_queue_space(void);
+void stepper_motor_get_queue_depth(uint32_t *depth, uint32_t *peak);
+void stepper_motor_set_queue_callback(stepper_motor_queue_cb_t cb, void *arg);
+
+// Cancel the move in progress and every command queued so far; never blocks on the queue
+esp_err_t stepper_motor_flush(stepper_motor_t *motor);
+
+// Refuse motion while gate returns false (e.g. during a firmware update); NULL to remove
+void stepper_motor_set_motion_gate(stepper_motor_gate_t gate);
+
+// Fault and limit alerts (BLE notifications and the application supervisor)
+esp_err_t stepper_motor_register_alert_cb(stepper_motor_alert_cb_t cb, void *arg);
+esp_err_t stepper_motor_unregister_alert_cb(stepper_motor_alert_cb_t cb, void *arg);
+
+// Step timing statistics (the first step of a move has no interval and is only counted)
+void stepper_motor_get_step_stats(stepper_motor_step_stats_t *stats);
+void stepper_motor_reset_step_stats(void);
+
+// Command latency statistics, per stage
+void stepper_motor_get_latency_stats(stepper_motor_latency_stats_t *stats);
+void stepper_motor_reset_latency_stats(void);
+
+// Motion completion events for on-device consumers
+esp_err_t stepper_motor_register_event_cb(stepper_motor_event_cb_t cb, void *arg);
+esp_err_t stepper_motor_unregister_event_cb(stepper_motor_event_cb_t cb, void *arg);
+
 void stepper_motor_task(void *pvParameters);
 void stepper_motor_test_movement(stepper_motor_t *motor);
 
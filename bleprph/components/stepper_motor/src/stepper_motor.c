@@ -1,8 +1,21 @@
+#include <string.h>
 #include "stepper_motor.h"
+#include "app_alloc.h"
+#include "app_hal.h"
+#include "timer_wheel.h"
+#include "diag_capture.h"
+#include "diag_power.h"
+#include "diag_prof.h"
+#include "diag_trace.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
 
 static const char *TAG = "STEPPER_MOTOR";
 
@@ -17,28 +30,376 @@ static const uint8_t step_sequence[4][4] = {
 // Static motor instance
 static stepper_motor_t *g_motor = NULL;
 static TaskHandle_t motor_task_handle = NULL;
+static timer_wheel_timer_t motor_fault_timer;
 static QueueHandle_t motor_command_queue = NULL;
+static SemaphoreHandle_t motor_queue_lock = NULL;   // Keeps batches contiguous in the queue
+static uint32_t motor_queue_peak = 0;               // Deepest queue seen by a producer, under motor_queue_lock
+static stepper_motor_queue_cb_t queue_cb = NULL;
+static void *queue_cb_arg = NULL;
+static stepper_motor_gate_t motion_gate = NULL;
+
+// Flush generation: bumped under motor_queue_lock by stepper_motor_flush(), stamped
+// on every queued command. The motor task drops commands of an older generation.
+static volatile uint8_t motor_queue_gen = 0;
+static uint8_t motor_gen_seen = 0;          // Motor task only
+
+// Motion event listeners
+typedef struct {
+    stepper_motor_event_cb_t cb;
+    void *arg;
+} motor_event_listener_t;
+
+static motor_event_listener_t event_listeners[MOTOR_EVENT_MAX_LISTENERS];
+static portMUX_TYPE event_listeners_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Alert listeners, under the same lock
+typedef struct {
+    stepper_motor_alert_cb_t cb;
+    void *arg;
+} motor_alert_listener_t;
+
+static motor_alert_listener_t alert_listeners[MOTOR_ALERT_MAX_LISTENERS];
+
+// Active move bookkeeping (owned by the motor task)
+static bool move_active = false;
+static bool move_limited = false;
+static uint16_t move_id = 0;
+static int64_t move_start_us = 0;
+static bool fault_active = false;
+static bool motor_enabled = true;           // Last ENABLE/DISABLE; a driver reset returns to it
+
+// Step timing, written by the motor task and read by diagnostics clients
+static stepper_motor_step_stats_t step_stats;
+static portMUX_TYPE step_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t last_step_us = 0;            // 0 when the previous loop did not step
+static uint32_t last_step_commanded_us = 0;
+static int64_t rate_window_us = 0;
+static uint32_t rate_window_steps = 0;
+
+// Command latency, written by the motor task and read by diagnostics clients
+static stepper_motor_latency_stats_t latency_stats;
+static portMUX_TYPE latency_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool latency_pending = false;        // A dequeued move has not stepped yet
+static uint32_t latency_rx_us = 0;
+static uint32_t latency_dequeued_us = 0;
 
 // Motor command structure for queue
 typedef struct {
     motor_command_t command;
     int16_t parameter;
+    uint16_t move_id;       // Client-chosen move ID, 0 if untagged
+    bool batch_more;        // More commands of the same batch follow
+    uint8_t gen;            // motor_queue_gen when queued
+    uint32_t rx_us;         // Transport receive time, 0 if not tracked
+    uint32_t queued_us;     // Stamped right before xQueueSend
 } motor_cmd_msg_t;
 
+// Task, queue and lock storage (.bss with CONFIG_APP_STATIC_ALLOC)
+#define MOTOR_TASK_STACK    CONFIG_STEPPER_MOTOR_TASK_STACK_SIZE
+#define MOTOR_TASK_PRIO     CONFIG_STEPPER_MOTOR_TASK_PRIO
+#if defined(CONFIG_STEPPER_MOTOR_CORE_APP)
+#define MOTOR_TASK_CORE     1
+#elif defined(CONFIG_STEPPER_MOTOR_CORE_PRO)
+#define MOTOR_TASK_CORE     0
+#else
+#define MOTOR_TASK_CORE     tskNO_AFFINITY
+#endif
+#define MOTOR_MOVE_POLL_MS  10      // Command poll between steps; adds to every step interval
+#define MOTOR_IDLE_POLL_MS  100     // Fault pin poll while idle; commands wake the task at once
+#define MOTOR_FAULT_RECHECK_MS  1000    // Fault still latched: next look at the pin and the queue
+
+// DRV8833 nSLEEP timing for a driver reset: low long enough to clear the fault
+// logic, then tWAKE (1 ms max) before the outputs follow the inputs again
+#define MOTOR_RESET_SLEEP_MS    1
+#define MOTOR_WAKE_MS           1
+
+// Motor task notification bits; every wait is on these, so a fault edge ends any of them
+#define MOTOR_NOTIFY_FAULT  0x01    // nFAULT edge or fault re-check
+#define MOTOR_NOTIFY_CMD    0x02    // A producer queued commands
+
+// Bits received but not yet consumed by a wait (motor task only)
+static uint32_t motor_notified = 0;
+
+// Power management locks, held by the motor task only while stepping
+#ifdef CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t motor_pm_apb = NULL;
+static esp_pm_lock_handle_t motor_pm_awake = NULL;
+#endif
+static bool motor_pm_held = false;
+
+APP_TASK_MEM(motor_task_mem, MOTOR_TASK_STACK);
+APP_QUEUE_MEM(motor_queue_mem, MOTOR_CMD_QUEUE_LENGTH, sizeof(motor_cmd_msg_t));
+APP_MUTEX_MEM(motor_queue_lock_mem);
+
+// FAULT pin edge: wake the motor task so it makes the outputs safe and raises the alert
+static void IRAM_ATTR motor_fault_isr(void *arg) {
+    BaseType_t woken = pdFALSE;
+#ifdef CONFIG_DIAG_CAPTURE
+    const stepper_motor_t *motor = (const stepper_motor_t *)arg;
+    DIAG_CAPTURE_SIGNAL(MOTOR_SIG_NFAULT, app_hal_gpio_get(motor->fault_pin) != 0);
+#endif
+    if (motor_task_handle != NULL) {
+        xTaskNotifyFromISR(motor_task_handle, MOTOR_NOTIFY_FAULT, eSetBits, &woken);
+    }
+    portYIELD_FROM_ISR(woken);
+}
+
+// Interrupts are allocated on the calling core, so this runs in the motor task to
+// keep the fault ISR on the motor's core. If another component installed the GPIO
+// ISR service first, the handler runs on that component's core instead.
+static void motor_fault_irq_init(stepper_motor_t *motor) {
+    esp_err_t err = app_hal_gpio_isr_add(motor->fault_pin, motor_fault_isr, motor);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Fault interrupt unavailable, falling back to polling: %s", esp_err_to_name(err));
+    }
+}
+
+// Move pending notification bits into motor_notified without waiting
+static void motor_notify_collect(void) {
+    uint32_t bits = 0;
+    if (xTaskNotifyWait(0, UINT32_MAX, &bits, 0) == pdTRUE) {
+        motor_notified |= bits;
+    }
+}
+
+// Sleep until one of the wake bits is notified or ticks pass, and consume those bits.
+// Other bits end the kernel wait but are kept for later, and the sleep goes on to
+// the original deadline, so a queued command does not cut a step delay short.
+static uint32_t motor_wait(uint32_t wake, TickType_t ticks) {
+    TickType_t start = xTaskGetTickCount();
+    
+    while ((motor_notified & wake) == 0) {
+        TickType_t left = portMAX_DELAY;
+        if (ticks != portMAX_DELAY) {
+            TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks) {
+                break;
+            }
+            left = ticks - elapsed;
+        }
+        
+        uint32_t bits = 0;
+        if (xTaskNotifyWait(0, UINT32_MAX, &bits, left) == pdTRUE) {
+            motor_notified |= bits;
+        }
+    }
+    
+    uint32_t seen = motor_notified & wake;
+    motor_notified &= ~wake;
+    return seen;
+}
+
+// Take the next queued command, waiting up to ticks for one. A fault edge ends the
+// wait too, so the caller looks at the pin without first sitting out the poll.
+static bool motor_receive(motor_cmd_msg_t *cmd, TickType_t ticks) {
+    // Command bits raised before this look at the queue are answered by it
+    motor_notify_collect();
+    motor_notified &= ~MOTOR_NOTIFY_CMD;
+    
+    if (xQueueReceive(motor_command_queue, cmd, 0) == pdTRUE) {
+        return true;
+    }
+    if (ticks == 0) {
+        return false;
+    }
+    motor_wait(MOTOR_NOTIFY_CMD | MOTOR_NOTIFY_FAULT, ticks);
+    return xQueueReceive(motor_command_queue, cmd, 0) == pdTRUE;
+}
+
+// Wakes the motor task to look at a latched fault again; runs in the timer wheel task.
+// Always wakes it: without the fault interrupt, a fault that cleared since the last
+// look has no edge to end the task's wait.
+static void motor_fault_timer_cb(void *arg) {
+    if (motor_task_handle != NULL) {
+        xTaskNotify(motor_task_handle, MOTOR_NOTIFY_FAULT, eSetBits);
+    }
+}
+
+// Keep the APB clock at its maximum and light sleep off while stepping, so
+// neither a frequency switch nor a wakeup stretches a step interval; idle
+// time is left to the power manager
+static void motor_pm_hold(bool hold) {
+    if (hold == motor_pm_held) {
+        return;
+    }
+    
+    motor_pm_held = hold;
+#ifdef CONFIG_PM_ENABLE
+    if (hold) {
+        esp_pm_lock_acquire(motor_pm_apb);
+        esp_pm_lock_acquire(motor_pm_awake);
+    } else {
+        esp_pm_lock_release(motor_pm_awake);
+        esp_pm_lock_release(motor_pm_apb);
+    }
+#endif
+    if (hold) {
+        diag_power_perf_begin();
+    } else {
+        diag_power_perf_end();
+    }
+}
+
+// Checkpoint at xQueueReceive: the receive and queue stages are known now, the rest at the first step
+static void motor_latency_dequeued(const motor_cmd_msg_t *cmd) {
+    uint32_t now = (uint32_t)app_hal_time_us();
+    
+    taskENTER_CRITICAL(&latency_lock);
+    if (cmd->rx_us != 0) {
+        diag_hist_add(&latency_stats.stage_us[MOTOR_LATENCY_RX_TO_QUEUE], cmd->queued_us - cmd->rx_us);
+    }
+    diag_hist_add(&latency_stats.stage_us[MOTOR_LATENCY_QUEUE_WAIT], now - cmd->queued_us);
+    taskEXIT_CRITICAL(&latency_lock);
+    
+    if (cmd->command == MOTOR_CMD_MOVE_ABSOLUTE || cmd->command == MOTOR_CMD_MOVE_RELATIVE ||
+        cmd->command == MOTOR_CMD_HOME) {
+        latency_pending = true;
+        latency_rx_us = cmd->rx_us;
+        latency_dequeued_us = now;
+    }
+}
+
+// Checkpoint at the first step output of a move
+static void motor_latency_first_step(uint32_t now) {
+    uint32_t to_step = now - latency_dequeued_us;
+    uint32_t total = now - latency_rx_us;
+    bool over = false;
+    
+    latency_pending = false;
+    taskENTER_CRITICAL(&latency_lock);
+    diag_hist_add(&latency_stats.stage_us[MOTOR_LATENCY_DEQUEUE_TO_STEP], to_step);
+    if (latency_rx_us != 0) {
+        diag_hist_add(&latency_stats.stage_us[MOTOR_LATENCY_TOTAL], total);
+#if CONFIG_STEPPER_MOTOR_LATENCY_BUDGET_US > 0
+        if (total > CONFIG_STEPPER_MOTOR_LATENCY_BUDGET_US) {
+            latency_stats.over_budget++;
+            over = true;
+        }
+#endif
+    }
+    taskEXIT_CRITICAL(&latency_lock);
+    
+    if (over) {
+        DIAG_TRACE(TRACE_EVT_MOTOR_LATENCY, total, to_step, move_id);
+    }
+}
+
+// Account one step: interval deviation from the expected interval and the step rate
+static void motor_record_step(const stepper_motor_t *motor) {
+    int64_t now = app_hal_time_us();
+    
+    taskENTER_CRITICAL(&step_stats_lock);
+    step_stats.total_steps++;
+    if (last_step_us != 0) {
+        int32_t dev = (int32_t)(now - last_step_us - last_step_commanded_us);
+        if (step_stats.jitter_us.count == 0 || dev < step_stats.dev_min_us) {
+            step_stats.dev_min_us = dev;
+        }
+        if (step_stats.jitter_us.count == 0 || dev > step_stats.dev_max_us) {
+            step_stats.dev_max_us = dev;
+        }
+        diag_hist_add(&step_stats.jitter_us, dev < 0 ? (uint32_t)-dev : (uint32_t)dev);
+    } else {
+        rate_window_us = now;
+        rate_window_steps = 0;
+    }
+    
+    rate_window_steps++;
+    if (now - rate_window_us >= 1000000) {
+        step_stats.step_rate_hz = (uint32_t)((uint64_t)rate_window_steps * 1000000 / (now - rate_window_us));
+        rate_window_us = now;
+        rate_window_steps = 0;
+    }
+    taskEXIT_CRITICAL(&step_stats_lock);
+    
+    if (latency_pending) {
+        motor_latency_first_step((uint32_t)now);
+    }
+    
+    // The next step follows the command poll and the speed delay, both in whole ticks
+    last_step_us = now;
+    last_step_commanded_us = (uint32_t)app_hal_ticks_to_us(app_hal_ms_to_ticks(MOTOR_MOVE_POLL_MS) +
+                                                           app_hal_ms_to_ticks(motor->speed_delay_ms));
+}
+
+// Not stepping this loop; the next step starts a new interval
+static void motor_record_idle(void) {
+    latency_pending = false;    // The move ended (or was stopped) before its first step
+    if (last_step_us != 0) {
+        last_step_us = 0;
+        taskENTER_CRITICAL(&step_stats_lock);
+        step_stats.step_rate_hz = 0;
+        taskEXIT_CRITICAL(&step_stats_lock);
+    }
+}
+
+// Drive one driver input and report the write to the pin capture
+static inline void motor_pin_set(gpio_num_t pin, uint8_t sig, uint32_t level) {
+    app_hal_gpio_set(pin, level);
+    DIAG_CAPTURE_SIGNAL(sig, level != 0);
+}
+
+// Drive the four bridge inputs in one HAL write, reported as one pin capture record
+static void motor_coils_set(stepper_motor_t *motor, const uint8_t levels[4]) {
+    uint64_t mask = (1ULL << motor->ain1_pin) | (1ULL << motor->ain2_pin) |
+                    (1ULL << motor->bin1_pin) | (1ULL << motor->bin2_pin);
+    uint64_t bits = ((uint64_t)levels[0] << motor->ain1_pin) | ((uint64_t)levels[1] << motor->ain2_pin) |
+                    ((uint64_t)levels[2] << motor->bin1_pin) | ((uint64_t)levels[3] << motor->bin2_pin);
+    
+    app_hal_gpio_set_mask(mask, bits);
+    DIAG_CAPTURE_SIGNALS(MOTOR_SIG_AIN1 | MOTOR_SIG_AIN2 | MOTOR_SIG_BIN1 | MOTOR_SIG_BIN2,
+                         (levels[0] ? MOTOR_SIG_AIN1 : 0) | (levels[1] ? MOTOR_SIG_AIN2 : 0) |
+                         (levels[2] ? MOTOR_SIG_BIN1 : 0) | (levels[3] ? MOTOR_SIG_BIN2 : 0));
+}
+
 // Set motor pins according to step sequence
 static void set_motor_step(stepper_motor_t *motor, uint8_t step) {
-    gpio_set_level(motor->ain1_pin, step_sequence[step][0]);
-    gpio_set_level(motor->ain2_pin, step_sequence[step][1]);
-    gpio_set_level(motor->bin1_pin, step_sequence[step][2]);
-    gpio_set_level(motor->bin2_pin, step_sequence[step][3]);
+    motor_coils_set(motor, step_sequence[step]);
 }
 
 // Stop motor (all pins low)
 static void motor_stop_pins(stepper_motor_t *motor) {
-    gpio_set_level(motor->ain1_pin, 0);
-    gpio_set_level(motor->ain2_pin, 0);
-    gpio_set_level(motor->bin1_pin, 0);
-    gpio_set_level(motor->bin2_pin, 0);
+    static const uint8_t off[4] = {0, 0, 0, 0};
+    motor_coils_set(motor, off);
+}
+
+// Push commands under the producer lock; a batch is only queued if it fits entirely.
+// The lock is never held across a blocking send: a full queue is retried outside it,
+// one tick at a time until wait runs out, so other producers are not stalled.
+static esp_err_t motor_queue_send(const motor_cmd_msg_t *msgs, size_t count, TickType_t wait) {
+    TickType_t start = xTaskGetTickCount();
+    
+    while (1) {
+        if (xSemaphoreTake(motor_queue_lock, portMAX_DELAY) != pdTRUE) {
+            return ESP_ERR_TIMEOUT;
+        }
+        
+        bool fits = uxQueueSpacesAvailable(motor_command_queue) >= count;
+        for (size_t i = 0; fits && i < count; i++) {
+            motor_cmd_msg_t msg = msgs[i];
+            msg.gen = motor_queue_gen;
+            msg.queued_us = (uint32_t)app_hal_time_us();
+            xQueueSend(motor_command_queue, &msg, 0);   // Cannot fail: space checked, only producers add
+        }
+        
+        uint32_t depth = uxQueueMessagesWaiting(motor_command_queue);
+        if (depth > motor_queue_peak) {
+            motor_queue_peak = depth;
+        }
+        
+        xSemaphoreGive(motor_queue_lock);
+        
+        if (fits) {
+            if (motor_task_handle != NULL) {
+                xTaskNotify(motor_task_handle, MOTOR_NOTIFY_CMD, eSetBits);
+            }
+            return ESP_OK;
+        }
+        if (xTaskGetTickCount() - start >= wait) {
+            return ESP_ERR_NO_MEM;
+        }
+        vTaskDelay(1);
+    }
 }
 
 // Initialize motor hardware and GPIO
@@ -48,23 +409,14 @@ esp_err_t stepper_motor_init(stepper_motor_t *motor) {
     }
     
     // Configure GPIO pins
-    gpio_config_t io_conf = {0};
-    io_conf.intr_type = GPIO_INTR_DISABLE;
-    io_conf.mode = GPIO_MODE_OUTPUT;
-    io_conf.pin_bit_mask = (1ULL << motor->ain1_pin) | 
-                           (1ULL << motor->ain2_pin) |
-                           (1ULL << motor->bin1_pin) | 
-                           (1ULL << motor->bin2_pin) |
-                           (1ULL << motor->sleep_pin);
-    io_conf.pull_down_en = 0;
-    io_conf.pull_up_en = 0;
-    gpio_config(&io_conf);
-    
-    // Configure fault pin as input
-    io_conf.mode = GPIO_MODE_INPUT;
-    io_conf.pin_bit_mask = (1ULL << motor->fault_pin);
-    io_conf.pull_up_en = 1;  // DRV8833 FAULT is active low
-    gpio_config(&io_conf);
+    app_hal_gpio_output((1ULL << motor->ain1_pin) |
+                        (1ULL << motor->ain2_pin) |
+                        (1ULL << motor->bin1_pin) |
+                        (1ULL << motor->bin2_pin) |
+                        (1ULL << motor->sleep_pin));
+    
+    // Configure fault pin as input; both edges wake the motor task
+    app_hal_gpio_input(motor->fault_pin, true);  // DRV8833 FAULT is active low
     
     // Initialize motor state
     motor->current_position = 0;
@@ -76,24 +428,50 @@ esp_err_t stepper_motor_init(stepper_motor_t *motor) {
     motor->is_moving = false;
     motor->direction = true;
     
+#ifdef CONFIG_DIAG_CAPTURE
+    static const char *const capture_names[] = { "AIN1", "AIN2", "BIN1", "BIN2", "SLEEP", "nFAULT" };
+    diag_capture_set_signal_names(capture_names, sizeof(capture_names) / sizeof(capture_names[0]));
+    DIAG_CAPTURE_SIGNAL(MOTOR_SIG_NFAULT, app_hal_gpio_get(motor->fault_pin) != 0);
+#endif
+    
     // Enable motor driver
-    gpio_set_level(motor->sleep_pin, 1);
+    motor_pin_set(motor->sleep_pin, MOTOR_SIG_SLEEP, 1);
     
     // Stop motor initially
     motor_stop_pins(motor);
     
     // Create command queue
-    motor_command_queue = xQueueCreate(10, sizeof(motor_cmd_msg_t));
+    motor_command_queue = app_queue_create(&motor_queue_mem, MOTOR_CMD_QUEUE_LENGTH, sizeof(motor_cmd_msg_t));
     if (motor_command_queue == NULL) {
         ESP_LOGE(TAG, "Failed to create motor command queue");
         return ESP_ERR_NO_MEM;
     }
     
+    motor_queue_lock = app_mutex_create(&motor_queue_lock_mem);
+    if (motor_queue_lock == NULL) {
+        ESP_LOGE(TAG, "Failed to create motor queue lock");
+        return ESP_ERR_NO_MEM;
+    }
+    
+#ifdef CONFIG_PM_ENABLE
+    if (esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, "motor_apb", &motor_pm_apb) != ESP_OK ||
+        esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "motor_awake", &motor_pm_awake) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create motor PM locks");
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+    
+    stepper_motor_reset_step_stats();
+    stepper_motor_reset_latency_stats();
+    
     // Set global motor reference
     g_motor = motor;
     
-    // Create motor control task
-    BaseType_t ret = xTaskCreate(stepper_motor_task, "motor_task", 4096, motor, 5, &motor_task_handle);
+    timer_wheel_timer_init(&motor_fault_timer, "motor_fault", motor_fault_timer_cb, motor);
+    
+    // Create motor control task; it installs the fault interrupt on its own core
+    BaseType_t ret = app_task_create_pinned(&motor_task_mem, stepper_motor_task, "motor_task", MOTOR_TASK_STACK,
+                                            motor, MOTOR_TASK_PRIO, &motor_task_handle, MOTOR_TASK_CORE);
     if (ret != pdPASS) {
         ESP_LOGE(TAG, "Failed to create motor task");
         return ESP_ERR_NO_MEM;
@@ -109,16 +487,13 @@ esp_err_t stepper_motor_move_to_position(stepper_motor_t *motor, int16_t positio
         return ESP_ERR_INVALID_STATE;
     }
     
-    // Clamp position to limits
-    if (position > motor->max_position) position = motor->max_position;
-    if (position < motor->min_position) position = motor->min_position;
-    
+    // Position is clamped to the soft limits by the motor task
     motor_cmd_msg_t cmd = {
         .command = MOTOR_CMD_MOVE_ABSOLUTE,
         .parameter = position
     };
     
-    if (xQueueSend(motor_command_queue, &cmd, pdMS_TO_TICKS(100)) != pdTRUE) {
+    if (motor_queue_send(&cmd, 1, pdMS_TO_TICKS(100)) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to send move command");
         return ESP_ERR_TIMEOUT;
     }
@@ -137,7 +512,7 @@ esp_err_t stepper_motor_move_relative(stepper_motor_t *motor, int16_t steps) {
         .parameter = steps
     };
     
-    if (xQueueSend(motor_command_queue, &cmd, pdMS_TO_TICKS(100)) != pdTRUE) {
+    if (motor_queue_send(&cmd, 1, pdMS_TO_TICKS(100)) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to send relative move command");
         return ESP_ERR_TIMEOUT;
     }
@@ -156,7 +531,7 @@ esp_err_t stepper_motor_home(stepper_motor_t *motor) {
         .parameter = 0
     };
     
-    if (xQueueSend(motor_command_queue, &cmd, pdMS_TO_TICKS(100)) != pdTRUE) {
+    if (motor_queue_send(&cmd, 1, pdMS_TO_TICKS(100)) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to send home command");
         return ESP_ERR_TIMEOUT;
     }
@@ -175,7 +550,7 @@ esp_err_t stepper_motor_stop(stepper_motor_t *motor) {
         .parameter = 0
     };
     
-    if (xQueueSend(motor_command_queue, &cmd, pdMS_TO_TICKS(100)) != pdTRUE) {
+    if (motor_queue_send(&cmd, 1, pdMS_TO_TICKS(100)) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to send stop command");
         return ESP_ERR_TIMEOUT;
     }
@@ -194,7 +569,7 @@ esp_err_t stepper_motor_set_speed(stepper_motor_t *motor, uint16_t speed_delay_m
         .parameter = speed_delay_ms
     };
     
-    if (xQueueSend(motor_command_queue, &cmd, pdMS_TO_TICKS(100)) != pdTRUE) {
+    if (motor_queue_send(&cmd, 1, pdMS_TO_TICKS(100)) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to send speed command");
         return ESP_ERR_TIMEOUT;
     }
@@ -202,27 +577,56 @@ esp_err_t stepper_motor_set_speed(stepper_motor_t *motor, uint16_t speed_delay_m
     return ESP_OK;
 }
 
-// Enable motor driver
+// Enable motor driver; the motor task drives nSLEEP when it reaches the command
 esp_err_t stepper_motor_enable(stepper_motor_t *motor) {
-    if (motor == NULL) {
-        return ESP_ERR_INVALID_ARG;
+    if (motor == NULL || motor_command_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    motor_cmd_msg_t cmd = {
+        .command = MOTOR_CMD_ENABLE,
+        .parameter = 0
+    };
+    
+    if (motor_queue_send(&cmd, 1, pdMS_TO_TICKS(100)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send enable command");
+        return ESP_ERR_TIMEOUT;
     }
     
-    gpio_set_level(motor->sleep_pin, 1);
-    ESP_LOGI(TAG, "Motor enabled");
     return ESP_OK;
 }
 
-// Disable motor driver
+// Queue a driver reset without waiting; the queued CMD notification ends the
+// motor task's fault wait, so it runs without waiting for the next re-check
+esp_err_t stepper_motor_reset_driver(stepper_motor_t *motor) {
+    if (motor == NULL || motor_command_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    motor_cmd_msg_t cmd = {
+        .command = MOTOR_CMD_RESET_DRIVER,
+        .parameter = 0
+    };
+    
+    return motor_queue_send(&cmd, 1, 0);
+}
+
+// Disable motor driver; a move in progress ends with MOTOR_EVENT_MOVE_ABORTED
 esp_err_t stepper_motor_disable(stepper_motor_t *motor) {
-    if (motor == NULL) {
-        return ESP_ERR_INVALID_ARG;
+    if (motor == NULL || motor_command_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    motor_cmd_msg_t cmd = {
+        .command = MOTOR_CMD_DISABLE,
+        .parameter = 0
+    };
+    
+    if (motor_queue_send(&cmd, 1, pdMS_TO_TICKS(100)) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send disable command");
+        return ESP_ERR_TIMEOUT;
     }
     
-    gpio_set_level(motor->sleep_pin, 0);
-    motor_stop_pins(motor);
-    motor->is_moving = false;
-    ESP_LOGI(TAG, "Motor disabled");
     return ESP_OK;
 }
 
@@ -232,11 +636,11 @@ motor_status_t stepper_motor_get_status(stepper_motor_t *motor) {
         return MOTOR_STATUS_ERROR;
     }
     
-    if (gpio_get_level(motor->fault_pin) == 0) {
+    if (app_hal_gpio_get(motor->fault_pin) == 0) {
         return MOTOR_STATUS_ERROR;
     }
     
-    if (gpio_get_level(motor->sleep_pin) == 0) {
+    if (app_hal_gpio_get(motor->sleep_pin) == 0) {
         return MOTOR_STATUS_DISABLED;
     }
     
@@ -260,7 +664,395 @@ bool stepper_motor_is_fault(stepper_motor_t *motor) {
     if (motor == NULL) {
         return true;
     }
-    return gpio_get_level(motor->fault_pin) == 0;
+    return app_hal_gpio_get(motor->fault_pin) == 0;
+}
+
+// Queue a command without waiting; fails immediately when the queue is full
+esp_err_t stepper_motor_try_command(stepper_motor_t *motor, motor_command_t command, int16_t parameter) {
+    if (motor == NULL || motor_command_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    if (command > MOTOR_CMD_DISABLE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    motor_cmd_msg_t cmd = {
+        .command = command,
+        .parameter = parameter
+    };
+    
+    return motor_queue_send(&cmd, 1, 0);
+}
+
+// Queue a batch so the motor task applies all of it before taking another step
+esp_err_t stepper_motor_submit_batch(stepper_motor_t *motor, const stepper_motor_cmd_t *cmds, size_t count) {
+    if (motor == NULL || motor_command_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    if (cmds == NULL || count == 0 || count > MOTOR_CMD_QUEUE_LENGTH) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    motor_cmd_msg_t msgs[MOTOR_CMD_QUEUE_LENGTH];
+    for (size_t i = 0; i < count; i++) {
+        if (cmds[i].command > MOTOR_CMD_DISABLE) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        
+        msgs[i].command = cmds[i].command;
+        msgs[i].parameter = cmds[i].parameter;
+        msgs[i].move_id = cmds[i].move_id;
+        msgs[i].batch_more = (i + 1 < count);
+        msgs[i].rx_us = cmds[i].rx_us;
+    }
+    
+    return motor_queue_send(msgs, count, 0);
+}
+
+// Number of free command queue slots
+uint32_t stepper_motor_queue_space(void) {
+    if (motor_command_queue == NULL) {
+        return 0;
+    }
+    return uxQueueSpacesAvailable(motor_command_queue);
+}
+
+void stepper_motor_get_queue_depth(uint32_t *depth, uint32_t *peak) {
+    *depth = motor_command_queue != NULL ? uxQueueMessagesWaiting(motor_command_queue) : 0;
+    *peak = motor_queue_peak;
+}
+
+void stepper_motor_get_step_stats(stepper_motor_step_stats_t *stats) {
+    taskENTER_CRITICAL(&step_stats_lock);
+    *stats = step_stats;
+    taskEXIT_CRITICAL(&step_stats_lock);
+}
+
+// Clear the deviation statistics; total_steps keeps counting
+void stepper_motor_reset_step_stats(void) {
+    taskENTER_CRITICAL(&step_stats_lock);
+    diag_hist_reset(&step_stats.jitter_us);
+    step_stats.dev_min_us = 0;
+    step_stats.dev_max_us = 0;
+    taskEXIT_CRITICAL(&step_stats_lock);
+}
+
+void stepper_motor_get_latency_stats(stepper_motor_latency_stats_t *stats) {
+    taskENTER_CRITICAL(&latency_lock);
+    *stats = latency_stats;
+    taskEXIT_CRITICAL(&latency_lock);
+}
+
+void stepper_motor_reset_latency_stats(void) {
+    taskENTER_CRITICAL(&latency_lock);
+    for (int i = 0; i < MOTOR_LATENCY_STAGE_COUNT; i++) {
+        diag_hist_reset(&latency_stats.stage_us[i]);
+    }
+    latency_stats.over_budget = 0;
+    taskEXIT_CRITICAL(&latency_lock);
+}
+
+// Invalidate the queue: the motor task drops what is queued now and ends the current
+// move. Only the producer lock is taken, so it works with the queue full.
+esp_err_t stepper_motor_flush(stepper_motor_t *motor) {
+    if (motor == NULL || motor_command_queue == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    xSemaphoreTake(motor_queue_lock, portMAX_DELAY);
+    motor_queue_gen++;
+    xSemaphoreGive(motor_queue_lock);
+    
+    if (motor_task_handle != NULL) {
+        xTaskNotify(motor_task_handle, MOTOR_NOTIFY_CMD, eSetBits);
+    }
+    return ESP_OK;
+}
+
+void stepper_motor_set_motion_gate(stepper_motor_gate_t gate) {
+    motion_gate = gate;
+}
+
+// Register a callback notified whenever the motor task frees a queue slot
+void stepper_motor_set_queue_callback(stepper_motor_queue_cb_t cb, void *arg) {
+    queue_cb_arg = arg;
+    queue_cb = cb;
+}
+
+// Register a listener for fault and limit alerts; callbacks run in the motor task
+esp_err_t stepper_motor_register_alert_cb(stepper_motor_alert_cb_t cb, void *arg) {
+    if (cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    portENTER_CRITICAL(&event_listeners_lock);
+    for (int i = 0; i < MOTOR_ALERT_MAX_LISTENERS; i++) {
+        if (alert_listeners[i].cb == NULL) {
+            alert_listeners[i].cb = cb;
+            alert_listeners[i].arg = arg;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&event_listeners_lock);
+    return ret;
+}
+
+// Remove a listener previously added with stepper_motor_register_alert_cb()
+esp_err_t stepper_motor_unregister_alert_cb(stepper_motor_alert_cb_t cb, void *arg) {
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&event_listeners_lock);
+    for (int i = 0; i < MOTOR_ALERT_MAX_LISTENERS; i++) {
+        if (alert_listeners[i].cb == cb && alert_listeners[i].arg == arg) {
+            alert_listeners[i].cb = NULL;
+            alert_listeners[i].arg = NULL;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&event_listeners_lock);
+    return ret;
+}
+
+// Register a listener for motion events; callbacks run in the motor task
+esp_err_t stepper_motor_register_event_cb(stepper_motor_event_cb_t cb, void *arg) {
+    if (cb == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    portENTER_CRITICAL(&event_listeners_lock);
+    for (int i = 0; i < MOTOR_EVENT_MAX_LISTENERS; i++) {
+        if (event_listeners[i].cb == NULL) {
+            event_listeners[i].cb = cb;
+            event_listeners[i].arg = arg;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&event_listeners_lock);
+    return ret;
+}
+
+// Remove a listener previously added with stepper_motor_register_event_cb()
+esp_err_t stepper_motor_unregister_event_cb(stepper_motor_event_cb_t cb, void *arg) {
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    portENTER_CRITICAL(&event_listeners_lock);
+    for (int i = 0; i < MOTOR_EVENT_MAX_LISTENERS; i++) {
+        if (event_listeners[i].cb == cb && event_listeners[i].arg == arg) {
+            event_listeners[i].cb = NULL;
+            event_listeners[i].arg = NULL;
+            ret = ESP_OK;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&event_listeners_lock);
+    return ret;
+}
+
+// Deliver an event to every registered listener
+static void motor_emit_event(const motor_event_t *event) {
+    motor_event_listener_t listeners[MOTOR_EVENT_MAX_LISTENERS];
+    
+    portENTER_CRITICAL(&event_listeners_lock);
+    memcpy(listeners, event_listeners, sizeof(listeners));
+    portEXIT_CRITICAL(&event_listeners_lock);
+    
+    for (int i = 0; i < MOTOR_EVENT_MAX_LISTENERS; i++) {
+        if (listeners[i].cb != NULL) {
+            listeners[i].cb(event, listeners[i].arg);
+        }
+    }
+}
+
+// Deliver an alert to every registered listener
+static void motor_emit_alert(stepper_motor_t *motor, motor_alert_type_t type) {
+    motor_alert_listener_t listeners[MOTOR_ALERT_MAX_LISTENERS];
+    motor_alert_t alert = {
+        .type = type,
+        .move_id = move_active ? move_id : 0,
+        .position = motor->current_position
+    };
+    
+    portENTER_CRITICAL(&event_listeners_lock);
+    memcpy(listeners, alert_listeners, sizeof(listeners));
+    portEXIT_CRITICAL(&event_listeners_lock);
+    
+    for (int i = 0; i < MOTOR_ALERT_MAX_LISTENERS; i++) {
+        if (listeners[i].cb != NULL) {
+            listeners[i].cb(&alert, listeners[i].arg);
+        }
+    }
+}
+
+// Close out the active move and report how it ended
+static void motor_finish_move(stepper_motor_t *motor, motor_event_type_t type) {
+    if (!move_active) {
+        return;
+    }
+    if (type == MOTOR_EVENT_MOVE_LIMIT) {
+        motor_emit_alert(motor, MOTOR_ALERT_LIMIT);
+    }
+    move_active = false;
+    
+    motor_event_t event = {
+        .type = type,
+        .move_id = move_id,
+        .position = motor->current_position,
+        .elapsed_ms = (uint32_t)((app_hal_time_us() - move_start_us) / 1000)
+    };
+    motor_emit_event(&event);
+}
+
+// Block the motor task for at least ms; a plain one-tick delay may end at the next tick
+static void motor_hold_ms(uint32_t ms) {
+    int64_t until = app_hal_time_us() + (int64_t)ms * 1000;
+    while (app_hal_time_us() < until) {
+        vTaskDelay(1);
+    }
+}
+
+// Drive nSLEEP; motor task only, so it cannot race a step
+static void motor_set_enabled(stepper_motor_t *motor, bool enabled) {
+    if (!enabled) {
+        motor->is_moving = false;
+        motor_stop_pins(motor);
+    }
+    bool waking = enabled && !motor_enabled;
+    motor_enabled = enabled;
+    motor_pin_set(motor->sleep_pin, MOTOR_SIG_SLEEP, enabled ? 1 : 0);
+    if (waking) {
+        motor_hold_ms(MOTOR_WAKE_MS);
+    }
+    ESP_LOGI(TAG, "Motor %s", enabled ? "enabled" : "disabled");
+}
+
+// Pulse nSLEEP to reset the driver logic, then return to the enable state the
+// clients last asked for; a driver that was disabled stays asleep
+static void motor_reset_driver(stepper_motor_t *motor) {
+    motor->is_moving = false;
+    motor_stop_pins(motor);
+    motor_finish_move(motor, MOTOR_EVENT_MOVE_ABORTED);
+    
+    motor_pin_set(motor->sleep_pin, MOTOR_SIG_SLEEP, 0);
+    motor_hold_ms(MOTOR_RESET_SLEEP_MS);
+    if (motor_enabled) {
+        motor_pin_set(motor->sleep_pin, MOTOR_SIG_SLEEP, 1);
+        motor_hold_ms(MOTOR_WAKE_MS);
+    }
+    ESP_LOGI(TAG, "Driver reset, motor %s", motor_enabled ? "enabled" : "disabled");
+}
+
+// Start a new move, superseding any move still in progress
+static void motor_start_move(stepper_motor_t *motor, int32_t target, uint16_t id) {
+    motor_finish_move(motor, MOTOR_EVENT_MOVE_ABORTED);
+    
+    // Clamp to soft limits
+    move_limited = false;
+    if (target > motor->max_position) {
+        target = motor->max_position;
+        move_limited = true;
+    }
+    if (target < motor->min_position) {
+        target = motor->min_position;
+        move_limited = true;
+    }
+    
+    motor->target_position = (int16_t)target;
+    motor->is_moving = true;
+    move_active = true;
+    move_id = id;
+    move_start_us = app_hal_time_us();
+}
+
+// A new flush generation ends the move in progress; commands queued before it are dropped
+static void motor_check_flush(stepper_motor_t *motor) {
+    uint8_t gen = motor_queue_gen;
+    if (gen == motor_gen_seen) {
+        return;
+    }
+    
+    motor_gen_seen = gen;
+    if (motor->is_moving) {
+        motor->is_moving = false;
+        motor_stop_pins(motor);
+    }
+    motor_finish_move(motor, MOTOR_EVENT_MOVE_ABORTED);
+    ESP_LOGW(TAG, "Command queue flushed");
+}
+
+// Commands that start or allow motion, refused while the motion gate is closed
+static bool motor_cmd_moves(motor_command_t command) {
+    return command == MOTOR_CMD_MOVE_ABSOLUTE || command == MOTOR_CMD_MOVE_RELATIVE ||
+           command == MOTOR_CMD_HOME || command == MOTOR_CMD_ENABLE;
+}
+
+// Apply a single queued command to the motor state
+static void motor_apply_command(stepper_motor_t *motor, const motor_cmd_msg_t *cmd) {
+    motor_check_flush(motor);
+    if (cmd->gen != motor_gen_seen) {
+        return;     // Queued before a flush
+    }
+    
+    stepper_motor_gate_t gate = motion_gate;
+    if (gate != NULL && motor_cmd_moves(cmd->command) && !gate()) {
+        ESP_LOGW(TAG, "Command %d refused, motion is inhibited", cmd->command);
+        return;
+    }
+    
+    motor_latency_dequeued(cmd);
+    DIAG_PROF_BEGIN(PROF_CMD_DISPATCH);
+    
+    switch (cmd->command) {
+        case MOTOR_CMD_STOP:
+            motor->is_moving = false;
+            motor_stop_pins(motor);
+            motor_finish_move(motor, MOTOR_EVENT_MOVE_ABORTED);
+            DIAG_TRACE(TRACE_EVT_MOTOR_STOP, motor->current_position, 0, 0);
+            break;
+            
+        case MOTOR_CMD_MOVE_ABSOLUTE:
+            motor_start_move(motor, cmd->parameter, cmd->move_id);
+            DIAG_TRACE(TRACE_EVT_MOTOR_MOVE, cmd->command, motor->target_position, cmd->move_id);
+            break;
+            
+        case MOTOR_CMD_MOVE_RELATIVE:
+            motor_start_move(motor, (int32_t)motor->current_position + cmd->parameter, cmd->move_id);
+            DIAG_TRACE(TRACE_EVT_MOTOR_MOVE, cmd->command, motor->target_position, cmd->move_id);
+            break;
+            
+        case MOTOR_CMD_HOME:
+            motor_start_move(motor, 0, cmd->move_id);
+            DIAG_TRACE(TRACE_EVT_MOTOR_MOVE, cmd->command, motor->target_position, cmd->move_id);
+            break;
+            
+        case MOTOR_CMD_SET_SPEED:
+            motor->speed_delay_ms = cmd->parameter;
+            DIAG_TRACE(TRACE_EVT_MOTOR_SPEED, cmd->parameter, 0, 0);
+            break;
+            
+        case MOTOR_CMD_ENABLE:
+            motor_set_enabled(motor, true);
+            break;
+            
+        case MOTOR_CMD_DISABLE:
+            motor_set_enabled(motor, false);
+            motor_finish_move(motor, MOTOR_EVENT_MOVE_ABORTED);
+            break;
+        
+        case MOTOR_CMD_RESET_DRIVER:
+            motor_reset_driver(motor);
+            break;
+            
+        default:
+            ESP_LOGW(TAG, "Unknown command: %d", cmd->command);
+            break;
+    }
+    
+    DIAG_PROF_END(PROF_CMD_DISPATCH);
 }
 
 // Motor control task
@@ -268,71 +1060,69 @@ void stepper_motor_task(void *pvParameters) {
     stepper_motor_t *motor = (stepper_motor_t *)pvParameters;
     motor_cmd_msg_t cmd;
     
-    ESP_LOGI(TAG, "Motor control task started");
+    motor_fault_irq_init(motor);
+    ESP_LOGI(TAG, "Motor control task started on core %d, priority %d", (int)xPortGetCoreID(), MOTOR_TASK_PRIO);
     
     while (1) {
-        // Check for commands
-        if (xQueueReceive(motor_command_queue, &cmd, pdMS_TO_TICKS(10)) == pdTRUE) {
-            switch (cmd.command) {
-                case MOTOR_CMD_STOP:
-                    motor->is_moving = false;
-                    motor_stop_pins(motor);
-                    ESP_LOGI(TAG, "Motor stopped");
-                    break;
-                    
-                case MOTOR_CMD_MOVE_ABSOLUTE:
-                    motor->target_position = cmd.parameter;
-                    motor->is_moving = true;
-                    ESP_LOGI(TAG, "Moving to position: %d", cmd.parameter);
-                    break;
-                    
-                case MOTOR_CMD_MOVE_RELATIVE:
-                    motor->target_position = motor->current_position + cmd.parameter;
-                    // Clamp to limits
-                    if (motor->target_position > motor->max_position) 
-                        motor->target_position = motor->max_position;
-                    if (motor->target_position < motor->min_position) 
-                        motor->target_position = motor->min_position;
-                    motor->is_moving = true;
-                    ESP_LOGI(TAG, "Moving relative: %d steps, target: %d", cmd.parameter, motor->target_position);
-                    break;
-                    
-                case MOTOR_CMD_HOME:
-                    motor->target_position = 0;
-                    motor->is_moving = true;
-                    ESP_LOGI(TAG, "Homing motor");
-                    break;
-                    
-                case MOTOR_CMD_SET_SPEED:
-                    motor->speed_delay_ms = cmd.parameter;
-                    ESP_LOGI(TAG, "Speed set to: %d ms", cmd.parameter);
-                    break;
-                    
-                case MOTOR_CMD_ENABLE:
-                    stepper_motor_enable(motor);
-                    break;
-                    
-                case MOTOR_CMD_DISABLE:
-                    stepper_motor_disable(motor);
-                    break;
-                    
-                default:
-                    ESP_LOGW(TAG, "Unknown command: %d", cmd.command);
-                    break;
+        // The pin is read before any wait. Fault edges that came before this read are
+        // answered by it and must not cut the next step delay short.
+        motor_notify_collect();
+        motor_check_flush(motor);
+        bool faulted = stepper_motor_is_fault(motor);
+        if (!faulted) {
+            motor_notified &= ~MOTOR_NOTIFY_FAULT;
+        }
+        
+        // Check for commands; a batch is drained completely before the next step.
+        // Idle, this is the only wait, so the chip can sleep until a command or a
+        // fault edge comes. With a fault latched, queued commands are applied at once.
+        TickType_t wait = faulted ? 0 :
+                          app_hal_ms_to_ticks(motor->is_moving ? MOTOR_MOVE_POLL_MS : MOTOR_IDLE_POLL_MS);
+        if (motor_receive(&cmd, wait)) {
+            motor_apply_command(motor, &cmd);
+            while (cmd.batch_more &&
+                   xQueueReceive(motor_command_queue, &cmd, portMAX_DELAY) == pdTRUE) {
+                motor_apply_command(motor, &cmd);
+            }
+            
+            // Let producers know a slot was freed
+            if (queue_cb != NULL) {
+                queue_cb(uxQueueSpacesAvailable(motor_command_queue), queue_cb_arg);
             }
         }
         
-        // Check for faults
+        // Check for faults; outputs go off before anyone is told
         if (stepper_motor_is_fault(motor)) {
-            ESP_LOGE(TAG, "Motor fault detected!");
             motor->is_moving = false;
             motor_stop_pins(motor);
-            vTaskDelay(pdMS_TO_TICKS(1000)); // Wait before checking again
+            if (!fault_active) {
+                ESP_LOGE(TAG, "Motor fault detected!");
+                fault_active = true;
+                motor_emit_alert(motor, MOTOR_ALERT_FAULT);
+            }
+            motor_finish_move(motor, MOTOR_EVENT_MOVE_FAULT);
+            motor_record_idle();
+            motor_pm_hold(false);
+            
+            // Sleep until the fault interrupt, the re-check timer or a command
+            bool timed = timer_wheel_start(&motor_fault_timer, MOTOR_FAULT_RECHECK_MS, 0) == ESP_OK;
+            motor_wait(MOTOR_NOTIFY_FAULT | MOTOR_NOTIFY_CMD,
+                       timed ? portMAX_DELAY : pdMS_TO_TICKS(MOTOR_FAULT_RECHECK_MS));
             continue;
         }
+        if (fault_active) {
+            ESP_LOGI(TAG, "Motor fault cleared");
+            fault_active = false;
+            timer_wheel_stop(&motor_fault_timer);
+            motor_notify_collect();
+            motor_notified &= ~MOTOR_NOTIFY_FAULT;  // A late re-check must not cut the first step short
+            motor_emit_alert(motor, MOTOR_ALERT_FAULT_CLEARED);
+        }
         
         // Execute movement if needed
         if (motor->is_moving && motor->current_position != motor->target_position) {
+            motor_pm_hold(true);
+            
             // Determine direction
             if (motor->current_position < motor->target_position) {
                 motor->direction = true;  // Forward
@@ -345,21 +1135,36 @@ void stepper_motor_task(void *pvParameters) {
             }
             
             // Set motor pins for current step
+            DIAG_PROF_BEGIN(PROF_STEP_OUTPUT);
             set_motor_step(motor, motor->current_step);
+            motor_record_step(motor);
+            DIAG_PROF_END(PROF_STEP_OUTPUT);
             
             // Check if reached target
             if (motor->current_position == motor->target_position) {
                 motor->is_moving = false;
                 motor_stop_pins(motor);
-                ESP_LOGI(TAG, "Reached target position: %d", motor->current_position);
+                motor_finish_move(motor, move_limited ? MOTOR_EVENT_MOVE_LIMIT : MOTOR_EVENT_MOVE_COMPLETE);
+                DIAG_TRACE(TRACE_EVT_MOTOR_REACHED, motor->current_position, move_id, 0);
+                motor_pm_hold(false);
             }
             
-            // Delay for speed control
-            vTaskDelay(pdMS_TO_TICKS(motor->speed_delay_ms));
-        } else if (!motor->is_moving) {
+            // Delay for speed control; a fault edge ends it early
+            motor_wait(MOTOR_NOTIFY_FAULT, app_hal_ms_to_ticks(motor->speed_delay_ms));
+        } else if (motor->is_moving) {
+            // Already at the target (zero-length move)
+            motor->is_moving = false;
+            motor_finish_move(motor, move_limited ? MOTOR_EVENT_MOVE_LIMIT : MOTOR_EVENT_MOVE_COMPLETE);
+            motor_record_idle();
+            motor_pm_hold(false);
+        } else {
+            // Motion was cut short outside the task (e.g. stepper_motor_disable())
+            motor_finish_move(motor, MOTOR_EVENT_MOVE_ABORTED);
+            
             // If not moving, turn off motor pins to save power
             motor_stop_pins(motor);
-            vTaskDelay(pdMS_TO_TICKS(100)); // Longer delay when idle
+            motor_record_idle();
+            motor_pm_hold(false);
         }
     }
 }
@@ -370,7 +1175,7 @@ void stepper_motor_test_movement(stepper_motor_t *motor)
     ESP_LOGI(TAG, "Starting motor test - 10 seconds each direction");
     
     // Enable motor
-    gpio_set_level(motor->sleep_pin, 1);
+    motor_pin_set(motor->sleep_pin, MOTOR_SIG_SLEEP, 1);
     vTaskDelay(pdMS_TO_TICKS(100)); // Wait for driver to wake up
     
     // Set test speed (faster for testing)
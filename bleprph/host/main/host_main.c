@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "app_hal_sim.h"
+#include "cmd_codec.h"
+#include "common_types.h"
+#include "diag_capture.h"
+#include "diag_hist.h"
+#include "motor_test.h"
+#include "stepper_motor.h"
+#include "timer_wheel.h"
+
+static const char *TAG = "HOST_SIM";
+
+// Real time allowed for one move; the simulated clock runs faster
+#define SIM_MOVE_TIMEOUT_MS     10000
+
+// Moves sim_run_command_path() stamps with rx_us
+#define SIM_TIMED_MOVES         3
+
+// Decodes per codec benchmark case
+#define SIM_BENCH_ITERATIONS    100000
+
+static stepper_motor_t g_motor = {
+    .ain1_pin = DEFAULT_MOTOR_AIN1,
+    .ain2_pin = DEFAULT_MOTOR_AIN2,
+    .bin1_pin = DEFAULT_MOTOR_BIN1,
+    .bin2_pin = DEFAULT_MOTOR_BIN2,
+    .sleep_pin = DEFAULT_MOTOR_SLEEP,
+    .fault_pin = DEFAULT_MOTOR_FAULT
+};
+
+static QueueHandle_t sim_events = NULL;
+static int sim_failures = 0;
+
+static void sim_event_cb(const motor_event_t *event, void *arg) {
+    xQueueSend((QueueHandle_t)arg, event, 0);
+}
+
+// Feed one encoded frame through the codec shared by the GATT and L2CAP transports
+static esp_err_t sim_send_frame(const uint8_t *frame, size_t len) {
+    stepper_motor_cmd_t cmds[CMD_CODEC_BATCH_MAX_CMDS];
+    size_t count = 0;
+    
+    esp_err_t ret = cmd_codec_decode_command(frame, len, cmds, CMD_CODEC_BATCH_MAX_CMDS, &count);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    
+    uint32_t rx_us = (uint32_t)app_hal_time_us();
+    for (size_t i = 0; i < count; i++) {
+        cmds[i].rx_us = rx_us;
+    }
+    return stepper_motor_submit_batch(&g_motor, cmds, count);
+}
+
+// Block until the motor reports how a move ended
+static esp_err_t sim_wait_move(uint16_t move_id, motor_event_t *event) {
+    TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(SIM_MOVE_TIMEOUT_MS);
+    
+    while (1) {
+        TickType_t now = xTaskGetTickCount();
+        if ((int32_t)(deadline - now) <= 0 || xQueueReceive(sim_events, event, deadline - now) != pdTRUE) {
+            return ESP_ERR_TIMEOUT;
+        }
+        if (event->move_id == move_id) {
+            return ESP_OK;
+        }
+    }
+}
+
+// Real (unscaled) monotonic time, for benchmarks
+static int64_t sim_real_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sim_check(bool ok, const char *what) {
+    if (ok) {
+        ESP_LOGI(TAG, "PASS %s", what);
+    } else {
+        ESP_LOGE(TAG, "FAIL %s", what);
+        sim_failures++;
+    }
+}
+
+// Command path: tagged command, TLV batch and a driver fault, checked against the coils
+static void sim_run_command_path(void) {
+    motor_event_t event;
+    
+    // Tagged absolute move: [command][param:2][move_id:2]
+    uint32_t changes = app_hal_sim_get_coil_changes();
+    const uint8_t tagged[] = { MOTOR_CMD_MOVE_ABSOLUTE, 100, 0, 1, 0 };
+    sim_check(sim_send_frame(tagged, sizeof(tagged)) == ESP_OK, "tagged command accepted");
+    sim_check(sim_wait_move(1, &event) == ESP_OK && event.type == MOTOR_EVENT_MOVE_COMPLETE &&
+              event.position == 100, "tagged move reaches 100");
+    sim_check(app_hal_sim_get_coil_changes() - changes >= 100, "one coil change per step");
+    
+    app_hal_sim_coils_t coils;
+    app_hal_sim_get_coils(&coils);
+    sim_check(coils.coil_a == APP_HAL_SIM_COIL_OFF && coils.coil_b == APP_HAL_SIM_COIL_OFF,
+              "coils off after the move");
+    
+    // Batch: SET_SPEED 5, then MOVE_RELATIVE -40 tagged as move 2
+    const uint8_t batch[] = {
+        CMD_CODEC_BATCH_MARKER, 12,
+        MOTOR_CMD_SET_SPEED, 2, 5, 0,
+        CMD_CODEC_TLV_MOVE_ID, 2, 2, 0,
+        MOTOR_CMD_MOVE_RELATIVE, 2, 0xD8, 0xFF,
+    };
+    sim_check(sim_send_frame(batch, sizeof(batch)) == ESP_OK, "batch accepted");
+    sim_check(sim_wait_move(2, &event) == ESP_OK && event.type == MOTOR_EVENT_MOVE_COMPLETE &&
+              event.position == 60, "batch move reaches 60");
+    
+    // nFAULT during a move stops it and turns the coils off
+    const uint8_t faulted[] = { MOTOR_CMD_MOVE_ABSOLUTE, 0x2C, 0x01, 3, 0 };
+    sim_send_frame(faulted, sizeof(faulted));
+    vTaskDelay(pdMS_TO_TICKS(20));
+    app_hal_sim_set_fault(true);
+    sim_check(sim_wait_move(3, &event) == ESP_OK && event.type == MOTOR_EVENT_MOVE_FAULT &&
+              event.position < 300, "fault stops the move");
+    app_hal_sim_get_coils(&coils);
+    sim_check(coils.coil_a == APP_HAL_SIM_COIL_OFF && coils.coil_b == APP_HAL_SIM_COIL_OFF,
+              "coils off on fault");
+    app_hal_sim_set_fault(false);
+    stepper_motor_set_speed(&g_motor, MOTOR_DEFAULT_SPEED);
+}
+
+// Latency from frame receive to the first step of each move of the command path.
+// Stages and budget run on the simulated clock, like the firmware's own accounting.
+static void sim_check_latency(void) {
+    static const char *const stages[MOTOR_LATENCY_STAGE_COUNT] = {
+        "rx->queue", "queue wait", "dequeue->step", "total"
+    };
+    stepper_motor_latency_stats_t stats;
+    stepper_motor_get_latency_stats(&stats);
+    
+    for (int i = 0; i < MOTOR_LATENCY_STAGE_COUNT; i++) {
+        const diag_hist_t *hist = &stats.stage_us[i];
+        ESP_LOGI(TAG, "latency %-13s n=%lu p50=%lu p99=%lu max=%lu us", stages[i], (unsigned long)hist->count,
+                 (unsigned long)diag_hist_percentile(hist, 500), (unsigned long)diag_hist_percentile(hist, 990),
+                 (unsigned long)hist->max);
+    }
+    sim_check(stats.stage_us[MOTOR_LATENCY_TOTAL].count == SIM_TIMED_MOVES, "latency recorded for every move");
+    sim_check(stats.over_budget == 0 &&
+              stats.stage_us[MOTOR_LATENCY_TOTAL].max <= CONFIG_STEPPER_MOTOR_LATENCY_BUDGET_US,
+              "receive to first step within CONFIG_STEPPER_MOTOR_LATENCY_BUDGET_US");
+}
+
+// nFAULT without its interrupt: the motor task has to find the fault, and later
+// its release, by polling, and must still take the next move
+static void sim_run_fault_polling(void) {
+    motor_event_t event;
+    
+    app_hal_sim_mask_fault_irq(true);
+    const uint8_t faulted[] = { MOTOR_CMD_MOVE_ABSOLUTE, 0x58, 0x02, 4, 0 };
+    sim_send_frame(faulted, sizeof(faulted));
+    vTaskDelay(pdMS_TO_TICKS(20));
+    app_hal_sim_set_fault(true);
+    sim_check(sim_wait_move(4, &event) == ESP_OK && event.type == MOTOR_EVENT_MOVE_FAULT,
+              "polled fault stops the move");
+    
+    // Released without an edge; only the fault re-check timer can wake the task
+    app_hal_sim_set_fault(false);
+    const uint8_t next[] = { MOTOR_CMD_MOVE_ABSOLUTE, 100, 0, 5, 0 };
+    sim_check(sim_send_frame(next, sizeof(next)) == ESP_OK, "move queued after a polled fault");
+    sim_check(sim_wait_move(5, &event) == ESP_OK && event.type == MOTOR_EVENT_MOVE_COMPLETE &&
+              event.position == 100, "polled fault release resumes the motor");
+    app_hal_sim_mask_fault_irq(false);
+}
+
+// Decoders the GATT op table reaches through gatt_chr_op_t.decode, one payload each
+typedef struct {
+    const char *name;
+    cmd_codec_decode_fn decode;
+    const uint8_t *frame;
+    size_t len;
+} sim_codec_case_t;
+
+// Codec dispatch cost: an indirect call through the op's decoder, as gatt_chr_dispatch()
+// makes it. The NimBLE access callback itself has no linux port and is not timed here.
+static void sim_bench_codec(void) {
+    static const uint8_t position[] = { 0x2C, 0x01 };
+    static const uint8_t speed[] = { 5, 0 };
+    static const uint8_t single[] = { MOTOR_CMD_MOVE_RELATIVE, 10, 0 };
+    static const uint8_t tagged[] = { MOTOR_CMD_MOVE_ABSOLUTE, 100, 0, 7, 0 };
+    static const uint8_t batch[] = {
+        CMD_CODEC_BATCH_MARKER, 12,
+        MOTOR_CMD_SET_SPEED, 2, 5, 0,
+        CMD_CODEC_TLV_MOVE_ID, 2, 2, 0,
+        MOTOR_CMD_MOVE_RELATIVE, 2, 0xD8, 0xFF,
+    };
+    static const sim_codec_case_t cases[] = {
+        { "position", cmd_codec_decode_position, position, sizeof(position) },
+        { "speed", cmd_codec_decode_speed, speed, sizeof(speed) },
+        { "command", cmd_codec_decode_command, single, sizeof(single) },
+        { "tagged", cmd_codec_decode_command, tagged, sizeof(tagged) },
+        { "batch", cmd_codec_decode_command, batch, sizeof(batch) },
+    };
+    
+    bool ok = true;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        // volatile keeps the compiler from hoisting the call out of the loop
+        cmd_codec_decode_fn volatile decode = cases[c].decode;
+        stepper_motor_cmd_t cmds[CMD_CODEC_BATCH_MAX_CMDS];
+        size_t count = 0;
+        
+        int64_t start = sim_real_ns();
+        for (int i = 0; i < SIM_BENCH_ITERATIONS; i++) {
+            if (decode(cases[c].frame, cases[c].len, cmds, CMD_CODEC_BATCH_MAX_CMDS, &count) != ESP_OK) {
+                ok = false;
+                break;
+            }
+        }
+        int64_t elapsed = sim_real_ns() - start;
+        ESP_LOGI(TAG, "codec %-8s %3lld ns per decode, %u command(s)", cases[c].name,
+                 (long long)(elapsed / SIM_BENCH_ITERATIONS), (unsigned)count);
+    }
+    sim_check(ok, "codec decodes every benchmark frame");
+}
+
+// Write the pin capture as a binary SCAP dump for tools/capture_to_vcd.py and motor_plant.py
+static void sim_write_capture(const char *path) {
+    diag_capture_status_t status;
+    diag_capture_get_status(&status);
+    if (status.state == DIAG_CAPTURE_DONE) {
+        ESP_LOGW(TAG, "Capture filled after %lu records; later pin writes are missing",
+                 (unsigned long)status.count);
+    }
+    
+    size_t size = diag_capture_copy(NULL, 0);
+    uint8_t *dump = malloc(size);
+    FILE *f = fopen(path, "wb");
+    if (dump == NULL || f == NULL || diag_capture_copy(dump, size) != size ||
+        fwrite(dump, 1, size, f) != size) {
+        ESP_LOGE(TAG, "Cannot write %s", path);
+        sim_failures++;
+    } else {
+        ESP_LOGI(TAG, "Pin capture written to %s (%lu records)", path, (unsigned long)status.count);
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    free(dump);
+}
+
+void app_main(void) {
+    int64_t start_us = app_hal_time_us();
+    struct timespec real_start;
+    clock_gettime(CLOCK_MONOTONIC, &real_start);
+    
+    const app_hal_sim_drv8833_pins_t pins = {
+        .ain1 = DEFAULT_MOTOR_AIN1,
+        .ain2 = DEFAULT_MOTOR_AIN2,
+        .bin1 = DEFAULT_MOTOR_BIN1,
+        .bin2 = DEFAULT_MOTOR_BIN2,
+        .sleep = DEFAULT_MOTOR_SLEEP,
+        .fault = DEFAULT_MOTOR_FAULT,
+    };
+    app_hal_sim_drv8833_attach(&pins);
+    
+    // Record every driver pin write from the first one; the buffer freezes when full
+    const diag_capture_trigger_t trigger = { .mask = 0, .value = 0, .pre_samples = 0 };
+    diag_capture_arm(&trigger);
+    
+    sim_events = xQueueCreate(8, sizeof(motor_event_t));
+    if (sim_events == NULL || timer_wheel_init() != ESP_OK || stepper_motor_init(&g_motor) != ESP_OK ||
+        stepper_motor_register_event_cb(sim_event_cb, sim_events) != ESP_OK) {
+        ESP_LOGE(TAG, "Setup failed");
+        exit(EXIT_FAILURE);
+    }
+    
+    sim_bench_codec();
+    stepper_motor_reset_latency_stats();
+    sim_run_command_path();
+    sim_check_latency();
+    sim_run_fault_polling();
+    sim_check(motor_test_suite(&g_motor) == ESP_OK, "motor test suite");
+    
+    struct timespec real_end;
+    clock_gettime(CLOCK_MONOTONIC, &real_end);
+    int64_t real_ms = (real_end.tv_sec - real_start.tv_sec) * 1000 + (real_end.tv_nsec - real_start.tv_nsec) / 1000000;
+    int64_t sim_ms = (app_hal_time_us() - start_us) / 1000;
+    
+    stepper_motor_step_stats_t stats;
+    stepper_motor_get_step_stats(&stats);
+    ESP_LOGI(TAG, "%lld ms simulated in %lld ms, %lu steps, %lu coil changes", (long long)sim_ms,
+             (long long)real_ms, (unsigned long)stats.total_steps, (unsigned long)app_hal_sim_get_coil_changes());
+    
+    const char *capture = getenv("HOST_SIM_CAPTURE");
+    if (capture != NULL) {
+        sim_write_capture(capture);
+    }
+    
+    if (sim_failures > 0) {
+        ESP_LOGE(TAG, "%d check(s) failed", sim_failures);
+        exit(EXIT_FAILURE);
+    }
+    ESP_LOGI(TAG, "All checks passed");
+    exit(EXIT_SUCCESS);
+}
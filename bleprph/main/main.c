@@ -5,13 +5,24 @@
 #include "esp_log.h"
 #include "esp_system.h"
 #include "nvs_flash.h"
+#ifdef CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
 
 // Component includes
 #include "common_types.h"
 #include "stepper_motor.h"
 #include "ble_peripheral.h"
 #include "gatt_svr.h"
+#include "l2cap_coc.h"
+#include "ota_update.h"
+#include "diag_boot.h"
+#include "diag_power.h"
+#include "diag_sys.h"
+#include "diag_trace.h"
 #include "motor_test.h"
+#include "supervisor.h"
+#include "timer_wheel.h"
 
 static const char *TAG = "MAIN";
 
@@ -25,19 +36,39 @@ static stepper_motor_t g_motor = {
     .fault_pin = DEFAULT_MOTOR_FAULT
 };
 
-// System status
-static system_status_t system_status = SYSTEM_STATUS_INIT;
-
 // Function to initialize NVS
 static esp_err_t init_nvs(void) {
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        // Slow (whole partition) and rare; flagged so it stands out in the boot timeline
+        ESP_LOGW(TAG, "Erasing NVS: %s", esp_err_to_name(ret));
+        diag_boot_set_flags(DIAG_BOOT_FLAG_NVS_ERASED);
         ESP_ERROR_CHECK(nvs_flash_erase());
         ret = nvs_flash_init();
     }
     return ret;
 }
 
+// Dynamic frequency scaling, and automatic light sleep with tickless idle.
+// PM locks keep the chip up while the motor steps or the radio is busy.
+static esp_err_t init_pm(void) {
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_APP_PM_MIN_CPU_FREQ_MHZ,
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#endif
+    };
+    esp_err_t ret = esp_pm_configure(&pm_config);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to configure power management: %s", esp_err_to_name(ret));
+        return ret;
+    }
+#endif
+    return diag_power_init();
+}
+
 // Function to initialize motor
 static esp_err_t init_motor(void) {
     ESP_LOGI(TAG, "Initializing stepper motor...");
@@ -52,6 +83,15 @@ static esp_err_t init_motor(void) {
     return ESP_OK;
 }
 
+// Function to initialize firmware updates
+static esp_err_t init_ota(void) {
+    esp_err_t ret = ota_update_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to initialize OTA: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
 // Function to initialize BLE
 static esp_err_t init_ble(void) {
     ESP_LOGI(TAG, "Initializing BLE peripheral...");
@@ -62,17 +102,28 @@ static esp_err_t init_ble(void) {
         return ret;
     }
     
-    // Set motor instance for GATT server
-    gatt_svr_set_motor(&g_motor);
-    
     ESP_LOGI(TAG, "BLE initialized successfully");
     return ESP_OK;
 }
 
+// Motor task gate: no motion while a firmware image is received or waits for restart
+static bool motion_permitted(void) {
+    return !ota_update_is_active();
+}
+
+// Hand the motor to the GATT server and the L2CAP trajectory channel; commands
+// that arrive before this are rejected
+static void attach_motor(void) {
+    stepper_motor_set_motion_gate(motion_permitted);
+    gatt_svr_set_motor(&g_motor);
+    l2cap_coc_set_motor(&g_motor);
+    diag_boot_mark(BOOT_MOTOR_READY);
+}
+
 // Function to run motor tests (optional)
 static void run_motor_tests(void) {
     ESP_LOGI(TAG, "=== Starting Motor Test Suite ===");
-    system_status = SYSTEM_STATUS_TESTING;
+    supervisor_post(SUPERVISOR_EVT_TEST_START);
     
     esp_err_t ret = motor_test_suite(&g_motor);
     if (ret == ESP_OK) {
@@ -81,94 +132,81 @@ static void run_motor_tests(void) {
         ESP_LOGE(TAG, "=== Motor Test Suite Failed ===");
     }
     
-    system_status = SYSTEM_STATUS_READY;
-}
-
-// Main application task
-static void app_main_task(void *pvParameters) {
-    ESP_LOGI(TAG, "Main application task started");
-    
-    while (1) {
-        // Monitor system status
-        switch (system_status) {
-            case SYSTEM_STATUS_READY:
-                // Check for motor faults
-                if (stepper_motor_is_fault(&g_motor)) {
-                    ESP_LOGE(TAG, "Motor fault detected!");
-                    system_status = SYSTEM_STATUS_ERROR;
-                }
-                
-                // Log BLE connection status periodically
-                static int log_counter = 0;
-                if (++log_counter >= 100) { // Every 10 seconds
-                    log_counter = 0;
-                    if (ble_peripheral_is_connected()) {
-                        ESP_LOGI(TAG, "BLE connected, handle: %d", ble_peripheral_get_conn_handle());
-                    } else {
-                        ESP_LOGI(TAG, "BLE advertising, waiting for connection...");
-                    }
-                    
-                    // Log motor status
-                    motor_status_t motor_status = stepper_motor_get_status(&g_motor);
-                    int16_t position = stepper_motor_get_position(&g_motor);
-                    ESP_LOGI(TAG, "Motor status: %d, position: %d", motor_status, position);
-                }
-                break;
-                
-            case SYSTEM_STATUS_ERROR:
-                ESP_LOGE(TAG, "System in error state");
-                // Attempt to recover from error
-                vTaskDelay(pdMS_TO_TICKS(5000));
-                if (!stepper_motor_is_fault(&g_motor)) {
-                    ESP_LOGI(TAG, "Fault cleared, returning to ready state");
-                    system_status = SYSTEM_STATUS_READY;
-                }
-                break;
-                
-            case SYSTEM_STATUS_TESTING:
-                // Do nothing while tests are running
-                break;
-                
-            default:
-                break;
-        }
-        
-        // Task delay
-        vTaskDelay(pdMS_TO_TICKS(100));
-    }
+    supervisor_post(SUPERVISOR_EVT_TEST_END);
 }
 
 void app_main(void) {
+    diag_boot_mark(BOOT_APP_MAIN);
     ESP_LOGI(TAG, "===== ESP32 Stepper Motor Controller Starting =====");
-    ESP_LOGI(TAG, "Device: %s", DEVICE_NAME);
-    ESP_LOGI(TAG, "Version: %s", FIRMWARE_VERSION);
     
     esp_err_t ret;
     
-    // Initialize NVS
-    ESP_LOGI(TAG, "Initializing NVS...");
+    // Initialize NVS; the BLE controller keeps its PHY calibration there
     ret = init_nvs();
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to initialize NVS: %s", esp_err_to_name(ret));
         return;
     }
+    diag_boot_mark(BOOT_NVS_READY);
     
-    // Initialize motor
-    ret = init_motor();
+    // Periodic and one-shot jobs of every module below run on the timer wheel
+    ret = timer_wheel_init();
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Motor initialization failed, cannot continue");
+        ESP_LOGE(TAG, "Timer wheel failed, cannot continue");
         return;
     }
     
-    // Initialize BLE
+    // Tracing first so motor and BLE events from init are captured; it is optional
+    ret = diag_trace_init();
+    if (ret != ESP_OK && ret != ESP_ERR_NOT_SUPPORTED) {
+        ESP_LOGW(TAG, "Trace unavailable: %s", esp_err_to_name(ret));
+    }
+    
+    // Cached task, stack and heap snapshot for the Diagnostics Service; also optional
+    ret = diag_sys_init();
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "System snapshots unavailable: %s", esp_err_to_name(ret));
+    }
+    
+    // Power management is optional too; without it the chip stays at full speed
+    ret = init_pm();
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Power management unavailable: %s", esp_err_to_name(ret));
+    }
+    
+    // Firmware updates are optional; the actuator still works without them.
+    // Before BLE, because the update characteristics use the OTA queue.
+    ret = init_ota();
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "OTA unavailable");
+    }
+    
+    // BLE before the motor: the host syncs and starts advertising from its own
+    // task, so the motor and GPIO setup below runs while that happens
     ret = init_ble();
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "BLE initialization failed, cannot continue");
         return;
     }
+    diag_boot_mark(BOOT_BLE_STARTED);
     
-    // System is ready
-    system_status = SYSTEM_STATUS_READY;
+    // Initialize motor
+    ret = init_motor();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Motor initialization failed, cannot continue");
+        return;
+    }
+    attach_motor();
+    
+    // Motor and BLE came up, so an updated image can be updated again; keep it
+    ota_update_mark_valid();
+    
+    // System is ready; the supervisor reacts to faults, links and tests from here on
+    ret = supervisor_start(&g_motor);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start supervisor: %s", esp_err_to_name(ret));
+    }
+    diag_boot_mark(BOOT_INIT_DONE);
     ESP_LOGI(TAG, "===== System Initialization Complete =====");
     
     // Run motor tests (comment out if not needed)
@@ -176,11 +214,10 @@ void app_main(void) {
     run_motor_tests();
     #endif
     
-    // Create main application task
-    xTaskCreate(app_main_task, "app_main_task", 4096, NULL, 5, NULL);
-    
     ESP_LOGI(TAG, "===== System Running =====");
+    ESP_LOGI(TAG, "Device: %s, version: %s", DEVICE_NAME, FIRMWARE_VERSION);
     ESP_LOGI(TAG, "BLE device name: %s", BLE_DEVICE_NAME);
     ESP_LOGI(TAG, "Connect with a BLE client to control the motor");
     ESP_LOGI(TAG, "LED1: Motor activity, LED2: Enable status, LED3: Home command, LED4: Stop command");
+    timer_wheel_dump();
 }
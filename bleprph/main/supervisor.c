@@ -0,0 +1,244 @@
+#include "supervisor.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "app_alloc.h"
+#include "timer_wheel.h"
+#include "ble_peripheral.h"
+
+static const char *TAG = "SUPERVISOR";
+
+// Timer-driven work, in the bits above the public events
+#define SUP_EVT_HOUSEKEEPING    (1 << 6)
+#define SUP_EVT_RETRY           (1 << 7)
+#define SUP_EVT_ALL             (SUPERVISOR_EVT_FAULT | SUPERVISOR_EVT_FAULT_CLEARED | \
+                                 SUPERVISOR_EVT_CONNECT | SUPERVISOR_EVT_DISCONNECT | \
+                                 SUPERVISOR_EVT_TEST_START | SUPERVISOR_EVT_TEST_END | \
+                                 SUP_EVT_HOUSEKEEPING | SUP_EVT_RETRY)
+
+#define SUP_TASK_STACK          CONFIG_APP_MAIN_TASK_STACK_SIZE
+#define SUP_TASK_PRIO           5
+#define SUP_HOUSEKEEPING_MS     CONFIG_APP_SUPERVISOR_HOUSEKEEPING_MS
+
+// Fault recovery back-off
+#define SUP_RETRY_INITIAL_MS    CONFIG_APP_SUPERVISOR_RETRY_INITIAL_MS
+#define SUP_RETRY_MAX_MS        CONFIG_APP_SUPERVISOR_RETRY_MAX_MS
+#define SUP_RETRY_MULTIPLIER    CONFIG_APP_SUPERVISOR_RETRY_MULTIPLIER
+#define SUP_RETRY_LIMIT         CONFIG_APP_SUPERVISOR_RETRY_LIMIT       // 0 = no limit
+
+APP_TASK_MEM(sup_task_mem, SUP_TASK_STACK);
+APP_EVENT_GROUP_MEM(sup_events_mem);
+
+static EventGroupHandle_t sup_events = NULL;
+static timer_wheel_timer_t sup_housekeeping_timer;
+static timer_wheel_timer_t sup_retry_timer;
+static stepper_motor_t *sup_motor = NULL;
+static volatile system_status_t sup_status = SYSTEM_STATUS_INIT;
+
+// Recovery state, owned by the supervisor task
+static uint32_t sup_retry_ms = SUP_RETRY_INITIAL_MS;   // Delay before the next attempt
+static uint32_t sup_attempts = 0;
+static TickType_t sup_ready_since = 0;
+
+static void sup_alert_cb(const motor_alert_t *alert, void *arg) {
+    if (alert->type == MOTOR_ALERT_FAULT) {
+        supervisor_post(SUPERVISOR_EVT_FAULT);
+    } else if (alert->type == MOTOR_ALERT_FAULT_CLEARED) {
+        supervisor_post(SUPERVISOR_EVT_FAULT_CLEARED);
+    }
+}
+
+static void sup_conn_cb(uint16_t conn_handle, bool connected, void *arg) {
+    supervisor_post(connected ? SUPERVISOR_EVT_CONNECT : SUPERVISOR_EVT_DISCONNECT);
+}
+
+// Run in the timer wheel task; the work itself happens in the supervisor
+static void sup_timer_cb(void *arg) {
+    supervisor_post((uint32_t)(uintptr_t)arg);
+}
+
+static void sup_arm_retry(void) {
+    timer_wheel_start(&sup_retry_timer, sup_retry_ms, 0);
+}
+
+static void sup_enter_error(void) {
+    if (sup_status == SYSTEM_STATUS_ERROR) {
+        return;
+    }
+    
+    // A fault within one housekeeping period of the last recovery continues the
+    // back-off, so a flapping driver is not reset at the initial rate forever
+    if (xTaskGetTickCount() - sup_ready_since >= pdMS_TO_TICKS(SUP_HOUSEKEEPING_MS)) {
+        sup_retry_ms = SUP_RETRY_INITIAL_MS;
+        sup_attempts = 0;
+    }
+    
+    sup_status = SYSTEM_STATUS_ERROR;
+    ESP_LOGE(TAG, "Motor fault detected, recovery attempt in %lu ms", (unsigned long)sup_retry_ms);
+    sup_arm_retry();
+}
+
+// Sleep and wake the DRV8833; that resets its internal logic
+static void sup_reset_driver(void) {
+#ifdef CONFIG_APP_SUPERVISOR_RESET_DRIVER
+    if (stepper_motor_reset_driver(sup_motor) != ESP_OK) {
+        ESP_LOGW(TAG, "Driver reset not queued");
+    }
+#endif
+}
+
+// Called when nFAULT released or an attempt is due
+static void sup_try_recover(bool cleared) {
+    if (sup_status != SYSTEM_STATUS_ERROR) {
+        return;
+    }
+    
+    if (!stepper_motor_is_fault(sup_motor)) {
+        ESP_LOGI(TAG, "Fault cleared, returning to ready state");
+        sup_status = SYSTEM_STATUS_READY;
+        timer_wheel_stop(&sup_retry_timer);
+        sup_ready_since = xTaskGetTickCount();
+        return;
+    }
+    if (cleared) {
+        // Released and asserted again before we looked; keep the schedule
+        return;
+    }
+    
+    sup_attempts++;
+#if SUP_RETRY_LIMIT > 0
+    if (sup_attempts >= SUP_RETRY_LIMIT) {
+        ESP_LOGE(TAG, "Fault persists after %lu attempts, waiting for nFAULT to release",
+                 (unsigned long)sup_attempts);
+        return;
+    }
+#endif
+    
+    sup_reset_driver();
+    sup_retry_ms = sup_retry_ms * SUP_RETRY_MULTIPLIER;
+    if (sup_retry_ms > SUP_RETRY_MAX_MS) {
+        sup_retry_ms = SUP_RETRY_MAX_MS;
+    }
+    ESP_LOGW(TAG, "Fault persists (attempt %lu), next attempt in %lu ms",
+             (unsigned long)sup_attempts, (unsigned long)sup_retry_ms);
+    sup_arm_retry();
+}
+
+static void sup_housekeeping(void) {
+    // Backstop for a lost alert; the motor task reports faults as they happen
+    if (sup_status == SYSTEM_STATUS_READY && stepper_motor_is_fault(sup_motor)) {
+        sup_enter_error();
+    }
+    
+    if (ble_peripheral_is_connected()) {
+        ESP_LOGI(TAG, "BLE connected, handle: %d", ble_peripheral_get_conn_handle());
+    } else {
+        ESP_LOGI(TAG, "BLE advertising, waiting for connection...");
+    }
+    
+    motor_status_t motor_status = stepper_motor_get_status(sup_motor);
+    int16_t position = stepper_motor_get_position(sup_motor);
+    ESP_LOGI(TAG, "System status: %d, motor status: %d, position: %d", sup_status, motor_status, position);
+    
+    timer_wheel_stats_t wheel;
+    timer_wheel_get_stats(&wheel);
+    ESP_LOGI(TAG, "Timer wheel: %lu active timers, %lu wakeups, %lu callbacks", (unsigned long)wheel.active,
+             (unsigned long)wheel.wakeups, (unsigned long)wheel.fired);
+}
+
+static void sup_task(void *pvParameters) {
+    ESP_LOGI(TAG, "Supervisor started");
+    
+    while (1) {
+        EventBits_t bits = xEventGroupWaitBits(sup_events, SUP_EVT_ALL, pdTRUE, pdFALSE, portMAX_DELAY);
+        
+        if (bits & SUPERVISOR_EVT_TEST_START) {
+            ESP_LOGI(TAG, "Motor tests running");
+            sup_status = SYSTEM_STATUS_TESTING;
+            timer_wheel_stop(&sup_retry_timer);
+            bits &= ~SUP_EVT_RETRY;
+        }
+        if (bits & SUPERVISOR_EVT_TEST_END) {
+            ESP_LOGI(TAG, "Motor tests finished");
+            sup_status = SYSTEM_STATUS_READY;
+            sup_ready_since = xTaskGetTickCount();
+            
+            // A fault raised during the tests is handled now
+            if (stepper_motor_is_fault(sup_motor)) {
+                bits |= SUPERVISOR_EVT_FAULT;
+            }
+        }
+        
+        if (bits & SUPERVISOR_EVT_FAULT) {
+            if (sup_status == SYSTEM_STATUS_TESTING) {
+                ESP_LOGW(TAG, "Motor fault during tests");
+            } else {
+                sup_enter_error();
+            }
+        }
+        if (bits & (SUPERVISOR_EVT_FAULT_CLEARED | SUP_EVT_RETRY)) {
+            sup_try_recover(!(bits & SUP_EVT_RETRY));
+        }
+        
+        if (bits & (SUPERVISOR_EVT_CONNECT | SUPERVISOR_EVT_DISCONNECT)) {
+            ESP_LOGI(TAG, "BLE %s, %d/%d clients", (bits & SUPERVISOR_EVT_DISCONNECT) ? "disconnected" : "connected",
+                     ble_peripheral_get_conn_count(), BLE_PERIPHERAL_MAX_CONNS);
+        }
+        
+        if (bits & SUP_EVT_HOUSEKEEPING) {
+            sup_housekeeping();
+        }
+    }
+}
+
+esp_err_t supervisor_start(stepper_motor_t *motor) {
+    if (motor == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sup_motor = motor;
+    
+    sup_events = app_event_group_create(&sup_events_mem);
+    if (sup_events == NULL) {
+        ESP_LOGE(TAG, "Failed to create event group");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    timer_wheel_timer_init(&sup_housekeeping_timer, "sup_housekeep", sup_timer_cb,
+                           (void *)(uintptr_t)SUP_EVT_HOUSEKEEPING);
+    timer_wheel_timer_init(&sup_retry_timer, "sup_retry", sup_timer_cb, (void *)(uintptr_t)SUP_EVT_RETRY);
+    
+    // READY before the task runs, so a fault from now on moves it to ERROR
+    sup_status = SYSTEM_STATUS_READY;
+    sup_ready_since = xTaskGetTickCount();
+    if (app_task_create(&sup_task_mem, sup_task, "supervisor", SUP_TASK_STACK, NULL,
+                        SUP_TASK_PRIO, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create supervisor task");
+        return ESP_ERR_NO_MEM;
+    }
+    
+    esp_err_t ret = stepper_motor_register_alert_cb(sup_alert_cb, NULL);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register motor alert listener: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    ble_peripheral_set_conn_callback(sup_conn_cb, NULL);
+    timer_wheel_start(&sup_housekeeping_timer, SUP_HOUSEKEEPING_MS, SUP_HOUSEKEEPING_MS);
+    
+    // A fault that was already present raised its alert before we listened
+    if (stepper_motor_is_fault(motor)) {
+        supervisor_post(SUPERVISOR_EVT_FAULT);
+    }
+    return ESP_OK;
+}
+
+void supervisor_post(uint32_t events) {
+    if (sup_events != NULL) {
+        xEventGroupSetBits(sup_events, events);
+    }
+}
+
+system_status_t supervisor_get_status(void) {
+    return sup_status;
+}
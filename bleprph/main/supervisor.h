@@ -0,0 +1,45 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "common_types.h"
+#include "stepper_motor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Events posted to the supervisor; each wakes it at once */
+#define SUPERVISOR_EVT_FAULT            (1 << 0)    // nFAULT asserted (motor alert)
+#define SUPERVISOR_EVT_FAULT_CLEARED    (1 << 1)    // nFAULT released (motor alert)
+#define SUPERVISOR_EVT_CONNECT          (1 << 2)    // A BLE client connected
+#define SUPERVISOR_EVT_DISCONNECT       (1 << 3)    // A BLE client disconnected
+#define SUPERVISOR_EVT_TEST_START       (1 << 4)    // The motor test suite is about to run
+#define SUPERVISOR_EVT_TEST_END         (1 << 5)    // The motor test suite finished
+
+/**
+ * @brief Start the supervisor task and its housekeeping timer, and subscribe
+ *        to motor alerts and BLE link changes. The system enters READY.
+ * @param motor Motor to watch
+ * @return ESP_OK on success
+ */
+esp_err_t supervisor_start(stepper_motor_t *motor);
+
+/**
+ * @brief Post events to the supervisor. Safe from any task, not from an ISR.
+ * @param events SUPERVISOR_EVT_* bits
+ */
+void supervisor_post(uint32_t events);
+
+/**
+ * @brief Get the system state
+ * @return Current state, SYSTEM_STATUS_INIT before supervisor_start()
+ */
+system_status_t supervisor_get_status(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SUPERVISOR_H
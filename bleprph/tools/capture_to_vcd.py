@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Convert a signal capture dump (see diag_capture.h) to a VCD file.
+
+The input is either an idf.py monitor log holding the "CAP BEGIN" ...
+"CAP END" lines printed by diag_capture_dump(), or a raw binary dump in the
+same format. The last complete dump in a log is used.
+
+    python tools/capture_to_vcd.py monitor.log capture.vcd
+
+Open the result in GTKWave, PulseView or any other VCD viewer. Times are
+relative to the first record; a "trigger" marker rises on the trigger record.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+MAGIC = 0x50414353          # "SCAP"
+VERSION = 1
+MAX_SIGNALS = 8
+NAME_LEN = 8
+NO_TRIGGER = 0xFFFFFFFF
+
+HEADER = struct.Struct('<IHHII%ds' % (MAX_SIGNALS * NAME_LEN))
+RECORD = struct.Struct('<IBBH')
+
+CAP_LINE = re.compile(r'CAP ([0-9a-f]+)')         # Monitor lines may end in colour codes
+
+
+def read_dump(path):
+    """Return the raw dump bytes from a monitor log or a binary file."""
+    with open(path, 'rb') as f:
+        data = f.read()
+    if data[:4] == struct.pack('<I', MAGIC):
+        return data
+
+    dump = None
+    current = None
+    for line in data.decode('utf-8', errors='replace').splitlines():
+        if 'CAP BEGIN' in line:
+            current = bytearray()
+        elif 'CAP END' in line:
+            if current is not None:
+                dump = bytes(current)
+            current = None
+        elif current is not None:
+            m = CAP_LINE.search(line)
+            if m:
+                current += bytes.fromhex(m.group(1))
+    if dump is None:
+        sys.exit('%s: no complete "CAP BEGIN" ... "CAP END" dump found' % path)
+    return dump
+
+
+def parse_dump(dump):
+    """Return (names, trigger_index, records) where records are (timestamp_us, state)."""
+    if len(dump) < HEADER.size:
+        sys.exit('dump too short for header (%d bytes)' % len(dump))
+    magic, version, record_size, count, trigger_index, raw_names = HEADER.unpack_from(dump)
+    if magic != MAGIC:
+        sys.exit('bad magic 0x%08x' % magic)
+    if version != VERSION or record_size != RECORD.size:
+        sys.exit('unsupported dump version %d, record size %d' % (version, record_size))
+    if len(dump) < HEADER.size + count * RECORD.size:
+        sys.exit('dump truncated: header says %d records' % count)
+
+    names = []
+    for i in range(MAX_SIGNALS):
+        name = raw_names[i * NAME_LEN:(i + 1) * NAME_LEN].split(b'\0', 1)[0].decode('ascii', errors='replace')
+        names.append(name)
+
+    records = []
+    for i in range(count):
+        timestamp_us, state, _written, _reserved = RECORD.unpack_from(dump, HEADER.size + i * RECORD.size)
+        records.append((timestamp_us, state))
+    return names, trigger_index, records
+
+
+def vcd_id(index):
+    """Short printable VCD identifier for a signal index."""
+    return chr(ord('!') + index)
+
+
+def write_vcd(out, names, trigger_index, records):
+    signals = [(bit, name) for bit, name in enumerate(names) if name]
+    trigger_id = vcd_id(MAX_SIGNALS)
+
+    out.write('$comment stepper signal capture $end\n')
+    out.write('$timescale 1 us $end\n')
+    out.write('$scope module capture $end\n')
+    for bit, name in signals:
+        out.write('$var wire 1 %s %s $end\n' % (vcd_id(bit), name))
+    out.write('$var wire 1 %s trigger $end\n' % trigger_id)
+    out.write('$upscope $end\n')
+    out.write('$enddefinitions $end\n')
+
+    if not records:
+        return
+
+    # Timestamps are 32-bit esp_timer microseconds; unwrap across the ~71 minute rollover
+    t0 = records[0][0]
+    prev_ts = t0
+    elapsed = 0
+    prev_state = None
+    for index, (timestamp_us, state) in enumerate(records):
+        elapsed += (timestamp_us - prev_ts) & 0xFFFFFFFF
+        prev_ts = timestamp_us
+        changes = []
+        for bit, _name in signals:
+            level = (state >> bit) & 1
+            if prev_state is None or level != (prev_state >> bit) & 1:
+                changes.append('%d%s' % (level, vcd_id(bit)))
+        if index == 0:
+            changes.append('%d%s' % (1 if trigger_index == 0 else 0, trigger_id))
+        elif index == trigger_index:
+            changes.append('1%s' % trigger_id)
+        if changes:
+            out.write('#%d\n' % elapsed)
+            out.write('\n'.join(changes) + '\n')
+        prev_state = state
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('input', help='monitor log or raw binary dump')
+    parser.add_argument('output', nargs='?', help='VCD file (default: stdout)')
+    args = parser.parse_args()
+
+    names, trigger_index, records = parse_dump(read_dump(args.input))
+    if args.output:
+        with open(args.output, 'w') as out:
+            write_vcd(out, names, trigger_index, records)
+    else:
+        write_vcd(sys.stdout, names, trigger_index, records)
+
+    trigger = 'none' if trigger_index == NO_TRIGGER else str(trigger_index)
+    print('%d records, trigger at %s' % (len(records), trigger), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
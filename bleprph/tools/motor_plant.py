@@ -0,0 +1,549 @@
+#!/usr/bin/env python3
+"""Simulate the stepper motor and lead screw against a coil drive sequence.
+
+The plant is the actuator behind the DRV8833: a two-phase permanent magnet
+stepper with STEPS_PER_REVOLUTION full steps (read from stepper_motor.h),
+driving a lead screw of THREAD_PITCH_MM. Each run feeds it a list of coil
+phase changes and reports how far the rotor followed: missed steps, the lag
+behind the commanded step (load angle), overshoot and step-to-step ringing.
+
+    python tools/motor_plant.py firmware --delay-ms 10
+    python tools/motor_plant.py trapezoid --vmax 800 --accel 4000
+    python tools/motor_plant.py replay capture.bin
+    python tools/motor_plant.py check capture.bin
+    python tools/motor_plant.py sweep --vmax 200:2000:100 --accel 1000:20000:1000
+    python tools/motor_plant.py sweep --delay-ms 1:20 --jobs 4
+
+"firmware" generates the driver's own sequence: the full-step table with the
+motor task's step period, the command poll (MOTOR_MOVE_POLL_MS) plus the
+delay, each rounded down to whole RTOS ticks (CONFIG_FREERTOS_HZ from
+sdkconfig), and the coils switched off right after the last step.
+"trapezoid" uses the same table with an acceleration ramp. "replay" reads
+a pin capture (diag_capture.h): the binary dump the host simulation writes
+to HOST_SIM_CAPTURE (see host/README.md), or a monitor log holding a
+firmware dump. The coil drive is rebuilt from the AIN, BIN and SLEEP levels
+as the DRV8833 applies them. "check" compares the step period of the first
+move in a host capture with the firmware model at the host build's tick
+rate and speed-up, and fails if they differ by half a tick or more. "sweep" runs a grid of profiles over a full stroke in
+parallel, one process per core, and prints the fastest safe one.
+
+Model, per integration step:
+    L di/dt = V u - R i - e              per phase; e is the back-EMF
+    J dw/dt = T_coil + T_detent - B w - T_friction - T_screw
+T_coil = Kt (-ia sin(p th) + ib cos(p th)) with p = steps_per_rev / 4 pole
+pairs, T_detent = -Td sin(4 p th). A coil whose bridge is off coasts: its
+current decays against the supply until it reaches zero, as with both
+DRV8833 inputs low. The torque-speed curve is not a table; it follows from
+the winding L/R and back-EMF. The screw is self-locking (efficiency below
+50%), so its load torque F p / (2 pi eta) always opposes motion.
+
+A profile is safe when no step is missed and the load angle before each step
+stays below --max-lag full steps. At one full step the rotor sits at the peak
+of the torque curve and any extra load slips it by four steps.
+
+Motor parameters are defaults for a small 20-step can-stack actuator; measure
+yours and pass them with --params motor.json or --set name=value.
+"""
+
+import argparse
+import json
+import math
+import multiprocessing
+import os
+import re
+import sys
+
+import capture_to_vcd
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+MOTOR_HEADER = os.path.join(ROOT, 'components', 'stepper_motor', 'include', 'stepper_motor.h')
+MOTOR_SOURCE = os.path.join(ROOT, 'components', 'stepper_motor', 'src', 'stepper_motor.c')
+SDKCONFIG = os.path.join(ROOT, 'sdkconfig')
+HOST_SDKCONFIGS = (os.path.join(ROOT, 'host', 'sdkconfig'), os.path.join(ROOT, 'host', 'sdkconfig.defaults'))
+
+# Full-step table of stepper_motor.c as (coil A, coil B) drive, +1 = xIN1 high
+STEP_SEQUENCE = ((1, 1), (-1, 1), (-1, -1), (1, -1))
+
+DEFAULTS = {
+    'steps_per_rev': 20,        # Replaced by STEPS_PER_REVOLUTION
+    'pitch_mm': 0.5,            # Replaced by THREAD_PITCH_MM
+    'stroke_mm': 78.74,         # Replaced by STROKE_LENGTH_MM
+    'supply_v': 5.0,            # DRV8833 VM
+    'phase_r': 10.0,            # Winding resistance, ohm
+    'phase_l': 0.006,           # Winding inductance, H
+    'kt': 0.005,                # Torque and back-EMF constant, Nm/A = V s/rad
+    'detent_nm': 0.0003,        # Detent torque amplitude, Nm
+    'rotor_j': 3e-8,            # Rotor and screw inertia, kg m^2
+    'carriage_kg': 0.05,        # Moving mass on the screw
+    'damping': 2e-6,            # Viscous damping, Nm s/rad
+    'friction_nm': 0.0002,      # Coulomb friction of bearings and nut, Nm
+    'load_n': 5.0,              # Axial load on the nut, N
+    'screw_eff': 0.35,          # Lead screw efficiency
+}
+
+DEFINE = re.compile(r'^\s*#define\s+(STEPS_PER_REVOLUTION|THREAD_PITCH_MM|STROKE_LENGTH_MM)\s+([0-9.]+)', re.M)
+HEADER_KEYS = {'STEPS_PER_REVOLUTION': 'steps_per_rev', 'THREAD_PITCH_MM': 'pitch_mm',
+               'STROKE_LENGTH_MM': 'stroke_mm'}
+
+HALF_PI = math.pi / 2
+
+
+def load_params(path, overrides):
+    """Defaults, then the firmware geometry, then a JSON file, then --set."""
+    params = dict(DEFAULTS)
+    if os.path.exists(MOTOR_HEADER):
+        with open(MOTOR_HEADER) as f:
+            for name, value in DEFINE.findall(f.read()):
+                params[HEADER_KEYS[name]] = float(value)
+    if path:
+        with open(path) as f:
+            params.update({k: v for k, v in json.load(f).items() if not k.startswith('_')})
+    for item in overrides or []:
+        key, _, value = item.partition('=')
+        if key not in params:
+            sys.exit('unknown parameter %s; known: %s' % (key, ', '.join(sorted(params))))
+        params[key] = float(value)
+    params['steps_per_rev'] = int(params['steps_per_rev'])
+    return params
+
+
+def config_int(paths, name, default):
+    """An integer option from the first sdkconfig in paths that sets it."""
+    for path in paths:
+        if os.path.exists(path):
+            with open(path) as f:
+                m = re.search(r'^%s=(\d+)' % name, f.read(), re.M)
+                if m:
+                    return int(m.group(1))
+    return default
+
+
+def tick_hz():
+    """CONFIG_FREERTOS_HZ of the firmware build, 100 if there is no sdkconfig."""
+    return config_int((SDKCONFIG,), 'CONFIG_FREERTOS_HZ', 100)
+
+
+def move_poll_ms():
+    """MOTOR_MOVE_POLL_MS of stepper_motor.c: the command poll before every step."""
+    if os.path.exists(MOTOR_SOURCE):
+        with open(MOTOR_SOURCE) as f:
+            m = re.search(r'^#define\s+MOTOR_MOVE_POLL_MS\s+(\d+)', f.read(), re.M)
+            if m:
+                return int(m.group(1))
+    return 10
+
+
+def stroke_steps(params):
+    return int(round(params['stroke_mm'] * params['steps_per_rev'] / params['pitch_mm']))
+
+
+def resonance_hz(params):
+    """Small-signal natural frequency of the rotor around a two-phase-on step."""
+    pole_pairs = params['steps_per_rev'] / 4
+    current = params['supply_v'] / params['phase_r']
+    stiffness = pole_pairs * math.sqrt(2) * params['kt'] * current
+    return math.sqrt(stiffness / effective_inertia(params)) / (2 * math.pi)
+
+
+def effective_inertia(params):
+    lead_m = params['pitch_mm'] / 1000
+    return params['rotor_j'] + params['carriage_kg'] * (lead_m / (2 * math.pi)) ** 2
+
+
+def steps_to_events(step_times, hold_s):
+    """Coil events (t, a, b) for forward steps at the given times, starting
+    from table entry 0 and switching off hold_s after the last step."""
+    events = []
+    for n, t in enumerate(step_times):
+        a, b = STEP_SEQUENCE[(n + 1) % 4]
+        events.append((t, a, b))
+    if step_times:
+        events.append((step_times[-1] + hold_s, 0, 0))
+    return events
+
+
+def wait_ticks(ms, hz, speedup=1):
+    """app_hal_ms_to_ticks(): pdMS_TO_TICKS(), divided by the simulator speed-up
+    and rounded up on the host."""
+    ticks = ms * hz // 1000
+    return -(-ticks // speedup) if ticks > 0 else 0
+
+
+def firmware_period(delay_ms, hz, speedup=1):
+    """Step period of the motor task in seconds of the app_hal_time_us() clock. Each
+    loop waits in xQueueReceive() for the command poll, steps, then waits in
+    ulTaskNotifyTake() for the delay; both block from a tick boundary, so the
+    period is their sum in whole ticks."""
+    ticks = wait_ticks(move_poll_ms(), hz, speedup) + wait_ticks(delay_ms, hz, speedup)
+    return ticks * speedup / hz
+
+
+def firmware_times(steps, delay_ms, hz, speedup=1):
+    """Step times of the driver at a constant delay."""
+    interval = firmware_period(delay_ms, hz, speedup)
+    return [n * interval for n in range(steps)]
+
+
+def trapezoid_times(steps, vmax, accel, vstart):
+    """Step times for a symmetric ramp from vstart to vmax (steps/s, steps/s^2)."""
+    vmax = max(vmax, vstart)
+    distance = steps - 1
+
+    def ramp_time(x):
+        return (math.sqrt(vstart * vstart + 2 * accel * x) - vstart) / accel
+
+    ramp = (vmax * vmax - vstart * vstart) / (2 * accel)
+    if 2 * ramp > distance:
+        ramp = distance / 2
+        vmax = math.sqrt(vstart * vstart + 2 * accel * ramp)
+    t_ramp = ramp_time(ramp)
+    total = 2 * t_ramp + (distance - 2 * ramp) / vmax
+
+    times = []
+    for x in range(steps):
+        if x <= ramp:
+            times.append(ramp_time(x))
+        elif x < distance - ramp:
+            times.append(t_ramp + (x - ramp) / vmax)
+        else:
+            times.append(total - ramp_time(distance - x))
+    return times
+
+
+def bridge(state, in1, in2):
+    """DRV8833 bridge drive from its two input bits: +1 forward, -1 reverse, 0 off."""
+    a = (state >> in1) & 1
+    b = (state >> in2) & 1
+    if a == b:
+        return 0
+    return 1 if a else -1
+
+
+def read_capture(path):
+    """Coil events (time_s, coil_a, coil_b) from a pin capture, one per change
+    of the coil drive. Times start at the first record."""
+    names, _trigger, records = capture_to_vcd.parse_dump(capture_to_vcd.read_dump(path))
+    try:
+        ain1, ain2, bin1, bin2, sleep = (names.index(n) for n in ('AIN1', 'AIN2', 'BIN1', 'BIN2', 'SLEEP'))
+    except ValueError:
+        sys.exit('%s: capture does not name the AIN, BIN and SLEEP signals' % path)
+
+    events = []
+    elapsed = 0
+    prev_ts = records[0][0] if records else 0
+    for timestamp_us, state in records:
+        elapsed += (timestamp_us - prev_ts) & 0xFFFFFFFF     # 32-bit microseconds
+        prev_ts = timestamp_us
+        awake = (state >> sleep) & 1
+        coils = (bridge(state, ain1, ain2), bridge(state, bin1, bin2)) if awake else (0, 0)
+        if not events or coils != events[-1][1:]:
+            events.append((elapsed * 1e-6,) + coils)
+    if not events:
+        sys.exit('%s: no coil events' % path)
+    return events
+
+
+def first_move_intervals(events):
+    """Intervals between the steps of the first move in a capture, up to the
+    coils switching off."""
+    times = []
+    for t, a, b in events:
+        if a or b:
+            times.append(t)
+        elif times:
+            break
+    return [b - a for a, b in zip(times, times[1:])]
+
+
+def check_capture(path, args):
+    """Compare the first move of a host simulation capture with the firmware model."""
+    hz = args.tick_hz or config_int(HOST_SDKCONFIGS, 'CONFIG_FREERTOS_HZ', 1000)
+    speedup = args.speedup or config_int(HOST_SDKCONFIGS, 'CONFIG_APP_HAL_SIM_SPEEDUP', 1)
+    delay_ms = int(args.delay_ms or 10)
+    intervals = sorted(first_move_intervals(read_capture(path)))
+    if not intervals:
+        sys.exit('%s: first move has fewer than two steps' % path)
+
+    median = intervals[len(intervals) // 2]
+    expected = firmware_period(delay_ms, hz, speedup)
+    tick = speedup / hz
+    ok = abs(median - expected) < tick / 2
+    print('step period    median %.1f ms over %d intervals (%.1f to %.1f ms)' %
+          (median * 1000, len(intervals), intervals[0] * 1000, intervals[-1] * 1000))
+    print('model          %.1f ms at --delay-ms %d, %d Hz, speed-up %d (tick %.1f ms)' %
+          (expected * 1000, delay_ms, hz, speedup, tick * 1000))
+    print('verdict        %s' % ('match' if ok else 'MISMATCH'))
+    sys.exit(0 if ok else 1)
+
+
+def simulate(params, events, rest=STEP_SEQUENCE[0], dt=20e-6, settle_s=0.1):
+    """Run the plant through the coil events, starting at rest on the
+    equilibrium of the coil state rest, and return the result dict."""
+    pole_pairs = params['steps_per_rev'] / 4
+    v_supply = params['supply_v']
+    r = params['phase_r']
+    inv_l = 1 / params['phase_l']
+    kt = params['kt']
+    detent = params['detent_nm']
+    inv_j = 1 / effective_inertia(params)
+    damping = params['damping']
+    lead_m = params['pitch_mm'] / 1000
+    coulomb = params['friction_nm'] + params['load_n'] * lead_m / (2 * math.pi * params['screw_eff'])
+
+    # Electrical angle
+    start = math.atan2(rest[1], rest[0])
+    phi = start
+    omega = 0.0
+    ia = ib = 0.0
+    ua = ub = 0
+    command = start         # Unwrapped equilibrium of the last powered state
+    commanded_steps = 0
+    direction = 1
+
+    lags = []               # Load angle in full steps just before each step
+    swings = []             # Overshoot past the command, per step
+    swing = 0.0
+    stall_step = None       # Step at which the rotor first fell two steps behind
+    max_overshoot = 0.0
+    peak_rate = 0.0
+
+    t = 0.0
+    end = events[-1][0] + settle_s if events else settle_s
+    index = 0
+    while t < end:
+        while index < len(events) and events[index][0] <= t:
+            _te, a, b = events[index]
+            index += 1
+            if a or b:
+                target = math.atan2(b, a)
+                delta = (target - command + math.pi) % (2 * math.pi) - math.pi
+                if delta != 0:
+                    if (ua or ub) and stall_step is None:
+                        lag = (command - phi) / HALF_PI * direction
+                        if abs(lag) >= 2:
+                            stall_step = commanded_steps
+                        else:
+                            lags.append(lag)
+                            swings.append(swing)
+                    swing = 0.0
+                    direction = 1 if delta > 0 else -1
+                commanded_steps += int(round(delta / HALF_PI))
+                command += delta
+            ua, ub = a, b
+
+        sin_e = math.sin(phi)
+        cos_e = math.cos(phi)
+        emf = kt * omega
+
+        # Windings: driven bridges see +-V, coasting ones decay to zero
+        if ua:
+            ia += (v_supply * ua - r * ia + emf * sin_e) * inv_l * dt
+        elif ia:
+            new = ia + (-math.copysign(v_supply, ia) - r * ia + emf * sin_e) * inv_l * dt
+            ia = new if new * ia > 0 else 0.0
+        if ub:
+            ib += (v_supply * ub - r * ib - emf * cos_e) * inv_l * dt
+        elif ib:
+            new = ib + (-math.copysign(v_supply, ib) - r * ib - emf * cos_e) * inv_l * dt
+            ib = new if new * ib > 0 else 0.0
+
+        # sin(4 phi) from the double angle, without another transcendental
+        sin_2 = 2 * sin_e * cos_e
+        cos_2 = cos_e * cos_e - sin_e * sin_e
+        torque = kt * (ib * cos_e - ia * sin_e) - detent * 2 * sin_2 * cos_2 - damping * omega
+
+        # Friction and the self-locking screw hold the rotor until the drive overcomes them
+        if omega == 0.0 and abs(torque) <= coulomb:
+            accel = 0.0
+        else:
+            sign = omega if omega != 0.0 else torque
+            accel = (torque - math.copysign(coulomb, sign)) * inv_j
+        new_omega = omega + accel * dt
+        if omega != 0.0 and new_omega * omega < 0 and abs(torque) <= coulomb:
+            new_omega = 0.0
+        omega = new_omega
+        phi += omega * pole_pairs * dt
+
+        if (ua or ub) and stall_step is None:
+            lead = (phi - command) / HALF_PI * direction
+            if lead > swing:
+                swing = lead
+                if lead > max_overshoot:
+                    max_overshoot = lead
+        rate = abs(omega) * params['steps_per_rev'] / (2 * math.pi)
+        if rate > peak_rate:
+            peak_rate = rate
+        t += dt
+
+    rotor_steps = (phi - start) / HALF_PI
+    error = commanded_steps - rotor_steps
+    missed = int(round(error / 4)) * 4
+
+    # Ringing: mean overshoot per step over the middle of the move, up to a stall
+    middle = swings[len(swings) // 5:len(swings) - len(swings) // 5] or swings
+    ringing = sum(middle) / len(middle) if middle else 0.0
+
+    moving = [te for te, a, b in events if a or b]
+    return {
+        'commanded_steps': commanded_steps,
+        'rotor_steps': rotor_steps,
+        'missed_steps': missed,
+        'final_error_mm': error * params['pitch_mm'] / params['steps_per_rev'],
+        'max_lag': max(lags, key=abs) if lags else 0.0,
+        'ringing': ringing,
+        'overshoot': max_overshoot,
+        'peak_rate': peak_rate,
+        'move_s': (moving[-1] - moving[0]) if moving else 0.0,
+        'stall_step': stall_step,
+    }
+
+
+def judge(result, args):
+    result['resonant'] = result['stall_step'] is None and result['ringing'] > args.ringing
+    result['safe'] = result['missed_steps'] == 0 and abs(result['max_lag']) < args.max_lag
+    return result
+
+
+def print_result(result, params):
+    print('move           %.3f s, %d steps commanded, rotor at %.2f' %
+          (result['move_s'], result['commanded_steps'], result['rotor_steps']))
+    print('missed steps   %d (final error %.3f mm)' % (result['missed_steps'], result['final_error_mm']))
+    if result['stall_step'] is not None:
+        print('stall          lost step at step %d; load angle below is up to there' % result['stall_step'])
+    print('load angle     max %.2f steps; overshoot %.2f per step, %.2f max' %
+          (result['max_lag'], result['ringing'], result['overshoot']))
+    print('peak rate      %.0f steps/s; natural frequency %.0f Hz' % (result['peak_rate'], resonance_hz(params)))
+    print('verdict        %s%s' % ('safe' if result['safe'] else 'UNSAFE',
+                                   ', resonant' if result['resonant'] else ''))
+
+
+def parse_range(text, kind=float):
+    """"a:b:step" or a comma list."""
+    if ':' in text:
+        start, stop, step = (kind(x) for x in text.split(':'))
+        values = []
+        value = start
+        while value <= stop + 1e-9:
+            values.append(value)
+            value += step
+        return values
+    return [kind(x) for x in text.split(',')]
+
+
+def sweep_point(job):
+    """One sweep point; runs in a worker process."""
+    params, profile, value, args = job
+    steps = stroke_steps(params)
+    if profile == 'firmware':
+        times = firmware_times(steps, value, args.tick_hz, args.speedup or 1)
+    else:
+        vmax, accel = value
+        times = trapezoid_times(steps, vmax, accel, args.vstart)
+    result = simulate(params, steps_to_events(times, args.hold_ms / 1000), dt=args.dt)
+    return profile, value, judge(result, args)
+
+
+def run_sweep(params, args):
+    if args.delay_ms:
+        jobs = [(params, 'firmware', d, args) for d in parse_range(args.delay_ms, int)]
+    else:
+        jobs = [(params, 'trapezoid', (v, a), args)
+                for v in parse_range(args.vmax or '200:2000:200')
+                for a in parse_range(args.accel or '2000:20000:2000')]
+
+    print('%d profiles over %.2f mm (%d steps), %d jobs; natural frequency %.0f Hz' %
+          (len(jobs), params['stroke_mm'], stroke_steps(params), args.jobs, resonance_hz(params)),
+          file=sys.stderr)
+    with multiprocessing.Pool(args.jobs) as pool:
+        results = pool.map(sweep_point, jobs, chunksize=1)
+
+    results.sort(key=lambda r: r[2]['move_s'])
+    print('%-22s %9s %7s %8s %8s %9s %s' % ('profile', 'move_s', 'missed', 'max_lag', 'ringing',
+                                             'overshoot', 'verdict'))
+    for profile, value, r in results:
+        name = 'delay %d ms' % value if profile == 'firmware' else 'vmax %g accel %g' % value
+        verdict = ('safe' if r['safe'] else 'UNSAFE') + (' resonant' if r['resonant'] else '')
+        print('%-22s %9.3f %7d %8.2f %8.2f %9.2f %s' % (name, r['move_s'], r['missed_steps'],
+                                                        r['max_lag'], r['ringing'], r['overshoot'],
+                                                        verdict))
+
+    if args.csv:
+        with open(args.csv, 'w') as f:
+            f.write('profile,value,move_s,missed_steps,max_lag,ringing,overshoot,peak_rate,safe,resonant\n')
+            for profile, value, r in results:
+                value = value if profile == 'firmware' else '%g/%g' % value
+                f.write('%s,%s,%.4f,%d,%.3f,%.3f,%.3f,%.0f,%d,%d\n' %
+                        (profile, value, r['move_s'], r['missed_steps'], r['max_lag'], r['ringing'],
+                         r['overshoot'], r['peak_rate'], r['safe'], r['resonant']))
+
+    best = next(((p, v, r) for p, v, r in results if r['safe'] and not r['resonant']), None)
+    if best is None:
+        print('No safe profile in the sweep', file=sys.stderr)
+        sys.exit(1)
+    profile, value, r = best
+    name = '--delay-ms %d' % value if profile == 'firmware' else '--vmax %g --accel %g' % value
+    print('Fastest safe profile: %s, %.3f s per stroke' % (name, r['move_s']))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('mode', choices=('firmware', 'trapezoid', 'replay', 'check', 'sweep'))
+    parser.add_argument('capture', nargs='?', help='pin capture for replay and check')
+    parser.add_argument('--params', help='JSON file of motor parameters')
+    parser.add_argument('--set', action='append', metavar='NAME=VALUE', help='override one parameter')
+    parser.add_argument('--steps', type=int, help='move length (default: STROKE_LENGTH_MM)')
+    parser.add_argument('--delay-ms', help='firmware step delay; a:b:step or list for sweep')
+    parser.add_argument('--vmax', help='trapezoid top rate, steps/s; a:b:step or list for sweep')
+    parser.add_argument('--accel', help='trapezoid acceleration, steps/s^2; a:b:step or list for sweep')
+    parser.add_argument('--vstart', type=float, default=50, help='trapezoid start and end rate (default 50)')
+    parser.add_argument('--hold-ms', type=float, default=0.05,
+                        help='coils on after the last step (default 0.05, as the driver)')
+    parser.add_argument('--tick-hz', type=int,
+                        help='RTOS tick rate (default: sdkconfig, host/sdkconfig for check)')
+    parser.add_argument('--speedup', type=int,
+                        help='simulated clock speed-up (default 1, host/sdkconfig for check)')
+    parser.add_argument('--max-lag', type=float, default=0.5,
+                        help='largest safe load angle in full steps (default 0.5)')
+    parser.add_argument('--ringing', type=float, default=0.5,
+                        help='mean overshoot per step, in full steps, reported as resonance (default 0.5)')
+    parser.add_argument('--dt', type=float, default=20e-6, help='integration step in s (default 20e-6)')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count() or 1, help='sweep processes (default: cores)')
+    parser.add_argument('--csv', help='write the sweep results to a CSV file')
+    args = parser.parse_args()
+
+    if args.mode == 'check':
+        if not args.capture:
+            parser.error('check needs a pin capture')
+        check_capture(args.capture, args)
+    if args.tick_hz is None:
+        args.tick_hz = tick_hz()
+
+    params = load_params(args.params, args.set)
+    if args.steps:
+        params['stroke_mm'] = args.steps * params['pitch_mm'] / params['steps_per_rev']
+    steps = stroke_steps(params)
+
+    if args.mode == 'sweep':
+        run_sweep(params, args)
+        return
+    if args.mode == 'replay':
+        if not args.capture:
+            parser.error('replay needs a pin capture')
+        events = read_capture(args.capture)
+        rest = next(((a, b) for _t, a, b in events if a or b), STEP_SEQUENCE[0])
+    elif args.mode == 'firmware':
+        times = firmware_times(steps, int(args.delay_ms or 10), args.tick_hz, args.speedup or 1)
+        events = steps_to_events(times, args.hold_ms / 1000)
+    else:
+        times = trapezoid_times(steps, float(args.vmax or 800), float(args.accel or 4000), args.vstart)
+        events = steps_to_events(times, args.hold_ms / 1000)
+    if args.mode != 'replay':
+        rest = STEP_SEQUENCE[0]
+
+    result = judge(simulate(params, events, rest, args.dt), args)
+    print_result(result, params)
+    sys.exit(0 if result['safe'] else 1)
+
+
+if __name__ == '__main__':
+    main()
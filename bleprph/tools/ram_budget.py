@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Report static DRAM use per component from the linker map, and check it
+against a budget.
+
+    idf.py build ram_budget
+    python tools/ram_budget.py build/bleprph.map [--budget tools/ram_budget.json]
+    python tools/ram_budget.py build/bleprph.map --write-budget tools/ram_budget.json --margin 10
+
+Static DRAM is .data plus .bss, which is what the heap is left with after
+boot. With CONFIG_APP_STATIC_ALLOC it includes task stacks and queues. The
+budget file maps component names to byte limits. Components without an entry
+are only reported. The exit status is 1 if any component is over budget.
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+from collections import defaultdict
+
+# Output sections that end up in DRAM (Xtensa and RISC-V targets)
+DRAM_SECTION = re.compile(r'^\.(dram0\.(data|bss)|noinit|flash\.rodata_noload)')
+# Input section line: [name] address size file
+INPUT_LINE = re.compile(r'^\s+(\S+)?\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$')
+ARCHIVE = re.compile(r'lib([^/\\]+)\.a\(')
+
+
+def component_of(path):
+    """Component name for an input file: lib<name>.a, or the object file name."""
+    m = ARCHIVE.search(path)
+    if m:
+        return m.group(1)
+    return os.path.basename(path)
+
+
+def parse_map(path):
+    """Return {component: {'data': bytes, 'bss': bytes}} for DRAM sections."""
+    usage = defaultdict(lambda: {'data': 0, 'bss': 0})
+    in_memory_map = False
+    output = None
+    pending = None          # Input section name whose address is on the next line
+
+    with open(path, errors='replace') as f:
+        for line in f:
+            line = line.rstrip('\n')
+            if not in_memory_map:
+                in_memory_map = line.startswith('Linker script and memory map')
+                continue
+            if line.startswith('.'):
+                output = line.split()[0]
+                pending = None
+                continue
+            if output is None or not DRAM_SECTION.match(output):
+                continue
+
+            m = INPUT_LINE.match(line)
+            if m is None:
+                stripped = line.strip()
+                if stripped.startswith('.') or stripped == 'COMMON':
+                    pending = stripped
+                continue
+            name = m.group(1) or pending
+            pending = None
+            size = int(m.group(3), 16)
+            if name is None or name.startswith('*') or size == 0:
+                continue
+            kind = 'bss' if ('bss' in output or 'bss' in name or name == 'COMMON' or 'noinit' in output) else 'data'
+            usage[component_of(m.group(4))][kind] += size
+    return usage
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('map', help='linker map file, build/<project>.map')
+    parser.add_argument('--budget', help='JSON budget file {component: bytes}; missing file means report only')
+    parser.add_argument('--write-budget', metavar='FILE', help='write the current usage plus --margin as a budget file')
+    parser.add_argument('--margin', type=int, default=10, help='headroom in percent for --write-budget (default 10)')
+    parser.add_argument('--top', type=int, default=0, help='only list the N largest components')
+    args = parser.parse_args()
+
+    usage = parse_map(args.map)
+    if not usage:
+        sys.exit('%s: no DRAM sections found; is this a linker map?' % args.map)
+
+    budget = {}
+    if args.budget and os.path.exists(args.budget):
+        with open(args.budget) as f:
+            budget = {k: v for k, v in json.load(f).items() if not k.startswith('_')}
+
+    rows = sorted(usage.items(), key=lambda kv: kv[1]['data'] + kv[1]['bss'], reverse=True)
+    if args.top:
+        rows = rows[:args.top]
+
+    over = []
+    print('%-28s %8s %8s %8s %8s' % ('component', 'data', 'bss', 'total', 'budget'))
+    for comp, u in rows:
+        total = u['data'] + u['bss']
+        limit = budget.get(comp)
+        mark = ''
+        if limit is not None and total > limit:
+            over.append(comp)
+            mark = '  OVER by %d' % (total - limit)
+        print('%-28s %8d %8d %8d %8s%s' % (comp, u['data'], u['bss'], total,
+                                           '-' if limit is None else limit, mark))
+    total = sum(u['data'] + u['bss'] for u in usage.values())
+    print('%-28s %8s %8s %8d' % ('all', '', '', total))
+
+    if args.write_budget:
+        out = {'_comment': 'Static DRAM budget in bytes per component; generated by tools/ram_budget.py '
+                           'with %d%% margin' % args.margin}
+        for comp, u in sorted(usage.items()):
+            out[comp] = (u['data'] + u['bss']) * (100 + args.margin) // 100
+        with open(args.write_budget, 'w') as f:
+            json.dump(out, f, indent=4)
+            f.write('\n')
+        print('Budget written to %s' % args.write_budget)
+
+    if over:
+        print('Over budget: %s' % ', '.join(over), file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()